@@ -0,0 +1,79 @@
+#ifndef RCMB_BINARY_WRITER_HPP
+#define RCMB_BINARY_WRITER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rcmb/common.hpp"
+
+namespace rcmb {
+
+// 探索結果のバイナリ表現を書き出すライタ
+// 木の形はタグのバイト列、値は double の列に分けて格納する
+// (JS 側からは Uint8Array / Float64Array としてそのまま読める)
+//
+// 組み合わせは行きがけ順に書き出す:
+//   葉     : タグ BINARY_TAG_LEAF、値 1 つ (素子の値)
+//   それ以外: タグ (並列なら BINARY_TAG_PARALLEL) | 子ノード数、
+//            値 1 つ (合成値)、続けて子ノード
+// 分圧器の組み合わせは値 3 つ (分圧比, 上側の数, 下側の数) に続けて
+// 上側・下側の組み合わせを書き出す
+class BinaryWriter {
+ public:
+  static constexpr uint8_t BINARY_TAG_LEAF = 0x00;
+  static constexpr uint8_t BINARY_TAG_PARALLEL = 0x80;
+  static constexpr uint8_t BINARY_TAG_NUM_CHILDREN_MASK = 0x7f;
+
+  std::vector<uint8_t> tags;
+  std::vector<double> values;
+
+  inline void put_tag(uint8_t tag) { tags.push_back(tag); }
+  inline void put_value(value_t value) {
+    values.push_back(static_cast<double>(value));
+  }
+
+  // 領域を残したまま内容を捨てる (次の探索で使い回す)
+  inline void clear() {
+    tags.clear();
+    values.clear();
+  }
+};
+
+// BinaryWriter で書き出したバイナリ表現を先頭から読むリーダ
+class BinaryReader {
+ public:
+  BinaryReader(const uint8_t* tags, size_t num_tags, const double* values,
+               size_t num_values)
+      : tags(tags), num_tags(num_tags), values(values),
+        num_values(num_values) {}
+
+  // 読み終えていれば false を返す
+  inline bool get_tag(uint8_t* tag) {
+    if (tag_pos >= num_tags) return false;
+    *tag = tags[tag_pos++];
+    return true;
+  }
+  inline bool get_value(value_t* value) {
+    if (value_pos >= num_values) return false;
+    *value = static_cast<value_t>(values[value_pos++]);
+    return true;
+  }
+
+  // 全て読み終えたか
+  inline bool at_end() const {
+    return tag_pos == num_tags && value_pos == num_values;
+  }
+
+ private:
+  const uint8_t* tags;
+  const size_t num_tags;
+  const double* values;
+  const size_t num_values;
+  size_t tag_pos = 0;
+  size_t value_pos = 0;
+};
+
+}  // namespace rcmb
+
+#endif
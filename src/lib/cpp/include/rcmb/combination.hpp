@@ -1,27 +1,34 @@
 #ifndef RCMB_COMBINATION_HPP
 #define RCMB_COMBINATION_HPP
 
+#include <atomic>
 #include <cmath>
+#include <memory_resource>
+#include <vector>
 
+#include "rcmb/binary_writer.hpp"
 #include "rcmb/common.hpp"
+#include "rcmb/json_writer.hpp"
+#include "rcmb/result_arena.hpp"
 #include "rcmb/topology.hpp"
 
 namespace rcmb {
 
-extern uint32_t num_combinations;
+extern std::atomic<uint32_t> num_combinations;
 
 class CombinationClass;
 using Combination = std::shared_ptr<CombinationClass>;
+using CombinationList = std::pmr::vector<Combination>;
 
 class CombinationClass {
  public:
   const ComponentType type;
   const Topology topology;
-  const std::vector<Combination> children;
+  const CombinationList children;
   const value_t value;
 
   CombinationClass(const Topology &topology, ComponentType type,
-                   std::vector<Combination> &&children, value_t val)
+                   CombinationList &&children, value_t val)
       : type(type),
         topology(topology),
         children(std::move(children)),
@@ -38,18 +45,62 @@ class CombinationClass {
   bool is_normalized() const;
   std::string to_string() const;
   std::string to_json_string() const;
+  void write_json(JsonWriter &writer) const;
+  void write_binary(BinaryWriter &writer) const;
 };
 
+// 子ノードの一覧は同じアリーナ (resource_of(arena)) から確保しておくこと
 static inline Combination create_combination(
-    const Topology &topology, ComponentType type,
-    std::vector<Combination> &&children, value_t value) {
-  return std::make_shared<CombinationClass>(topology, type, std::move(children),
-                                            value);
+    const ResultArena &arena, const Topology &topology, ComponentType type,
+    CombinationList &&children, value_t value) {
+  return allocate_result<CombinationClass>(arena, topology, type,
+                                           std::move(children), value);
 }
 
+// write_binary() で書き出した組み合わせを 1 つ読み込む (不正なら nullptr)
+// トポロジは読み込んだ木の形と同じものをキャッシュから引くので、探索で
+// 得た組み合わせと同じものになる
+Combination read_combination_binary(BinaryReader &reader, ComponentType type,
+                                    const ResultArena &arena = nullptr);
+
 #ifdef RCMB_IMPLEMENTATION
 
-uint32_t num_combinations = 0;
+std::atomic<uint32_t> num_combinations = 0;
+
+Combination read_combination_binary(BinaryReader &reader, ComponentType type,
+                                    const ResultArena &arena) {
+  uint8_t tag;
+  value_t value;
+  if (!reader.get_tag(&tag) || !reader.get_value(&value) ||
+      !value_is_valid(value)) {
+    return nullptr;
+  }
+  CombinationList children(resource_of(arena));
+  if (tag == BinaryWriter::BINARY_TAG_LEAF) {
+    return create_combination(arena, get_topologies(1, false)[0], type,
+                              std::move(children), value);
+  }
+
+  const int num_children = tag & BinaryWriter::BINARY_TAG_NUM_CHILDREN_MASK;
+  if (num_children < 2) {
+    return nullptr;
+  }
+  std::vector<Topology> child_topologies;
+  for (int i = 0; i < num_children; i++) {
+    Combination child = read_combination_binary(reader, type, arena);
+    if (!child) {
+      return nullptr;
+    }
+    child_topologies.emplace_back(child->topology);
+    children.emplace_back(std::move(child));
+  }
+  const bool parallel = (tag & BinaryWriter::BINARY_TAG_PARALLEL) != 0;
+  const Topology topology = find_cached_topology(parallel, child_topologies);
+  if (!topology) {
+    return nullptr;
+  }
+  return create_combination(arena, topology, type, std::move(children), value);
+}
 
 // 値が正しいか確認
 result_t CombinationClass::verify() const {
@@ -142,24 +193,45 @@ std::string CombinationClass::to_string() const {
 }
 
 std::string CombinationClass::to_json_string() const {
+  JsonWriter writer;
+  write_json(writer);
+  return writer.take();
+}
+
+void CombinationClass::write_json(JsonWriter &writer) const {
   if (is_leaf()) {
-    return value_to_json_string(value);
+    writer.put_value(value);
   } else {
-    std::string s = "{";
-    // s += std::string("\"num_leafs\":") +
-    //      std::to_string(num_leafs()) + ",";
-    s += std::string("\"parallel\":") +
-         (topology->parallel ? "true" : "false") + ",";
-    s += std::string("\"value\":") + value_to_json_string(value) + ",";
-    s += "\"children\":[";
+    writer.put("{\"parallel\":");
+    writer.put_bool(topology->parallel);
+    writer.put(",\"value\":");
+    writer.put_value(value);
+    writer.put(",\"children\":[");
     for (size_t i = 0; i < children.size(); i++) {
-      s += children[i]->to_json_string();
+      children[i]->write_json(writer);
       if (i + 1 < children.size()) {
-        s += ",";
+        writer.put(',');
       }
     }
-    s += "]}";
-    return s;
+    writer.put("]}");
+  }
+}
+
+void CombinationClass::write_binary(BinaryWriter &writer) const {
+  if (is_leaf()) {
+    writer.put_tag(BinaryWriter::BINARY_TAG_LEAF);
+    writer.put_value(value);
+  } else {
+    uint8_t tag = static_cast<uint8_t>(children.size()) &
+                  BinaryWriter::BINARY_TAG_NUM_CHILDREN_MASK;
+    if (topology->parallel) {
+      tag |= BinaryWriter::BINARY_TAG_PARALLEL;
+    }
+    writer.put_tag(tag);
+    writer.put_value(value);
+    for (const auto &child : children) {
+      child->write_binary(writer);
+    }
   }
 }
 
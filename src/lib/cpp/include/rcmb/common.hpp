@@ -2,11 +2,16 @@
 #define RCMB_COMMON_HPP
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
 #include <cmath>
 #include <cstdint>
 #include <exception>
 #include <limits>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #ifdef RCMB_DEBUG
@@ -36,6 +41,11 @@ enum class result_t {
   PARAMETER_RANGE_REVERSAL,
   INVALID_ELEMENT_VALUE_LIST,
   INTERNAL_CORRUPTION,
+  SEARCH_CANCELLED,
+  SEARCH_IN_PROGRESS,
+  FILE_IO_ERROR,
+  INVALID_CACHE_FILE,
+  INVALID_JSON,
 };
 
 enum class topology_constraint_t {
@@ -46,6 +56,9 @@ enum class topology_constraint_t {
 
 static const int MAX_COMBINATION_ELEMENTS = 15;
 
+// std::make_shared の制御ブロックの大きさの目安 (メモリ使用量の見積もり用)
+static constexpr size_t CONTROL_BLOCK_SIZE = 16;
+
 static inline const char* result_to_string(result_t res) {
   switch (res) {
     case result_t::SUCCESS:
@@ -64,6 +77,16 @@ static inline const char* result_to_string(result_t res) {
       return "Invalid element value list.";
     case result_t::INTERNAL_CORRUPTION:
       return "Internal corruption.";
+    case result_t::SEARCH_CANCELLED:
+      return "The search was cancelled.";
+    case result_t::SEARCH_IN_PROGRESS:
+      return "The search is in progress.";
+    case result_t::FILE_IO_ERROR:
+      return "File I/O error.";
+    case result_t::INVALID_CACHE_FILE:
+      return "Invalid cache file.";
+    case result_t::INVALID_JSON:
+      return "Invalid JSON.";
     default:
       return "Unknown result.";
   }
@@ -96,8 +119,10 @@ static constexpr Prefix PREFIXES[] = {
 };
 static constexpr int NUM_PREFIXES = sizeof(PREFIXES) / sizeof(PREFIXES[0]);
 
-extern uint32_t next_object_id;
-inline uint32_t generate_object_id() { return next_object_id++; }
+extern std::atomic<uint32_t> next_object_id;
+inline uint32_t generate_object_id() {
+  return next_object_id.fetch_add(1, std::memory_order_relaxed);
+}
 
 static inline std::vector<value_t> sort_values(
     const std::vector<value_t>& values) {
@@ -107,15 +132,17 @@ static inline std::vector<value_t> sort_values(
 }
 
 value_t pow10(int exp);
+int floor_log10(value_t value);
 uint32_t valueKeyOf(value_t value);
-value_t parse_prefixed(std::string s);
+value_t parse_prefixed(std::string_view s);
 std::string value_to_prefixed(value_t value);
+int value_to_json_chars(value_t value, char* buffer);
 std::string value_to_json_string(value_t value);
 int zero_suppress(char* buffer, int len);
 
 #ifdef RCMB_IMPLEMENTATION
 
-uint32_t next_object_id = 1;
+std::atomic<uint32_t> next_object_id = 1;
 
 value_t pow10(int exp) {
   bool neg = exp < 0;
@@ -130,13 +157,75 @@ value_t pow10(int exp) {
   return neg ? (1 / ret) : ret;
 }
 
+// 10 のべき乗の表 (floor_log10 用)
+static constexpr int POW10_TABLE_MIN = -24;
+static constexpr int POW10_TABLE_MAX = 24;
+static constexpr value_t POW10_TABLE[] = {
+    1e-24, 1e-23, 1e-22, 1e-21, 1e-20, 1e-19, 1e-18, 1e-17, 1e-16, 1e-15, 1e-14,
+    1e-13, 1e-12, 1e-11, 1e-10, 1e-9, 1e-8, 1e-7, 1e-6, 1e-5, 1e-4, 1e-3, 1e-2,
+    1e-1, 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+    1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22, 1e23, 1e24};
+
+// floor(log10(value) + 1e-6) を表引きで求める
+int floor_log10(value_t value) {
+  // 10^(-1e-6): 境界をわずかに下げて丸め誤差を吸収する
+  constexpr value_t MARGIN = 0.99999769741756;
+
+  int exp2;
+  std::frexp(value, &exp2);
+  // floor((exp2 - 1) * log10(2)) を目安に前後を調べる
+  int exp = ((exp2 - 1) * 1233) >> 12;
+  if (!(POW10_TABLE_MIN < exp && exp < POW10_TABLE_MAX)) {
+    return static_cast<int>(std::floor(std::log10(value) + 1e-6));
+  }
+  const value_t* table = POW10_TABLE - POW10_TABLE_MIN;
+  if (value >= table[exp + 1] * MARGIN) {
+    exp++;
+  } else if (value < table[exp] * MARGIN) {
+    exp--;
+  }
+  return exp;
+}
+
 uint32_t valueKeyOf(value_t value) {
-  int exp = std::floor(std::log10(value) + 1e-6) - 6;
+  int exp = floor_log10(value) - 6;
   uint32_t frac = static_cast<uint32_t>(std::round(value * pow10(-exp)));
   return (exp + 128) << 24 | (frac & 0x00FFFFFF);
 }
 
-value_t parse_prefixed(std::string s) {
+// %.12lg 相当の文字列を buffer に書き込み、その長さを返す
+static inline int format_value_chars(value_t value, char* buffer, int size) {
+#if defined(__cpp_lib_to_chars)
+  const auto res = std::to_chars(buffer, buffer + size - 1, value,
+                                 std::chars_format::general, 12);
+  *res.ptr = '\0';
+  return static_cast<int>(res.ptr - buffer);
+#else
+  return std::snprintf(buffer, size, "%.12lg", value);
+#endif
+}
+
+// 先頭の数値を読み取る (std::stod 相当、読めない場合は例外)
+static inline value_t parse_value_chars(std::string_view s) {
+  while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front()))) {
+    s.remove_prefix(1);
+  }
+#if defined(__cpp_lib_to_chars)
+  if (!s.empty() && s.front() == '+') {
+    s.remove_prefix(1);
+  }
+  value_t value;
+  const auto res = std::from_chars(s.data(), s.data() + s.size(), value);
+  if (res.ec != std::errc()) {
+    throw std::invalid_argument("Invalid number: " + std::string(s));
+  }
+  return value;
+#else
+  return std::stod(std::string(s));
+#endif
+}
+
+value_t parse_prefixed(std::string_view s) {
   if (s.empty()) {
     return 0;
   }
@@ -146,12 +235,12 @@ value_t parse_prefixed(std::string s) {
   for (int i = 0; i < NUM_PREFIXES; i++) {
     if (PREFIXES[i].symbol == last_char) {
       exp = PREFIXES[i].exp;
-      s.pop_back();
+      s.remove_suffix(1);
       break;
     }
   }
 
-  value_t value = std::stod(s);
+  value_t value = parse_value_chars(s);
   if (exp > 0) {
     value *= pow10(exp);
   } else {
@@ -161,7 +250,7 @@ value_t parse_prefixed(std::string s) {
 }
 
 std::string value_to_prefixed(value_t value) {
-  int exp = std::floor(std::log10(value) + 1e-6);
+  int exp = floor_log10(value);
   if (exp < PREFIXES[0].exp) {
     exp = PREFIXES[0].exp;
   } else if (exp > PREFIXES[NUM_PREFIXES - 1].exp) {
@@ -183,18 +272,18 @@ std::string value_to_prefixed(value_t value) {
   }
 
   char buffer[32];
-  int len = std::snprintf(buffer, sizeof(buffer), "%.12lg", value);
+  int len = format_value_chars(value, buffer, sizeof(buffer));
   len = zero_suppress(buffer, len);
 
   if (prefix != '\0') {
-    buffer[len] = prefix;
-    buffer[len + 1] = '\0';
+    buffer[len++] = prefix;
   }
-  return std::string(buffer);
+  return std::string(buffer, len);
 }
 
-std::string value_to_json_string(value_t value) {
-  int exp = std::floor(std::log10(value) + 1e-6);
+// JSON 用の文字列を buffer (32 バイト以上) に書き込み、その長さを返す
+int value_to_json_chars(value_t value, char* buffer) {
+  int exp = floor_log10(value);
   exp = static_cast<int>(std::floor(static_cast<float>(exp) / 3)) * 3;
   if (-3 <= exp && exp < 6) {
     exp = 0;
@@ -205,15 +294,23 @@ std::string value_to_json_string(value_t value) {
     value *= pow10(-exp);
   }
 
-  char buffer[32];
-  int len = std::snprintf(buffer, sizeof(buffer), "%.12lg", value);
+  int len = format_value_chars(value, buffer, 32);
   len = zero_suppress(buffer, len);
 
   if (exp != 0) {
-    std::snprintf(buffer + len, sizeof(buffer) - len, "e%1d", exp);
+    buffer[len++] = 'e';
+    len = static_cast<int>(std::to_chars(buffer + len, buffer + 31, exp).ptr -
+                           buffer);
+    buffer[len] = '\0';
   }
 
-  return std::string(buffer);
+  return len;
+}
+
+std::string value_to_json_string(value_t value) {
+  char buffer[32];
+  const int len = value_to_json_chars(value, buffer);
+  return std::string(buffer, len);
 }
 
 int zero_suppress(char* buffer, int len) {
@@ -2,10 +2,14 @@
 #define RCMB_DOUBLE_COMBINATION_HPP
 
 #include <memory>
+#include <memory_resource>
 #include <vector>
 
+#include "rcmb/binary_writer.hpp"
 #include "rcmb/combination.hpp"
 #include "rcmb/common.hpp"
+#include "rcmb/json_writer.hpp"
+#include "rcmb/result_arena.hpp"
 
 namespace rcmb {
 
@@ -15,22 +19,56 @@ using DoubleCombination = std::shared_ptr<DoubleCombinationClass>;
 class DoubleCombinationClass {
  public:
   const value_t ratio;
-  std::vector<Combination> uppers;
-  std::vector<Combination> lowers;
+  CombinationList uppers;
+  CombinationList lowers;
 
-  DoubleCombinationClass(value_t ratio) : ratio(ratio) {}
+  DoubleCombinationClass(value_t ratio, std::pmr::memory_resource* resource =
+                                            std::pmr::get_default_resource())
+      : ratio(ratio), uppers(resource), lowers(resource) {}
 
   result_t verify() const;
   std::string to_json_string() const;
+  void write_json(JsonWriter& writer) const;
+  void write_binary(BinaryWriter& writer) const;
   std::string to_string() const;
 };
 
-static inline DoubleCombination create_double_combination(value_t ratio) {
-  return std::make_shared<DoubleCombinationClass>(ratio);
+static inline DoubleCombination create_double_combination(
+    const ResultArena& arena, value_t ratio) {
+  return allocate_result<DoubleCombinationClass>(arena, ratio,
+                                                 resource_of(arena));
 }
 
+// write_binary() で書き出した分圧抵抗の組み合わせを 1 つ読み込む
+// (不正なら nullptr)
+DoubleCombination read_double_combination_binary(
+    BinaryReader& reader, const ResultArena& arena = nullptr);
+
 #ifdef RCMB_IMPLEMENTATION
 
+DoubleCombination read_double_combination_binary(BinaryReader& reader,
+                                                 const ResultArena& arena) {
+  value_t ratio, num_uppers, num_lowers;
+  if (!reader.get_value(&ratio) || !reader.get_value(&num_uppers) ||
+      !reader.get_value(&num_lowers) || num_uppers < 1 || num_lowers < 1) {
+    return nullptr;
+  }
+  DoubleCombination comb = create_double_combination(arena, ratio);
+  for (int i = 0; i < static_cast<int>(num_uppers); i++) {
+    Combination upper =
+        read_combination_binary(reader, ComponentType::Resistor, arena);
+    if (!upper) return nullptr;
+    comb->uppers.emplace_back(std::move(upper));
+  }
+  for (int i = 0; i < static_cast<int>(num_lowers); i++) {
+    Combination lower =
+        read_combination_binary(reader, ComponentType::Resistor, arena);
+    if (!lower) return nullptr;
+    comb->lowers.emplace_back(std::move(lower));
+  }
+  return comb;
+}
+
 result_t DoubleCombinationClass::verify() const {
   if (uppers.empty() || lowers.empty()) {
     return result_t::BROKEN_TOPOLOGY;
@@ -84,26 +122,41 @@ result_t DoubleCombinationClass::verify() const {
 }
 
 std::string DoubleCombinationClass::to_json_string() const {
-  std::string s = "{";
-  s += std::string("\"ratio\":\"") + value_to_json_string(ratio) + "\",";
-  s += std::string("\"uppers\":[");
+  JsonWriter writer;
+  write_json(writer);
+  return writer.take();
+}
+
+void DoubleCombinationClass::write_json(JsonWriter& writer) const {
+  writer.put("{\"ratio\":");
+  writer.put_quoted_value(ratio);
+  writer.put(",\"uppers\":[");
   for (size_t i = 0; i < uppers.size(); i++) {
-    s += uppers[i]->to_json_string();
+    uppers[i]->write_json(writer);
     if (i + 1 < uppers.size()) {
-      s += ",";
+      writer.put(',');
     }
   }
-  s += "],";
-  s += std::string("\"lowers\":[");
+  writer.put("],\"lowers\":[");
   for (size_t i = 0; i < lowers.size(); i++) {
-    s += lowers[i]->to_json_string();
+    lowers[i]->write_json(writer);
     if (i + 1 < lowers.size()) {
-      s += ",";
+      writer.put(',');
     }
   }
-  s += "]";
-  s += "}";
-  return s;
+  writer.put("]}");
+}
+
+void DoubleCombinationClass::write_binary(BinaryWriter& writer) const {
+  writer.put_value(ratio);
+  writer.put_value(static_cast<value_t>(uppers.size()));
+  writer.put_value(static_cast<value_t>(lowers.size()));
+  for (const auto& comb : uppers) {
+    comb->write_binary(writer);
+  }
+  for (const auto& comb : lowers) {
+    comb->write_binary(writer);
+  }
 }
 
 std::string DoubleCombinationClass::to_string() const {
@@ -0,0 +1,258 @@
+#ifndef RCMB_JSON_READER_HPP
+#define RCMB_JSON_READER_HPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "rcmb/common.hpp"
+
+namespace rcmb {
+
+// 読み取った JSON の値
+// CLI の要求などの小さな JSON を読むためのもので、速度は重視しない
+class JsonValue {
+ public:
+  enum class kind_t { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+
+  kind_t kind = kind_t::NUL;
+  bool boolean = false;
+  double number = 0;
+  std::string str;
+  std::vector<JsonValue> items;
+  // オブジェクトのメンバ (書かれた順)
+  std::vector<std::pair<std::string, JsonValue>> members;
+
+  inline bool is_null() const { return kind == kind_t::NUL; }
+  inline bool is_bool() const { return kind == kind_t::BOOL; }
+  inline bool is_number() const { return kind == kind_t::NUMBER; }
+  inline bool is_string() const { return kind == kind_t::STRING; }
+  inline bool is_array() const { return kind == kind_t::ARRAY; }
+  inline bool is_object() const { return kind == kind_t::OBJECT; }
+
+  // オブジェクトのメンバを探す (無ければ nullptr)
+  const JsonValue* find(std::string_view key) const {
+    for (const auto& member : members) {
+      if (member.first == key) return &member.second;
+    }
+    return nullptr;
+  }
+};
+
+// text 全体を 1 つの JSON の値として読み取る
+result_t parse_json(std::string_view text, JsonValue& out);
+
+#ifdef RCMB_IMPLEMENTATION
+
+// 入れ子の深さの上限 (壊れた入力でスタックを使い切らないように)
+static constexpr int MAX_JSON_DEPTH = 64;
+
+class JsonParser {
+ public:
+  JsonParser(std::string_view text) : text(text) {}
+
+  bool parse(JsonValue& out) {
+    if (!parse_value(out, 0)) return false;
+    skip_spaces();
+    return pos == text.size();
+  }
+
+ private:
+  std::string_view text;
+  size_t pos = 0;
+
+  void skip_spaces() {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' ||
+                                 text[pos] == '\n' || text[pos] == '\r')) {
+      pos++;
+    }
+  }
+
+  bool consume(char c) {
+    skip_spaces();
+    if (pos < text.size() && text[pos] == c) {
+      pos++;
+      return true;
+    }
+    return false;
+  }
+
+  bool consume_word(std::string_view word) {
+    if (text.substr(pos, word.size()) != word) return false;
+    pos += word.size();
+    return true;
+  }
+
+  bool parse_value(JsonValue& out, int depth) {
+    if (depth > MAX_JSON_DEPTH) return false;
+    skip_spaces();
+    if (pos >= text.size()) return false;
+    const char c = text[pos];
+    if (c == '{') {
+      pos++;
+      out.kind = JsonValue::kind_t::OBJECT;
+      if (consume('}')) return true;
+      do {
+        std::string key;
+        skip_spaces();
+        if (!parse_string(key) || !consume(':')) return false;
+        out.members.emplace_back(std::move(key), JsonValue());
+        if (!parse_value(out.members.back().second, depth + 1)) return false;
+      } while (consume(','));
+      return consume('}');
+    } else if (c == '[') {
+      pos++;
+      out.kind = JsonValue::kind_t::ARRAY;
+      if (consume(']')) return true;
+      do {
+        out.items.emplace_back();
+        if (!parse_value(out.items.back(), depth + 1)) return false;
+      } while (consume(','));
+      return consume(']');
+    } else if (c == '"') {
+      out.kind = JsonValue::kind_t::STRING;
+      return parse_string(out.str);
+    } else if (c == 't' || c == 'f') {
+      out.kind = JsonValue::kind_t::BOOL;
+      out.boolean = (c == 't');
+      return consume_word(out.boolean ? "true" : "false");
+    } else if (c == 'n') {
+      out.kind = JsonValue::kind_t::NUL;
+      return consume_word("null");
+    } else {
+      out.kind = JsonValue::kind_t::NUMBER;
+      return parse_number(out.number);
+    }
+  }
+
+  bool parse_number(double& out) {
+    const size_t start = pos;
+    while (pos < text.size() &&
+           (('0' <= text[pos] && text[pos] <= '9') || text[pos] == '-' ||
+            text[pos] == '+' || text[pos] == '.' || text[pos] == 'e' ||
+            text[pos] == 'E')) {
+      pos++;
+    }
+    if (pos == start || text[start] == '+') return false;
+    // 数値の文字だけを切り出しているので接頭辞としては解釈されない
+    const std::string_view s = text.substr(start, pos - start);
+    try {
+      out = parse_prefixed(s);
+    } catch (const std::exception&) {
+      return false;
+    }
+    return true;
+  }
+
+  bool parse_hex4(uint32_t& out) {
+    if (pos + 4 > text.size()) return false;
+    out = 0;
+    for (int i = 0; i < 4; i++) {
+      const char c = text[pos++];
+      out <<= 4;
+      if ('0' <= c && c <= '9') {
+        out |= c - '0';
+      } else if ('a' <= c && c <= 'f') {
+        out |= c - 'a' + 10;
+      } else if ('A' <= c && c <= 'F') {
+        out |= c - 'A' + 10;
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // \uXXXX を UTF-8 にして追加する
+  bool parse_unicode_escape(std::string& out) {
+    uint32_t code;
+    if (!parse_hex4(code)) return false;
+    if (0xD800 <= code && code < 0xDC00) {
+      uint32_t low;
+      if (!consume_word("\\u") || !parse_hex4(low) ||
+          !(0xDC00 <= low && low < 0xE000)) {
+        return false;
+      }
+      code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+    }
+    if (code < 0x80) {
+      out.push_back(static_cast<char>(code));
+    } else if (code < 0x800) {
+      out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+      out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    } else if (code < 0x10000) {
+      out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+      out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    } else {
+      out.push_back(static_cast<char>(0xF0 | (code >> 18)));
+      out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+    return true;
+  }
+
+  bool parse_string(std::string& out) {
+    if (pos >= text.size() || text[pos] != '"') return false;
+    pos++;
+    while (pos < text.size()) {
+      const char c = text[pos++];
+      if (c == '"') return true;
+      if (static_cast<unsigned char>(c) < 0x20) return false;
+      if (c != '\\') {
+        out.push_back(c);
+        continue;
+      }
+      if (pos >= text.size()) return false;
+      const char e = text[pos++];
+      switch (e) {
+        case '"':
+        case '\\':
+        case '/':
+          out.push_back(e);
+          break;
+        case 'b':
+          out.push_back('\b');
+          break;
+        case 'f':
+          out.push_back('\f');
+          break;
+        case 'n':
+          out.push_back('\n');
+          break;
+        case 'r':
+          out.push_back('\r');
+          break;
+        case 't':
+          out.push_back('\t');
+          break;
+        case 'u':
+          if (!parse_unicode_escape(out)) return false;
+          break;
+        default:
+          return false;
+      }
+    }
+    return false;
+  }
+};
+
+result_t parse_json(std::string_view text, JsonValue& out) {
+  out = JsonValue();
+  JsonParser parser(text);
+  if (!parser.parse(out)) {
+    out = JsonValue();
+    return result_t::INVALID_JSON;
+  }
+  return result_t::SUCCESS;
+}
+
+#endif
+
+}  // namespace rcmb
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef RCMB_JSON_WRITER_HPP
+#define RCMB_JSON_WRITER_HPP
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include "rcmb/common.hpp"
+
+namespace rcmb {
+
+// JSON を 1 つのバッファに追記していくライタ
+// 出力先を指定した場合は、バッファが一定量たまるごとに出力先に渡す
+// (要素ごとの一時的な文字列は作らない)
+class JsonWriter {
+ public:
+  using sink_t = std::function<void(const char* data, size_t size)>;
+
+  // 出力先に渡すバッファの大きさの目安
+  static constexpr size_t DEFAULT_FLUSH_SIZE = 64 * 1024;
+
+  // バッファに追記するだけのライタ (str() または take() で取り出す)
+  JsonWriter() = default;
+
+  // バッファがたまるごとに sink に渡すライタ
+  JsonWriter(const sink_t& sink, size_t flush_size = DEFAULT_FLUSH_SIZE)
+      : sink(sink), flush_size(flush_size) {
+    buffer.reserve(flush_size);
+  }
+
+  // ファイルに書き出すライタ
+  JsonWriter(FILE* fp, size_t flush_size = DEFAULT_FLUSH_SIZE)
+      : JsonWriter(
+            [fp](const char* data, size_t size) {
+              std::fwrite(data, 1, size, fp);
+            },
+            flush_size) {}
+
+  JsonWriter(const JsonWriter&) = delete;
+  JsonWriter& operator=(const JsonWriter&) = delete;
+
+  ~JsonWriter() { flush(); }
+
+  inline void put(char c) {
+    buffer.push_back(c);
+    flush_if_full();
+  }
+
+  inline void put(const char* s, size_t n) {
+    buffer.append(s, n);
+    flush_if_full();
+  }
+
+  inline void put(const char* s) { put(s, std::strlen(s)); }
+
+  inline void put(const std::string& s) { put(s.data(), s.size()); }
+
+  inline void put_bool(bool b) {
+    if (b) {
+      put("true", 4);
+    } else {
+      put("false", 5);
+    }
+  }
+
+  // 値を value_to_json_string() と同じ形式で書き出す
+  inline void put_value(value_t value) {
+    char tmp[32];
+    put(tmp, value_to_json_chars(value, tmp));
+  }
+
+  // 値を文字列として書き出す
+  inline void put_quoted_value(value_t value) {
+    put('"');
+    put_value(value);
+    put('"');
+  }
+
+  // バッファの内容を出力先に渡す (出力先が無い場合は何もしない)
+  void flush() {
+    if (sink && !buffer.empty()) {
+      sink(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+  }
+
+  inline const std::string& str() const { return buffer; }
+
+  inline std::string take() { return std::move(buffer); }
+
+ private:
+  std::string buffer;
+  sink_t sink;
+  size_t flush_size = 0;
+
+  inline void flush_if_full() {
+    if (sink && buffer.size() >= flush_size) {
+      flush();
+    }
+  }
+};
+
+}  // namespace rcmb
+
+#endif
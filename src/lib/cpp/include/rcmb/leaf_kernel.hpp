@@ -0,0 +1,122 @@
+#ifndef RCMB_LEAF_KERNEL_HPP
+#define RCMB_LEAF_KERNEL_HPP
+
+#include "rcmb/common.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+namespace rcmb {
+
+// 最後の葉の値 v から根の値 (a * v + b) / (c * v + d) への写像
+struct LeafTransform {
+  value_t a = 1;
+  value_t b = 0;
+  value_t c = 0;
+  value_t d = 1;
+
+  // 部分和 p との直列和: x --> p + x
+  inline void series(value_t p) {
+    a += p * c;
+    b += p * d;
+  }
+
+  // 部分和 p (逆数の和) との並列和: x --> 1 / (p + 1 / x)
+  inline void parallel(value_t p) {
+    c += p * a;
+    d += p * b;
+  }
+
+  inline value_t apply(value_t v) const { return (a * v + b) / (c * v + d); }
+};
+
+int eval_leaf_batch(const LeafTransform& t, const value_t* values, int count,
+                    value_t min, value_t max, int* hits);
+
+#ifdef RCMB_IMPLEMENTATION
+
+// values[0..count) を一括評価し、根の値が [min, max] に収まる要素の
+// インデックスを hits に格納してその個数を返す
+int eval_leaf_batch(const LeafTransform& t, const value_t* values, int count,
+                    value_t min, value_t max, int* hits) {
+  int num_hits = 0;
+  int i = 0;
+
+#if defined(__AVX2__)
+  const __m256d va = _mm256_set1_pd(t.a);
+  const __m256d vb = _mm256_set1_pd(t.b);
+  const __m256d vc = _mm256_set1_pd(t.c);
+  const __m256d vd = _mm256_set1_pd(t.d);
+  const __m256d vmin = _mm256_set1_pd(min);
+  const __m256d vmax = _mm256_set1_pd(max);
+  for (; i + 4 <= count; i += 4) {
+    const __m256d v = _mm256_loadu_pd(values + i);
+    const __m256d num = _mm256_add_pd(_mm256_mul_pd(va, v), vb);
+    const __m256d den = _mm256_add_pd(_mm256_mul_pd(vc, v), vd);
+    const __m256d r = _mm256_div_pd(num, den);
+    const __m256d in = _mm256_and_pd(_mm256_cmp_pd(r, vmin, _CMP_GE_OQ),
+                                     _mm256_cmp_pd(r, vmax, _CMP_LE_OQ));
+    int mask = _mm256_movemask_pd(in);
+    while (mask) {
+      const int bit = __builtin_ctz(mask);
+      hits[num_hits++] = i + bit;
+      mask &= mask - 1;
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128d va = _mm_set1_pd(t.a);
+  const __m128d vb = _mm_set1_pd(t.b);
+  const __m128d vc = _mm_set1_pd(t.c);
+  const __m128d vd = _mm_set1_pd(t.d);
+  const __m128d vmin = _mm_set1_pd(min);
+  const __m128d vmax = _mm_set1_pd(max);
+  for (; i + 2 <= count; i += 2) {
+    const __m128d v = _mm_loadu_pd(values + i);
+    const __m128d num = _mm_add_pd(_mm_mul_pd(va, v), vb);
+    const __m128d den = _mm_add_pd(_mm_mul_pd(vc, v), vd);
+    const __m128d r = _mm_div_pd(num, den);
+    const __m128d in =
+        _mm_and_pd(_mm_cmpge_pd(r, vmin), _mm_cmple_pd(r, vmax));
+    const int mask = _mm_movemask_pd(in);
+    if (mask & 1) hits[num_hits++] = i;
+    if (mask & 2) hits[num_hits++] = i + 1;
+  }
+#elif defined(__wasm_simd128__)
+  const v128_t va = wasm_f64x2_splat(t.a);
+  const v128_t vb = wasm_f64x2_splat(t.b);
+  const v128_t vc = wasm_f64x2_splat(t.c);
+  const v128_t vd = wasm_f64x2_splat(t.d);
+  const v128_t vmin = wasm_f64x2_splat(min);
+  const v128_t vmax = wasm_f64x2_splat(max);
+  for (; i + 2 <= count; i += 2) {
+    const v128_t v = wasm_v128_load(values + i);
+    const v128_t num = wasm_f64x2_add(wasm_f64x2_mul(va, v), vb);
+    const v128_t den = wasm_f64x2_add(wasm_f64x2_mul(vc, v), vd);
+    const v128_t r = wasm_f64x2_div(num, den);
+    const v128_t in =
+        wasm_v128_and(wasm_f64x2_ge(r, vmin), wasm_f64x2_le(r, vmax));
+    const uint32_t mask = wasm_i64x2_bitmask(in);
+    if (mask & 1) hits[num_hits++] = i;
+    if (mask & 2) hits[num_hits++] = i + 1;
+  }
+#endif
+
+  for (; i < count; i++) {
+    const value_t r = t.apply(values[i]);
+    if (min <= r && r <= max) {
+      hits[num_hits++] = i;
+    }
+  }
+  return num_hits;
+}
+
+#endif
+
+}  // namespace rcmb
+
+#endif
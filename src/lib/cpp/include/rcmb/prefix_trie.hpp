@@ -0,0 +1,228 @@
+#ifndef RCMB_PREFIX_TRIE_HPP
+#define RCMB_PREFIX_TRIE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "rcmb/common.hpp"
+#include "rcmb/search_state.hpp"
+#include "rcmb/topology.hpp"
+
+namespace rcmb {
+
+// 根の子ノードの並びの接頭辞を共有するトポロジのトライ木のノード
+// 根以外のノードは、根から数えてその位置にある子ノードに相当する
+struct PrefixTrieNode {
+  // 子ノードのトポロジ (トポロジのキャッシュ内を指す)
+  Topology* topology = nullptr;
+  // 根の最後の子ノードの場合はトポロジ全体
+  Topology* whole = nullptr;
+  // 全ての葉の値が 1 のときの子ノードの値
+  value_t unit = 1;
+  // 弟ノード全体の、全ての葉の値が 1 のときの和・逆数和の範囲
+  // (このノードを通る全トポロジについての範囲)
+  value_t next_units_min = VALUE_POSITIVE_INFINITY;
+  value_t next_units_max = 0;
+  value_t next_inv_units_min = VALUE_POSITIVE_INFINITY;
+  value_t next_inv_units_max = 0;
+  // このノードを通るトポロジの数 (探索の進捗の集計用)
+  int num_topologies = 0;
+  std::vector<int> children;
+
+  inline bool is_terminal() const { return whole != nullptr; }
+  inline bool is_single_leaf() const { return topology == whole; }
+};
+
+class PrefixTrieClass;
+using PrefixTrie = std::shared_ptr<PrefixTrieClass>;
+
+extern std::atomic<size_t> prefix_trie_memory_size;
+
+// 同じ素子数・並列/直列のトポロジ群のトライ木
+// ノード 0 が根で、根から終端までの経路がひとつのトポロジに相当する
+class PrefixTrieClass {
+ public:
+  const ComponentType type;
+  const bool inv_sum;
+  std::vector<PrefixTrieNode> nodes;
+  // 根の子ノードの最大数
+  int max_children = 0;
+
+  PrefixTrieClass(ComponentType type, const TopologyList& topologies,
+                  bool parallel, int max_depth);
+
+  ~PrefixTrieClass() { prefix_trie_memory_size -= memory_size; }
+
+ private:
+  // ノードが指すトポロジの一覧 (キャッシュから解放されても保持する)
+  const TopologyList topologies;
+  size_t memory_size = 0;
+
+  // (親ノード, 子ノードのトポロジ ID, 終端か) --> ノード番号
+  std::map<uint64_t, int> node_index;
+
+  void add(Topology& topo);
+  int find_or_add_child(int parent, Topology& child_topo, Topology* whole);
+};
+
+PrefixTrie get_prefix_trie(ComponentType type, int num_leafs, bool parallel,
+                           int max_depth);
+size_t estimate_prefix_trie_memory(ComponentType type, int num_leafs,
+                                   bool parallel, int max_depth);
+void release_prefix_tries(int max_num_leafs);
+
+#ifdef RCMB_IMPLEMENTATION
+
+// トライ木のキャッシュ (生成後は変更しないので探索間で共有する)
+std::map<uint32_t, PrefixTrie> prefix_trie_cache;
+std::mutex prefix_trie_mutex;
+
+std::atomic<size_t> prefix_trie_memory_size = 0;
+
+// 1 ノードあたりのメモリの見積もり (構築時の索引を含む)
+static constexpr size_t PREFIX_TRIE_NODE_SIZE =
+    sizeof(PrefixTrieNode) + sizeof(int) + 48;
+
+PrefixTrieClass::PrefixTrieClass(ComponentType type,
+                                 const TopologyList& topologies,
+                                 bool parallel, int max_depth)
+    : type(type),
+      inv_sum((type == ComponentType::Resistor) ? parallel : !parallel),
+      topologies(topologies) {
+  nodes.emplace_back();
+  for (auto& topo : *topologies) {
+    if (topo->depth > max_depth) continue;
+    add(topo);
+  }
+  // 索引は構築にしか使わない
+  node_index.clear();
+  memory_size = sizeof(PrefixTrieClass) + nodes.size() * PREFIX_TRIE_NODE_SIZE;
+  prefix_trie_memory_size += memory_size;
+}
+
+// トポロジをトライ木に追加
+void PrefixTrieClass::add(Topology& topo) {
+  nodes[0].num_topologies++;
+  if (topo->is_leaf()) {
+    // 単一の葉はそれ自体を唯一の子ノードとして扱う
+    const int index = find_or_add_child(0, topo, &topo);
+    auto& node = nodes[index];
+    node.num_topologies++;
+    node.next_units_min = node.next_units_max = 0;
+    node.next_inv_units_min = node.next_inv_units_max = 0;
+    if (max_children < 1) max_children = 1;
+    return;
+  }
+
+  const int num_children = static_cast<int>(topo->children.size());
+  std::vector<int> indices(num_children);
+  int index = 0;
+  for (int i = 0; i < num_children; i++) {
+    const bool last = (i + 1 >= num_children);
+    index = find_or_add_child(index, topo->children[i], last ? &topo : nullptr);
+    indices[i] = index;
+  }
+
+  // 弟ノード全体の和・逆数和の範囲を更新
+  value_t units = 0;
+  value_t inv_units = 0;
+  for (int i = num_children - 1; i >= 0; i--) {
+    auto& node = nodes[indices[i]];
+    node.num_topologies++;
+    if (node.next_units_min > units) node.next_units_min = units;
+    if (node.next_units_max < units) node.next_units_max = units;
+    if (node.next_inv_units_min > inv_units) {
+      node.next_inv_units_min = inv_units;
+    }
+    if (node.next_inv_units_max < inv_units) {
+      node.next_inv_units_max = inv_units;
+    }
+    units += node.unit;
+    inv_units += 1 / node.unit;
+  }
+
+  if (max_children < num_children) max_children = num_children;
+}
+
+int PrefixTrieClass::find_or_add_child(int parent, Topology& child_topo,
+                                       Topology* whole) {
+  const uint64_t key = (static_cast<uint64_t>(parent) << 33) |
+                       (static_cast<uint64_t>(child_topo->id) << 1) |
+                       (whole ? 1 : 0);
+  const auto it = node_index.find(key);
+  if (it != node_index.end()) {
+    return it->second;
+  }
+  const int index = static_cast<int>(nodes.size());
+  node_index[key] = index;
+  nodes.emplace_back();
+  nodes.back().topology = &child_topo;
+  nodes.back().whole = whole;
+  nodes.back().unit = unit_value_of(type, child_topo);
+  nodes[parent].children.push_back(index);
+  return index;
+}
+
+static inline uint32_t prefix_trie_key(ComponentType type, int num_leafs,
+                                       bool parallel, int max_depth) {
+  // 深さは素子数未満なので、それ以上の制限は同一視する
+  if (max_depth > num_leafs) max_depth = num_leafs;
+  if (num_leafs < 2) parallel = false;
+  return (static_cast<uint32_t>(num_leafs) << 16) |
+         (static_cast<uint32_t>(max_depth) << 2) | (parallel ? 2 : 0) |
+         (type == ComponentType::Capacitor ? 1 : 0);
+}
+
+// 深さ max_depth 以下のトポロジのトライ木を取得 (初回に生成)
+PrefixTrie get_prefix_trie(ComponentType type, int num_leafs, bool parallel,
+                           int max_depth) {
+  const uint32_t key = prefix_trie_key(type, num_leafs, parallel, max_depth);
+  if (num_leafs < 2) parallel = false;
+  std::lock_guard<std::mutex> lock(prefix_trie_mutex);
+  const auto it = prefix_trie_cache.find(key);
+  if (it != prefix_trie_cache.end()) {
+    return it->second;
+  }
+
+  auto trie = std::make_shared<PrefixTrieClass>(
+      type, get_topology_list(num_leafs, parallel), parallel, max_depth);
+  prefix_trie_cache[key] = trie;
+  return trie;
+}
+
+// トライ木を生成する場合に新たに必要なメモリの見積もり
+// (トポロジの生成を含む、生成済みなら 0)
+size_t estimate_prefix_trie_memory(ComponentType type, int num_leafs,
+                                   bool parallel, int max_depth) {
+  size_t size = estimate_topology_memory(num_leafs, parallel);
+  std::lock_guard<std::mutex> lock(prefix_trie_mutex);
+  const uint32_t key = prefix_trie_key(type, num_leafs, parallel, max_depth);
+  if (!prefix_trie_cache.contains(key)) {
+    // ノード数はトポロジの数の 2 倍程度
+    size += estimate_num_topologies(num_leafs) * 2 * PREFIX_TRIE_NODE_SIZE;
+  }
+  return size;
+}
+
+// 素子数が max_num_leafs を超えるトポロジのトライ木をキャッシュから解放
+void release_prefix_tries(int max_num_leafs) {
+  std::lock_guard<std::mutex> lock(prefix_trie_mutex);
+  for (auto it = prefix_trie_cache.begin(); it != prefix_trie_cache.end();) {
+    const int num_leafs = static_cast<int>(it->first >> 16);
+    if (num_leafs > max_num_leafs) {
+      it = prefix_trie_cache.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+#endif
+
+}  // namespace rcmb
+
+#endif
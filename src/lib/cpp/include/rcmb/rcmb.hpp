@@ -1,21 +1,51 @@
 #ifndef RCMB_RCMB_HPP
 #define RCMB_RCMB_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <functional>
 #include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <stack>
 #include <vector>
 
 #include "rcmb/combination.hpp"
 #include "rcmb/common.hpp"
 #include "rcmb/double_combination.hpp"
+#include "rcmb/leaf_kernel.hpp"
+#include "rcmb/prefix_trie.hpp"
+#include "rcmb/result_arena.hpp"
+#include "rcmb/result_cache.hpp"
 #include "rcmb/search_state.hpp"
+#include "rcmb/thread_pool.hpp"
 #include "rcmb/topology.hpp"
 #include "rcmb/value_list.hpp"
 
 namespace rcmb {
 
+// 1 つの探索を複数のワーカーで分担する場合の、受け持つ部分
+// 素子数・並列/直列ごとのトポロジ群について、根の最初の子ノードを
+// 試す順に count 個に区切った index 番目だけを探索する
+struct SearchShard {
+  int index = 0;
+  int count = 1;
+
+  inline bool is_whole() const { return count == 1; }
+
+  result_t validate() const {
+    if (count < 1 || index < 0 || count <= index) {
+      RCMB_DEBUG_PRINT("Invalid shard: %d / %d\n", index, count);
+      return result_t::PARAMETER_OUT_OF_RANGE;
+    }
+    return result_t::SUCCESS;
+  }
+};
+
 struct CombinationSearchArgs {
   const ComponentType type;
   const ValueList& element_values;
@@ -26,6 +56,11 @@ struct CombinationSearchArgs {
   const value_t target_max;
   topology_constraint_t topology_constraint = topology_constraint_t::NO_LIMIT;
   int max_depth = 9999;
+  // この探索のメモリ使用量の上限 [バイト] (0 なら無制限)
+  // 超えた場合はそれまでの結果を返して SEARCH_SPACE_TOO_LARGE で終了する
+  size_t memory_budget = 0;
+  // 分担して探索する場合の受け持つ部分 (既定は全体)
+  SearchShard shard;
 
   CombinationSearchArgs(ComponentType type, const ValueList& values,
                   int num_elems_min, int num_elems_max, value_t target,
@@ -38,12 +73,33 @@ struct CombinationSearchArgs {
         target_min(0 > target_min ? 0 : target_min),
         target_max(target_max) {}
 
+  // 結果のキャッシュのキー (メモリ使用量の上限は結果に影響しないので除く)
+  std::string cache_key() const {
+    ResultCacheKey key('C');
+    key.put(type);
+    key.put_values(element_values.values);
+    key.put(num_elems_min);
+    key.put(num_elems_max);
+    key.put(target);
+    key.put(target_min);
+    key.put(target_max);
+    key.put(topology_constraint);
+    key.put(max_depth);
+    key.put(shard.index);
+    key.put(shard.count);
+    return key.take();
+  }
+
   result_t validate() const {
     result_t ret;
     ret = element_values.validate();
     if (ret != result_t::SUCCESS) {
       return ret;
     }
+    ret = shard.validate();
+    if (ret != result_t::SUCCESS) {
+      return ret;
+    }
     if (num_elems_max < num_elems_min) {
       RCMB_DEBUG_PRINT("Element count range reversal: %d > %d\n",
                          num_elems_max, num_elems_min);
@@ -83,6 +139,11 @@ struct DividerSearchArgs {
   const value_t target_max;
   topology_constraint_t topology_constraint = topology_constraint_t::NO_LIMIT;
   int max_depth = 9999;
+  // この探索のメモリ使用量の上限 [バイト] (0 なら無制限)
+  // 超えた場合はそれまでの結果を返して SEARCH_SPACE_TOO_LARGE で終了する
+  size_t memory_budget = 0;
+  // 分担して探索する場合の受け持つ部分 (下側のトポロジ群を分割する)
+  SearchShard shard;
 
   DividerSearchArgs(const ValueList& values, int num_elems_min,
                     int num_elems_max, value_t total_min_val,
@@ -97,12 +158,34 @@ struct DividerSearchArgs {
         target_min(0 > target_min ? 0 : target_min),
         target_max(1 < target_max ? 1 : target_max) {}
 
+  // 結果のキャッシュのキー (メモリ使用量の上限は結果に影響しないので除く)
+  std::string cache_key() const {
+    ResultCacheKey key('D');
+    key.put_values(element_values.values);
+    key.put(num_elems_min);
+    key.put(num_elems_max);
+    key.put(total_min);
+    key.put(total_max);
+    key.put(target_value);
+    key.put(target_min);
+    key.put(target_max);
+    key.put(topology_constraint);
+    key.put(max_depth);
+    key.put(shard.index);
+    key.put(shard.count);
+    return key.take();
+  }
+
   result_t validate() const {
     result_t ret;
     ret = element_values.validate();
     if (ret != result_t::SUCCESS) {
       return ret;
     }
+    ret = shard.validate();
+    if (ret != result_t::SUCCESS) {
+      return ret;
+    }
     if (num_elems_max < num_elems_min) {
       RCMB_DEBUG_PRINT("Element count range reversal: %d > %d\n",
                          num_elems_max, num_elems_min);
@@ -141,13 +224,364 @@ struct DividerSearchArgs {
   }
 };
 
+// 探索の統計情報
+struct SearchStatistics {
+  // 探索の回数 (分圧抵抗の探索中に行う上側の探索を含む)
+  uint64_t num_searches = 0;
+  // 根の値が値域に入った組み合わせの数
+  uint64_t num_candidates = 0;
+  // 最良の組み合わせとして返した数
+  uint64_t num_results = 0;
+};
+
+// 探索の進捗
+struct SearchProgress {
+  // 探索を終えたトポロジの数 (分圧抵抗の上側の探索を含む)
+  uint64_t num_topologies_done = 0;
+  // 値を試したトライ木のノードの数
+  uint64_t num_nodes_visited = 0;
+};
+
+// 探索の中止要求と進捗の通知
+// cancel_flag が 0 以外になるか progress_callback が false を返すと探索を
+// 中止し、それまでの結果を SEARCH_CANCELLED と共に返す
+struct SearchControl {
+  // 他のスレッドや JS 側から書き込む中止要求 (nullptr なら使わない)
+  // 探索器は書き換えないので、次の探索の前に呼び出し側で 0 に戻すこと
+  const std::atomic<int32_t>* cancel_flag = nullptr;
+  // ノードを progress_interval 個試すごとに呼ぶ (続けるなら true を返す)
+  // 探索を開始したスレッドからのみ呼ぶ
+  std::function<bool(const SearchProgress&)> progress_callback;
+  uint64_t progress_interval = 1 << 16;
+};
+
+class SearcherClass;
+using Searcher = std::shared_ptr<SearcherClass>;
+
+struct MemoryBudget;
+struct SearchMonitor;
+struct BestCombinations;
+struct CombinationSearchState;
+struct DividerSearchState;
+class SearchTaskClass;
+
+// 探索器
+// 探索中の状態と統計情報はインスタンスごとに持つので、スレッドごとに
+// 別のインスタンスを使えば並行して探索できる
+// (1 つのインスタンスを複数のスレッドから同時に使うことはできない)
+// 生成済みのトポロジとトライ木は全インスタンスで共有する
+// スレッドプールを指定すると、大きなトポロジ群の探索を分割して
+// プールのスレッドで並行に実行する (結果は分割しない場合と同じ)
+// 引数の shard で部分を指定すると、その部分の中で最良の組み合わせを返す
+// (別のワーカーで探索した各部分の結果を merge_*_shards で統合する)
+class SearcherClass {
+ public:
+  SearcherClass(const ThreadPool& pool = nullptr) : pool(pool) {}
+
+  result_t search_combinations(CombinationSearchArgs& args,
+                               std::vector<Combination>& out_combs);
+  result_t search_dividers(DividerSearchArgs& args,
+                           std::vector<DoubleCombination>& best_combs);
+
+  inline const SearchStatistics& statistics() const { return stats; }
+  inline void reset_statistics() { stats = SearchStatistics(); }
+
+  // 以降の探索の中止要求と進捗の通知の方法を設定
+  inline void set_control(const SearchControl& control) {
+    this->control = control;
+  }
+
+  // 同じ条件の探索の結果を保持するキャッシュを設定 (nullptr なら使わない)
+  // 最後まで探索できた結果だけを保持する
+  inline void set_result_cache(const ResultCache& cache) {
+    result_cache = cache;
+  }
+  inline const ResultCache& get_result_cache() const { return result_cache; }
+
+  // 実行中または直前の探索の進捗
+  inline SearchProgress progress() const {
+    SearchProgress p;
+    p.num_topologies_done = num_topologies_done;
+    p.num_nodes_visited = num_nodes_visited;
+    return p;
+  }
+
+ private:
+  friend struct SearchMonitor;
+  friend class SearchTaskClass;
+  friend class CandidateCacheClass;
+
+  SearchStatistics stats;
+  const ThreadPool pool;
+  SearchControl control;
+  ResultCache result_cache;
+
+  // 探索中の進捗と中止の状態 (並行に探索するワーカーからも更新する)
+  std::atomic<uint64_t> num_topologies_done = 0;
+  std::atomic<uint64_t> num_nodes_visited = 0;
+  std::atomic<bool> cancelled = false;
+  uint64_t next_progress_report = 0;
+
+  // 探索を始める前に進捗と中止の状態を戻す
+  void begin_search();
+
+  // 結果を arena から確保して探索 (分圧抵抗の上側の探索と共有する)
+  // whole を指定すると、メモリ予算をその探索全体と合わせて数える
+  result_t search_combinations(CombinationSearchArgs& args,
+                               std::vector<Combination>& out_combs,
+                               const ResultArena& arena,
+                               MemoryBudget* whole = nullptr);
+
+  // 探索の状態 st を、終わるか monitor が中断を求めるまで進める
+  void run_combination_search(CombinationSearchState& st,
+                              SearchMonitor& monitor);
+
+  // st の素子数・並列/直列のトポロジ群を探索して st の最良の一覧を更新
+  // 中断した場合は st にコンテキストを残して false を返す
+  // (次の呼び出しでその続きから探索する)
+  bool search_combination_group(CombinationSearchState& st,
+                                const PrefixTrie& trie,
+                                SearchMonitor& monitor);
+  void search_combination_group_parallel(const CombinationSearchArgs& args,
+                                         const PrefixTrie& trie,
+                                         int num_elems, BestCombinations& best,
+                                         MemoryBudget& budget,
+                                         SearchMonitor& monitor,
+                                         const ResultArena& arena);
+
+  // 分圧抵抗の探索の状態 st を、終わるか monitor が中断を求めるまで進める
+  void run_divider_search(DividerSearchState& st, SearchMonitor& monitor);
+
+  // st の下側の素子数・並列/直列のトポロジ群を探索して st の最良の一覧を
+  // 更新 (中断した場合は st にコンテキストを残して false を返す)
+  bool search_divider_group(DividerSearchState& st, const PrefixTrie& trie,
+                            SearchMonitor& monitor);
+
+  // 下側の値 lower_val に上側を組み合わせて st の最良の一覧に照らす
+  // 上側は search_upper(args, combs) で探し、一覧に加える場合は下側を
+  // bake_lower() で得る (探索を続けられなければ false を返す)
+  template <class bake_t, class search_t>
+  bool add_divider_lower(DividerSearchState& st, value_t lower_val,
+                         const bake_t& bake_lower,
+                         const search_t& search_upper);
+
+  // 探索を終えた st の結果を整えて、探索の結果のエラーコードを返す
+  result_t finish_divider_search(DividerSearchState& st,
+                                 SearchMonitor& monitor);
+};
+
+static inline Searcher create_searcher(const ThreadPool& pool = nullptr) {
+  return std::make_shared<SearcherClass>(pool);
+}
+
+// 少しずつ進める合成抵抗・合成容量、または分圧抵抗の探索
+// step() を繰り返し呼んで進め、その合間に別の処理 (新しい要求や中止の
+// 受け付けなど) を行える (結果は一度に探索した場合と同じ)
+// スレッドプールで分割して探索するトポロジ群や、分圧抵抗の下側の値 1 つに
+// 対する上側の探索は 1 回の step() でまとめて探索するので、その間は
+// 指定した時間を超えることがある
+// 終わるまで searcher と args の素子の値の一覧を占有する
+class SearchTaskClass {
+ public:
+  SearchTaskClass(const Searcher& searcher, const CombinationSearchArgs& args);
+  SearchTaskClass(const Searcher& searcher, const DividerSearchArgs& args);
+  ~SearchTaskClass();
+
+  SearchTaskClass(const SearchTaskClass&) = delete;
+  SearchTaskClass& operator=(const SearchTaskClass&) = delete;
+
+  // 探索を始める (引数が不正ならそのエラーで終わった状態になる)
+  result_t start();
+
+  // budget_ms [ms] 程度探索を進め、探索が終わったら true を返す
+  // (start() を呼んでいなければ先に呼ぶ)
+  bool step(double budget_ms);
+
+  inline bool finished() const {
+    return status != result_t::SEARCH_IN_PROGRESS;
+  }
+
+  // 分圧抵抗の探索か
+  inline bool is_divider() const { return divider_args.has_value(); }
+
+  // 見つかった組み合わせ
+  // 探索中は、それまでの最良のものを SEARCH_IN_PROGRESS と共に返す
+  // (探索の種類と異なる一覧には PARAMETER_OUT_OF_RANGE を返す)
+  result_t results(std::vector<Combination>& out_combs) const;
+  result_t results(std::vector<DoubleCombination>& out_combs) const;
+
+ private:
+  const Searcher searcher;
+  // どちらか一方だけを持つ
+  const std::optional<CombinationSearchArgs> args;
+  const std::optional<DividerSearchArgs> divider_args;
+  std::vector<Combination> combs;
+  std::vector<DoubleCombination> dividers;
+  std::unique_ptr<CombinationSearchState> state;
+  std::unique_ptr<DividerSearchState> divider_state;
+  result_t status = result_t::SEARCH_IN_PROGRESS;
+};
+using SearchTask = std::shared_ptr<SearchTaskClass>;
+
+static inline SearchTask create_search_task(
+    const Searcher& searcher, const CombinationSearchArgs& args) {
+  return std::make_shared<SearchTaskClass>(searcher, args);
+}
+
+static inline SearchTask create_search_task(const Searcher& searcher,
+                                            const DividerSearchArgs& args) {
+  return std::make_shared<SearchTaskClass>(searcher, args);
+}
+
+// 候補のキャッシュが保持する候補の数の既定の上限
+static constexpr size_t DEFAULT_MAX_CACHED_CANDIDATES = 50000;
+
+// 目標値や許容誤差だけを少しずつ変えて繰り返す探索のための候補のキャッシュ
+// 素子の値の一覧や素子数などが同じ探索が続いたら、目標値の範囲を含む
+// 値域の候補を全て列挙して保持し、以降は保持している候補から選び直して答える
+// 値域が広がったりずれたりした場合は、保持している値域との差分だけを
+// 列挙して加える (候補が多すぎる場合は保持せずに通常の探索を行う)
+// 分圧抵抗の探索では、下側と上側の抵抗値の範囲の候補をそれぞれ保持し、
+// 下側の候補ごとに上側の候補から選び直す
+// 結果は通常の探索と同じになる
+class CandidateCacheClass {
+ public:
+  CandidateCacheClass(const Searcher& searcher,
+                      size_t max_candidates = DEFAULT_MAX_CACHED_CANDIDATES)
+      : searcher(searcher), max_candidates(max_candidates) {}
+
+  CandidateCacheClass(const CandidateCacheClass&) = delete;
+  CandidateCacheClass& operator=(const CandidateCacheClass&) = delete;
+
+  // args の目標値の範囲の候補を保持している状態にする
+  // 足りない値域だけを列挙し、保持できなければ false を返す
+  // (条件が変わって最初の探索では、一度きりかもしれないので列挙しない)
+  bool prepare(const CombinationSearchArgs& args);
+  bool prepare(const DividerSearchArgs& args);
+
+  // 保持している候補から選べる場合は選び直し、そうでなければ通常の探索を行う
+  result_t search_combinations(CombinationSearchArgs& args,
+                               std::vector<Combination>& out_combs);
+  result_t search_dividers(DividerSearchArgs& args,
+                           std::vector<DoubleCombination>& out_combs);
+
+  void clear();
+
+  // 保持している候補の数
+  inline size_t size() const { return num_candidates; }
+
+ private:
+  // 値域を広げながら列挙した候補
+  struct CandidateSet {
+    // 列挙済みの値域 (valid の場合)
+    bool valid = false;
+    value_t min = 0;
+    value_t max = 0;
+    // 候補が多すぎて列挙できなかった値域の幅 (目標値との比)
+    // これより広い値域は列挙を試みない
+    value_t failed_width = VALUE_POSITIVE_INFINITY;
+    // 素子数・直列/並列のトポロジ群ごとの候補 (列挙した順)
+    std::vector<std::vector<Combination>> groups;
+    size_t size = 0;
+    ResultArena arena;
+  };
+
+  const Searcher searcher;
+  const size_t max_candidates;
+
+  // 候補を列挙する条件 (目標値と許容誤差以外)
+  bool has_key = false;
+  bool divider = false;
+  ComponentType type = ComponentType::Resistor;
+  std::vector<value_t> element_values;
+  int num_elems_min = 0;
+  int num_elems_max = 0;
+  topology_constraint_t topology_constraint = topology_constraint_t::NO_LIMIT;
+  int max_depth = 0;
+  SearchShard shard;
+
+  // 合成抵抗・合成容量、または分圧抵抗の下側の候補
+  CandidateSet candidates;
+  // 分圧抵抗の上側の候補
+  CandidateSet upper_candidates;
+  size_t num_candidates = 0;
+
+  bool matches(const CombinationSearchArgs& args) const;
+  bool matches(const DividerSearchArgs& args) const;
+  void set_key(const CombinationSearchArgs& args);
+  void set_key(const DividerSearchArgs& args);
+  void clear_candidates(CandidateSet& set);
+  bool extend(CandidateSet& set, const CombinationSearchArgs& args,
+              value_t lo, value_t hi, value_t scale);
+  bool collect(CandidateSet& set, const CombinationSearchArgs& args,
+               value_t lo, value_t hi);
+  void select_from(const CandidateSet& set, int num_elems_min,
+                   int num_elems_max, BestCombinations& best);
+  result_t select(const CombinationSearchArgs& args,
+                  std::vector<Combination>& best_combs);
+  result_t select(const DividerSearchArgs& args,
+                  std::vector<DoubleCombination>& best_combs);
+};
+using CandidateCache = std::shared_ptr<CandidateCacheClass>;
+
+static inline CandidateCache create_candidate_cache(
+    const Searcher& searcher,
+    size_t max_candidates = DEFAULT_MAX_CACHED_CANDIDATES) {
+  return std::make_shared<CandidateCacheClass>(searcher, max_candidates);
+}
+
 result_t search_combinations(CombinationSearchArgs& args,
                              std::vector<Combination>& out_combs);
 result_t search_dividers(DividerSearchArgs& args,
                          std::vector<DoubleCombination>& best_combs);
 
+// 部分ごとに探索した結果 shard_combs (部分の番号順) を統合
+// 全ての部分の結果を統合すると、分割せずに探索した場合と同じ結果になる
+result_t merge_combination_shards(
+    const CombinationSearchArgs& args,
+    std::vector<std::vector<Combination>>& shard_combs,
+    std::vector<Combination>& best_combs);
+result_t merge_divider_shards(
+    const DividerSearchArgs& args,
+    std::vector<std::vector<DoubleCombination>>& shard_combs,
+    std::vector<DoubleCombination>& best_combs);
+
+size_t get_memory_usage(const ValueList& values,
+                        const ResultArena& arena = nullptr);
+void release_topologies(int max_num_leafs);
+
 #ifdef RCMB_IMPLEMENTATION
 
+// 最後の葉を一括評価する際の 1 回あたりの候補数
+static constexpr int LEAF_BATCH_SIZE = 64;
+
+// スロットに設定する候補値の一覧
+struct SlotCandidates {
+  const value_t* values = nullptr;
+  // 部分木をキャッシュで解決する場合の各子孫ノードの値
+  const value_t* nodes = nullptr;
+  SearchStateClass* const* descendants = nullptr;
+  int stride = 0;
+  int count = 0;
+  // 目安の値の位置 (有効な場合、ここから外側に向かって試す)
+  int center = -1;
+  // 目安の値が center - 1 より center に近いか
+  bool up_first = true;
+};
+
+// スロットごとの列挙位置
+struct SlotCursor {
+  SlotCandidates cands;
+  int index = 0;
+
+  // 最後のスロットの一括評価の状態
+  LeafTransform transform;
+  int batch_offset = 0;
+  int next_offset = 0;
+  int num_hits = 0;
+  int hit_index = 0;
+};
+
 class CombinationEnumContext {
  public:
   const ComponentType type;
@@ -156,18 +590,46 @@ class CombinationEnumContext {
 
   SearchState root_state = nullptr;
   std::vector<SearchState> leaf_states;
+  // 値を設定する単位 (葉、または値の集合がキャッシュされている部分木)
+  std::vector<SearchState> slot_states;
+  std::vector<const SubtreeValueSet*> slot_sets;
+  std::vector<std::vector<SearchStateClass*>> slot_descendants;
+  int num_slots = 0;
+  std::vector<int> leaf_hits;
+  // CombinationEnumIterator の列挙位置 (同時に使えるイテレータは 1 つ)
+  std::vector<SlotCursor> slot_cursors;
   bool aborted = false;
 
+  // 根の値の目安 (有効な場合、候補値をこれに近い順に試す)
+  value_t hint = VALUE_NONE;
+
+  // 根の部分木の値の集合もキャッシュから引く
+  // (根の値を何度も列挙する子コンテキスト用)
+  const bool memoize_root;
+
+  // 生成時に新たに生成した部分木の値の集合のメモリ使用量
+  size_t subtree_built_size = 0;
+
   CombinationEnumContext(ComponentType type, const ValueList& elem_values,
                          Topology& topology, value_t min = 0,
                          value_t max = VALUE_POSITIVE_INFINITY,
-                         value_t target = VALUE_NONE)
+                         value_t target = VALUE_NONE,
+                         bool memoize_root = false)
       : type(type),
         element_values(elem_values),
-        num_elements(topology->num_leafs) {
+        num_elements(topology->num_leafs),
+        memoize_root(memoize_root) {
     root_state = build_search_state_tree(type, leaf_states, topology);
+    if (element_values.size() > 0) {
+      root_state->update_reach(element_values.values.front(),
+                               element_values.values.back());
+    }
     root_state->update_min_max(min, max);
     root_state->target = target;
+    collect_slots(root_state);
+    num_slots = static_cast<int>(slot_states.size());
+    leaf_hits.resize(LEAF_BATCH_SIZE);
+    slot_cursors.resize(num_slots);
   }
 
   ~CombinationEnumContext() {
@@ -176,392 +638,2620 @@ class CombinationEnumContext {
   }
 
   void abort() { aborted = true; }
-};
 
-static void update_target_of_next_brother_of(SearchState st);
+  // 根の値域と目標値を設定し直す (コンテキストの再利用用)
+  // 探索木はそのまま使い回し、前回の列挙で設定された値は上書きされる
+  void reset(value_t min, value_t max, value_t target,
+             value_t hint = VALUE_NONE) {
+    aborted = false;
+    if (value_is_valid(root_state->target) && !value_is_valid(target)) {
+      // 前回設定された目標値が残っていると最も近い値しか試さなくなる
+      clear_targets(root_state.get());
+    }
+    root_state->update_min_max(min, max);
+    root_state->target = target;
+    this->hint = hint;
+  }
 
-// 探索木の葉にひとつずつ値を設定して探索
-template <class callback_t>
-void enum_combinations_recursive(CombinationEnumContext& ctx, int pos,
-                                 const callback_t& callback) {
-  auto st = ctx.leaf_states[pos];
+  inline Combination bake(const ResultArena& arena = nullptr) const {
+    return root_state->bake(type, arena);
+  }
 
-  value_t min = st->min;
-  value_t max = st->max;
+  // 根の値域を狭める (より良い解が見つかった場合の枝刈り用)
+  void narrow(value_t min, value_t max) {
+    min -= min / 1e9;
+    max += max / 1e9;
+    if (root_state->min < min) root_state->min = min;
+    if (root_state->max > max) root_state->max = max;
+  }
 
-  if (min > max) return;
+ private:
+  void collect_slots(const SearchState& st) {
+    // 根は通常 1 回しか列挙しないのでキャッシュしない
+    const SubtreeValueSet* set = nullptr;
+    if (!st->is_leaf() && (!st->is_root() || memoize_root)) {
+      set = element_values.get_subtree_values(st->topology, st->inv_sum,
+                                              &subtree_built_size);
+    }
+    if (st->is_leaf() || set) {
+      // 部分木の値をキャッシュから引けるならまとめて 1 つのスロットにする
+      slot_states.push_back(st);
+      slot_sets.push_back(set);
+      slot_descendants.emplace_back();
+      if (set) {
+        collect_descendants(st.get(), slot_descendants.back());
+      }
+      return;
+    }
+    for (auto child = st->first_child; child; child = child->next_brother) {
+      collect_slots(child);
+    }
+  }
 
-  bool last = pos + 1 >= ctx.num_elements;
+  static void clear_targets(SearchStateClass* st) {
+    st->target = VALUE_NONE;
+    for (auto child = st->first_child.get(); child;
+         child = child->next_brother.get()) {
+      clear_targets(child);
+    }
+  }
 
-  int count = 0;
-  const value_t* values = nullptr;
-  if (value_is_valid(st->target)) {
-    // ターゲット値が指定されている場合は最も近い値だけを試す
-    values = ctx.element_values.get_nearest(st->target, &count);
-    if (values[count - 1] < min || max < values[0]) {
-      return;
+  // 子孫ノードを行きがけ順に収集
+  static void collect_descendants(const SearchStateClass* st,
+                                  std::vector<SearchStateClass*>& out) {
+    for (auto child = st->first_child.get(); child;
+         child = child->next_brother.get()) {
+      out.push_back(child);
+      collect_descendants(child, out);
     }
-  } else {
-    values = ctx.element_values.get_values(min, max, &count);
   }
+};
 
-  for (int i = 0; i < count; i++) {
-    // 葉に値を設定
-    st->value = values[i];
+// k 番目に試す候補のインデックス
+static inline int candidate_index(const SlotCandidates& cands, int k) {
+  if (cands.center < 0) return k;
+
+  // 目安の値の上下から交互に取り、片側が尽きたら残りを順に取る
+  const int below = cands.center;
+  const int above = cands.count - cands.center;
+  const int pairs = std::min(below, above);
+  if (k < 2 * pairs) {
+    const int j = k >> 1;
+    const bool up = ((k & 1) == 0) == cands.up_first;
+    return up ? (cands.center + j) : (cands.center - 1 - j);
+  }
+  k -= 2 * pairs;
+  return (above > below) ? (cands.center + pairs + k)
+                         : (cands.center - 1 - pairs - k);
+}
 
-    // 親ノードを辿って値を更新
-    auto child = st;
-    while (!child->is_root()) {
-      auto parent = child->parent;
+// 候補値を目安の値に近い順に試すよう設定
+static inline void order_candidates(SlotCandidates& cands, value_t hint) {
+  if (cands.count < 2 || !value_is_valid(hint)) return;
+  const value_t* values = cands.values;
+  const int c = static_cast<int>(
+      std::lower_bound(values, values + cands.count, hint) - values);
+  cands.center = c;
+  cands.up_first =
+      c <= 0 || (c < cands.count && values[c] - hint <= hint - values[c - 1]);
+}
 
-      // 兄ノードの積算値に自ノードの値を加算
-      auto prev = child->prev_brother;
-      child->accum = prev ? prev->accum : 0;
-      if (parent->inv_sum) {
-        child->accum += 1 / child->value;
-      } else {
-        child->accum += child->value;
-      }
+static void update_target_of_next_brother_of(SearchStateClass* st);
 
-      if (child->is_last_child()) {
-        // 兄弟全部の積算値が揃ったら親ノードの値を更新
-        if (parent->inv_sum) {
-          parent->value = 1 / child->accum;
-        } else {
-          parent->value = child->accum;
-        }
-      } else {
-        // 弟ノードの目標値と値域を更新
-        update_target_of_next_brother_of(child);
-        break;
-      }
+// ノードに値を設定し、親ノードを辿って値を更新
+static inline void set_slot_value(SearchStateClass* st, value_t value) {
+  st->value = value;
 
-      child = parent;
-    }
+  auto child = st;
+  while (!child->is_root()) {
+    const auto parent = child->parent.get();
 
-    if (last) {
-      // 全ての葉が埋まったらコールバック
-      callback(ctx, ctx.root_state->value);
+    // 兄ノードの積算値に自ノードの値を加算
+    const auto prev = child->prev_brother.get();
+    child->accum = prev ? prev->accum : 0;
+    if (parent->inv_sum) {
+      child->accum += 1 / child->value;
     } else {
-      // 次の葉へ
-      enum_combinations_recursive(ctx, pos + 1, callback);
+      child->accum += child->value;
     }
 
-    if (ctx.aborted) {
-      // 中止
-      return;
+    if (child->is_last_child()) {
+      // 兄弟全部の積算値が揃ったら親ノードの値を更新
+      if (parent->inv_sum) {
+        parent->value = 1 / child->accum;
+      } else {
+        parent->value = child->accum;
+      }
+    } else {
+      // 弟ノードの目標値と値域を更新
+      update_target_of_next_brother_of(child);
+      break;
     }
+
+    child = parent;
   }
 }
 
-static void update_target_of_next_brother_of(SearchState st) {
-  if (st->is_root() || st->is_last_child()) {
-    return;
+// スロットに i 番目の候補を設定
+static inline void assign_slot(SearchStateClass* st,
+                               const SlotCandidates& cands, int i) {
+  if (cands.nodes) {
+    const value_t* nodes = cands.nodes + static_cast<size_t>(i) * cands.stride;
+    for (int j = 0; j < cands.stride; j++) {
+      cands.descendants[j]->value = nodes[j];
+    }
   }
+  set_slot_value(st, cands.values[i]);
+}
 
-  // 枝刈り:
-  // 親ノードの min/max とここまでの部分和から
-  // 兄弟ノードの min/max を計算
-  auto brother = st->next_brother;
-  auto parent = st->parent;
-  value_t parent_min = parent->min;
-  value_t parent_max = parent->max;
-  value_t brother_min = 0;
-  value_t brother_max = VALUE_POSITIVE_INFINITY;
-  value_t partial_val = parent->inv_sum ? (1 / st->accum) : st->accum;
-  if (parent->inv_sum) {
-    // 並列和
-    if (brother->is_last_child()) {
-      brother_min = partial_val * parent_min / (partial_val - parent_min);
-      brother_max = partial_val * parent_max / (partial_val - parent_max);
-      if (brother_max < brother_min) {
-        brother_max = VALUE_POSITIVE_INFINITY;
-      }
+// スロットの値域と目標値から候補値を取得
+static inline void get_slot_candidates(const CombinationEnumContext& ctx,
+                                       int pos, SlotCandidates& cands) {
+  const auto st = ctx.slot_states[pos].get();
+  const value_t min = st->min;
+  const value_t max = st->max;
+  const SubtreeValueSet* set = ctx.slot_sets[pos];
+  if (set) {
+    // 部分木はキャッシュされた値の集合の二分探索で解決
+    int offset;
+    if (value_is_valid(st->target)) {
+      offset = set->get_nearest(st->target, min, max, &cands.count);
     } else {
-      brother_min = parent->min;
+      offset = set->get_range(min, max, &cands.count);
     }
-  } else {
-    // 直列和
-    if (brother->is_last_child()) {
-      brother_min = parent->min - partial_val;
+    cands.values = set->values.data() + offset;
+    cands.nodes = set->nodes.data() + static_cast<size_t>(offset) * set->stride;
+    cands.descendants = ctx.slot_descendants[pos].data();
+    cands.stride = set->stride;
+  } else if (value_is_valid(st->target)) {
+    // ターゲット値が指定されている場合は最も近い値だけを試す
+    cands.values = ctx.element_values.get_nearest(st->target, &cands.count);
+    if (cands.values[cands.count - 1] < min || max < cands.values[0]) {
+      cands.count = 0;
     }
-    brother_max = parent->max - partial_val;
+  } else {
+    cands.values = ctx.element_values.get_values(min, max, &cands.count);
   }
 
-  // 枝刈り:
-  // 同じトポロジーの隣り合うノードは値が降順になるようにする
-  if (st->topology->id == brother->topology->id) {
-    if (brother_max > st->value) {
-      brother_max = st->value;
-    }
+  if (value_is_valid(ctx.hint) && !value_is_valid(st->target) &&
+      pos + 1 < ctx.num_slots) {
+    // 根の値の目安から求めたこのスロットの値に近い順に試す
+    order_candidates(cands, st->implied_value(ctx.hint));
   }
+}
 
-  // 弟ノードとその子ノードの min/max を更新
-  brother->update_min_max(brother_min, brother_max);
-
-  // 弟が木の右端に位置する場合は目標値を更新
-  if (value_is_valid(parent->target) && brother->is_finisher) {
-    value_t parent_target = parent->target;
-    if (parent->inv_sum) {
-      brother->target =
-          partial_val * parent_target / (partial_val - parent_target);
+// 最後のスロットの値から根の値への写像を求める
+static inline LeafTransform transform_to_root(const SearchStateClass* st) {
+  LeafTransform t;
+  for (auto child = st; !child->is_root(); child = child->parent.get()) {
+    const auto prev = child->prev_brother.get();
+    const value_t partial = prev ? prev->accum : 0;
+    if (child->parent->inv_sum) {
+      t.parallel(partial);
     } else {
-      brother->target = parent_target - partial_val;
+      t.series(partial);
     }
   }
+  return t;
 }
 
-static void filter_unnormalized_combinations(std::vector<Combination>& combs);
-
-// 合成抵抗・合成容量の探索
-result_t search_combinations(CombinationSearchArgs& args,
-                             std::vector<Combination>& best_combs) {
-  result_t ret;
-  ret = args.validate();
-  if (ret != result_t::SUCCESS) {
-    return ret;
+// 最後のスロットの候補値を一括評価し、根の値域に収まるものだけコールバック
+template <class callback_t>
+void enum_last_slot_batch(CombinationEnumContext& ctx, SearchStateClass* st,
+                          const SlotCandidates& cands,
+                          const callback_t& callback) {
+  // 最後のスロット以外は固定なので、スロットの値から根の値への写像を
+  // 先に求めておく
+  const LeafTransform t = transform_to_root(st);
+
+  const auto root = ctx.root_state.get();
+  int* hits = ctx.leaf_hits.data();
+  for (int offset = 0; offset < cands.count; offset += LEAF_BATCH_SIZE) {
+    const int n = std::min(LEAF_BATCH_SIZE, cands.count - offset);
+    // コールバック内で値域が狭められることがあるので毎回読み直す
+    const int num_hits = eval_leaf_batch(t, cands.values + offset, n,
+                                         root->min, root->max, hits);
+    for (int i = 0; i < num_hits; i++) {
+      assign_slot(st, cands, offset + hits[i]);
+      callback(ctx, root->value);
+      if (ctx.aborted) {
+        // 中止
+        return;
+      }
+    }
   }
+}
 
-  const value_t eps = args.target / 1e9;
+// 明示的なスタックで探索木のスロットにひとつずつ値を設定して探索
+// 再帰しないので深いトポロジでもスタックを消費せず、
+// 任意の位置で中断して後から再開できる
+class CombinationEnumIterator {
+ public:
+  CombinationEnumContext& ctx;
 
-  const value_t target_min = args.target_min;
-  const value_t target_max = args.target_max;
+  CombinationEnumIterator(CombinationEnumContext& ctx)
+      : ctx(ctx), cursors(ctx.slot_cursors) {}
 
-  value_t best_min = target_min;
-  value_t best_max = target_max;
-  value_t best_error = std::numeric_limits<value_t>::infinity();
-  int best_elems = std::numeric_limits<int>::max();
+  inline bool finished() const { return done; }
 
-  const int topo_constr = static_cast<int>(args.topology_constraint);
+  // 列挙を最初からやり直す
+  void reset() {
+    started = false;
+    done = false;
+    paused = false;
+  }
 
-  // 素子数が少ない順に試す
-  std::vector<bool> parallels = {false, true};
-  for (int num_elems = args.num_elems_min; num_elems <= args.num_elems_max;
-       num_elems++) {
-    //  並列・直列パターンを全部試す
-    for (bool parallel : parallels) {
-      // 1 素子の場合は直列のみ探索
-      if (num_elems == 1 && parallel) continue;
+  // 現在のコールバックの後で列挙を中断する
+  void pause() { paused = true; }
+
+  // 列挙を進める (max_steps 個の値を設定したら中断)
+  // 列挙が完了したか中止された場合は true を返す
+  template <class callback_t>
+  bool run(const callback_t& callback,
+           uint64_t max_steps = std::numeric_limits<uint64_t>::max()) {
+    if (done) return true;
+    if (!started) {
+      started = true;
+      depth = 0;
+      load(0);
+    }
+    paused = false;
+
+    const int last = ctx.num_slots - 1;
+    const auto root = ctx.root_state.get();
+    uint64_t steps = 0;
+    while (depth >= 0) {
+      if (ctx.aborted) {
+        // 中止
+        done = true;
+        return true;
+      }
+      if (paused || steps >= max_steps) {
+        return false;
+      }
+      steps++;
+
+      const auto st = ctx.slot_states[depth].get();
+      auto& cur = cursors[depth];
+
+      if (depth == last && !value_is_valid(st->target)) {
+        // 最後のスロットは候補値をまとめて評価する
+        if (cur.hit_index < cur.num_hits) {
+          const int i = cur.batch_offset + ctx.leaf_hits[cur.hit_index++];
+          assign_slot(st, cur.cands, i);
+          callback(ctx, root->value);
+        } else if (cur.next_offset < cur.cands.count) {
+          // コールバック内で値域が狭められることがあるので毎回読み直す
+          const int n =
+              std::min(LEAF_BATCH_SIZE, cur.cands.count - cur.next_offset);
+          cur.batch_offset = cur.next_offset;
+          cur.next_offset += n;
+          cur.num_hits = eval_leaf_batch(
+              cur.transform, cur.cands.values + cur.batch_offset, n,
+              root->min, root->max, ctx.leaf_hits.data());
+          cur.hit_index = 0;
+        } else {
+          depth--;
+        }
+        continue;
+      }
 
-      // 全トポロジーを試す
-      auto& topos = get_topologies(num_elems, parallel);
-      for (auto& topo : topos) {
-        int t = topo->parallel
-                    ? static_cast<int>(topology_constraint_t::PARALLEL)
-                    : static_cast<int>(topology_constraint_t::SERIES);
-        if (num_elems >= 2 && !(t & topo_constr)) continue;
-        if (topo->depth > args.max_depth) continue;
-
-        CombinationEnumContext cec(args.type, args.element_values, topo,
-                                   best_min, best_max, args.target);
-        const auto cb = [&](CombinationEnumContext& ctx, value_t value) {
-          if (value < target_min - eps || target_max + eps < value) {
-            return;
-          }
+      if (cur.index >= cur.cands.count) {
+        depth--;
+        continue;
+      }
 
-          const auto error = std::abs(value - args.target);
-          if (error - eps > best_error) {
-            return;
-          } else if (error + eps >= best_error) {
-            if (num_elems > best_elems) {
-              return;
-            } else if (num_elems < best_elems) {
-              best_combs.clear();
-            }
-          } else {
-            best_combs.clear();
-          }
-          best_combs.emplace_back(ctx.root_state->bake(args.type));
-          best_error = error;
-          best_elems = num_elems;
-          if (value < args.target) {
-            if (best_min - eps < value) best_min = value;
-          } else {
-            if (best_max + eps > value) best_max = value;
-          }
-        };
-        enum_combinations_recursive(cec, 0, cb);
+      // 値を設定して親ノードを更新
+      assign_slot(st, cur.cands, candidate_index(cur.cands, cur.index++));
+
+      if (depth == last) {
+        // 全てのスロットが埋まったらコールバック
+        callback(ctx, root->value);
+      } else {
+        // 次のスロットへ
+        load(++depth);
       }
     }
 
-    if (best_error < eps) {
-      // 十分良い解が見つかったら終了
-      break;
-    }
+    done = true;
+    return true;
   }
 
-  // 重複回避のため正規化されているものだけを残す
-  filter_unnormalized_combinations(best_combs);
-
-  for (auto& comb : best_combs) {
-    result_t ret = comb->verify();
-    if (ret != result_t::SUCCESS) {
-      return ret;
+ private:
+  std::vector<SlotCursor>& cursors;
+  int depth = 0;
+  bool started = false;
+  bool done = false;
+  bool paused = false;
+
+  // スロットの候補値を取得して列挙位置を初期化
+  void load(int pos) {
+    const auto st = ctx.slot_states[pos].get();
+    auto& cur = cursors[pos];
+    cur.cands = SlotCandidates();
+    cur.index = 0;
+    cur.batch_offset = 0;
+    cur.next_offset = 0;
+    cur.num_hits = 0;
+    cur.hit_index = 0;
+    if (st->min > st->max) return;
+
+    get_slot_candidates(ctx, pos, cur.cands);
+
+    if (pos + 1 >= ctx.num_slots && !value_is_valid(st->target)) {
+      // 最後のスロット以外は固定なので、スロットの値から根の値への写像を
+      // 先に求めておく
+      cur.transform = transform_to_root(st);
     }
   }
+};
 
-  return result_t::SUCCESS;
-}
+// CombinationEnumIterator をスロット数で特殊化した再帰版
+// 再帰がコンパイル時に展開され、各階層の状態がレジスタに載る
+template <int POS, int NUM_SLOTS, class callback_t>
+void enum_combinations_fixed(CombinationEnumContext& ctx,
+                             SearchStateClass* const* slots,
+                             SearchStateClass* root,
+                             const callback_t& callback) {
+  const auto st = slots[POS];
 
-// 分圧抵抗の探索
-result_t search_dividers(DividerSearchArgs& args,
-                         std::vector<DoubleCombination>& best_combs) {
-  const value_t eps = 1e-9;
+  if (st->min > st->max) return;
 
-  result_t ret;
-  ret = args.validate();
-  if (ret != result_t::SUCCESS) {
-    return ret;
+  constexpr bool last = POS + 1 >= NUM_SLOTS;
+
+  SlotCandidates cands;
+  get_slot_candidates(ctx, POS, cands);
+
+  if constexpr (last) {
+    if (!value_is_valid(st->target)) {
+      // 最後のスロットは候補値をまとめて評価する
+      enum_last_slot_batch(ctx, st, cands, callback);
+      return;
+    }
   }
 
-  value_t best_error = VALUE_POSITIVE_INFINITY;
-  int best_elems = std::numeric_limits<int>::max();
-  std::map<uint32_t, DoubleCombination> result_memo;
+  for (int i = 0; i < cands.count; i++) {
+    // 値を設定して親ノードを更新
+    assign_slot(st, cands, candidate_index(cands, i));
 
-  const value_t target_total_min = args.total_min;
-  const value_t target_total_max = args.total_max;
+    if constexpr (last) {
+      // 全てのスロットが埋まったらコールバック
+      callback(ctx, root->value);
+    } else {
+      // 次のスロットへ
+      enum_combinations_fixed<POS + 1, NUM_SLOTS>(ctx, slots, root, callback);
+    }
 
-  const value_t target_min = args.target_min;
-  const value_t target_max = args.target_max;
+    if (ctx.aborted) {
+      // 中止
+      return;
+    }
+  }
+}
 
-  const value_t target_lower_min = target_total_min * target_min;
-  const value_t target_lower_max = target_total_max * target_max;
-  const value_t target_upper_min = target_total_min * (1.0 - target_max);
-  const value_t target_upper_max = target_total_max * (1.0 - target_min);
+// 特殊化された列挙を使用する最大スロット数
+static constexpr int MAX_FIXED_SLOTS = 6;
 
-  std::vector<Combination> upper_combs;
+// スロット数に応じて列挙方法を選択
+template <class callback_t>
+void enum_combinations(CombinationEnumContext& ctx,
+                       const callback_t& callback) {
+  if (ctx.num_slots > MAX_FIXED_SLOTS) {
+    CombinationEnumIterator it(ctx);
+    it.run(callback);
+    return;
+  }
 
-  const int topo_constr = static_cast<int>(args.topology_constraint);
+  SearchStateClass* slots[MAX_FIXED_SLOTS];
+  for (int i = 0; i < ctx.num_slots; i++) {
+    slots[i] = ctx.slot_states[i].get();
+  }
+  const auto root = ctx.root_state.get();
+  switch (ctx.num_slots) {
+    case 1:
+      enum_combinations_fixed<0, 1>(ctx, slots, root, callback);
+      break;
+    case 2:
+      enum_combinations_fixed<0, 2>(ctx, slots, root, callback);
+      break;
+    case 3:
+      enum_combinations_fixed<0, 3>(ctx, slots, root, callback);
+      break;
+    case 4:
+      enum_combinations_fixed<0, 4>(ctx, slots, root, callback);
+      break;
+    case 5:
+      enum_combinations_fixed<0, 5>(ctx, slots, root, callback);
+      break;
+    case 6:
+      enum_combinations_fixed<0, 6>(ctx, slots, root, callback);
+      break;
+  }
+}
 
-  // 下側の抵抗値を列挙する
-  std::vector<bool> parallels = {false, true};
-  for (int num_lowers = args.num_elems_min - 1;
-       num_lowers <= args.num_elems_max - 1; num_lowers++) {
-    //  並列・直列パターンを全部試す
-    for (bool parallel : parallels) {
-      // 1 素子の場合は直列のみ探索
-      if (num_lowers == 1 && parallel) continue;
-
-      // 全トポロジーを試す
-      auto& topos = get_topologies(num_lowers, parallel);
-      for (auto& topo : topos) {
-        // 上側の最大素子数
-        int upper_max_elements = args.num_elems_max - num_lowers;
-        if (best_error < eps) {
-          // 既に誤差の無い組み合わせが見つかっている場合は素子数を絞る
-          upper_max_elements = best_elems - num_lowers;
-          if (upper_max_elements <= 0) {
-            break;
-          }
-        }
+// 探索のメモリ予算
+// この探索が新たに生成したトポロジとトライ木、探索木、部分木の値の集合と、
+// 結果のアリーナの使用量を合算して上限と比較する
+// 他の探索が生成したものは数えないので、並行に探索しても互いに影響しない
+// (生成済みのものを後の探索が使い回す場合は、後の探索では数えない)
+struct MemoryBudget {
+  // 上限 [バイト] (0 なら無制限)
+  const size_t limit;
+  const ResultArena& arena;
+  bool exceeded = false;
+
+  MemoryBudget(size_t limit, const ResultArena& arena)
+      : limit(limit), arena(arena), base(0), allocated(own_allocated) {}
+
+  // 探索 whole の一部を受け持つ予算 (生成したものは whole と合わせて数える)
+  // 結果を別のアリーナに確保する場合は、whole のアリーナの現在の使用量を含める
+  MemoryBudget(MemoryBudget& whole, const ResultArena& arena)
+      : limit(whole.limit),
+        arena(arena),
+        base((arena == whole.arena) ? whole.base
+                                    : (whole.base + whole.arena_size())),
+        allocated(whole.allocated) {}
+
+  MemoryBudget(const MemoryBudget&) = delete;
+  MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+  // この探索の使用量
+  inline size_t usage() const { return base + allocated + arena_size(); }
+
+  // さらに extra バイト使っても上限内か確認 (超える場合は exceeded を立てる)
+  bool check(size_t extra = 0) {
+    if (limit == 0 || exceeded) return !exceeded;
+    if (usage() + extra > limit) {
+      RCMB_DEBUG_PRINT("Memory budget exceeded: %zu bytes\n", limit);
+      exceeded = true;
+    }
+    return !exceeded;
+  }
 
-        int t = topo->parallel
-                    ? static_cast<int>(topology_constraint_t::PARALLEL)
-                    : static_cast<int>(topology_constraint_t::SERIES);
-        if (num_lowers >= 2 && !(t & topo_constr)) continue;
-        if (topo->depth > args.max_depth) continue;
-        CombinationEnumContext cec(ComponentType::Resistor, args.element_values,
-                                   topo, target_lower_min, target_lower_max);
-        result_t upper_error = result_t::SUCCESS;
-        const auto cb = [&](CombinationEnumContext& ctx, value_t lower_val) {
-          const value_t est_upper_val =
-              lower_val / args.target_value - lower_val;
-          const value_t est_total_min = lower_val + est_upper_val;
-          const value_t est_total_max = lower_val + est_upper_val;
-          if (est_total_max < target_total_min - eps ||
-              target_total_max + eps < est_total_min) {
-            return;
-          }
+  // size バイト生成してよければ、それを使用量に加えて true を返す
+  bool reserve(size_t size) {
+    if (!check(size)) return false;
+    allocated += size;
+    return true;
+  }
 
-          const uint32_t lower_key = valueKeyOf(lower_val);
-          if (result_memo.contains(lower_key)) {
-            // 既知の結果の lower と一致
-            auto& memo = result_memo[lower_key];
-            const int memo_lowers = memo->lowers[0]->num_leafs();
-            const int memo_elems = memo_lowers + memo->uppers[0]->num_leafs();
-            if (num_lowers <= memo_lowers && memo_elems <= best_elems) {
-              memo->lowers.emplace_back(
-                  ctx.root_state->bake(ComponentType::Resistor));
-            }
-            return;
-          }
+  // 生成したものを使用量に加える
+  inline void charge(size_t size) { allocated += size; }
 
-          // 下側の抵抗値に対応する上側の抵抗を列挙する
-          CombinationSearchArgs vsa(ComponentType::Resistor, args.element_values, 1,
-                              upper_max_elements, est_upper_val,
-                              target_upper_min, target_upper_max);
-          vsa.topology_constraint = args.topology_constraint;
-          vsa.max_depth = args.max_depth;
-          upper_combs.clear();
-          result_t ret = search_combinations(vsa, upper_combs);
-          if (ret != result_t::SUCCESS) {
-            upper_error = result_t::INTERNAL_CORRUPTION;
-            ctx.abort();
-            return;
-          }
-          if (upper_combs.empty()) {
-            // 条件を満たす上位側の組み合わせなし
-            return;
-          }
-          const value_t upper_val = upper_combs[0]->value;
-          const value_t total_val = lower_val + upper_val;
-          const value_t ratio = lower_val / total_val;
-          if (ratio < target_min - eps || target_max + eps < ratio) {
-            return;
-          }
-          if (total_val < target_total_min - eps ||
-              target_total_max + eps < total_val) {
-            return;
-          }
+ private:
+  // 結果を別のアリーナに確保している、探索全体の他の部分の使用量
+  const size_t base;
+  std::atomic<size_t> own_allocated = 0;
+  // 生成したものの使用量 (探索全体で共有)
+  std::atomic<size_t>& allocated;
 
-          const int num_elems = num_lowers + upper_combs[0]->num_leafs();
-
-          const value_t error = std::abs(ratio - args.target_value);
-          if (error - eps > best_error) {
-            return;
-          } else if (error + eps >= best_error) {
-            if (num_elems > best_elems) {
-              return;
-            } else if (num_elems < best_elems) {
-              best_combs.clear();
-            }
-          } else {
-            best_combs.clear();
-          }
+  inline size_t arena_size() const {
+    return arena ? arena->memory_size() : 0;
+  }
+};
 
-          auto double_comb = create_double_combination(ratio);
-          double_comb->uppers = upper_combs;
-          double_comb->lowers.emplace_back(
-              ctx.root_state->bake(ComponentType::Resistor));
-          result_memo[lower_key] = double_comb;
-          best_combs.emplace_back(std::move(double_comb));
-          best_error = error;
-          best_elems = num_elems;
-        };
+// 探索の進捗の集計と中止要求の確認
+// 並行に探索する場合はワーカーごとに用意し、進捗を探索器に集める
+// (進捗の通知は reporter のもの、つまり探索を開始したスレッドだけが行う)
+struct SearchMonitor {
+  // 中止要求を確認する間隔 (試したノードの数)
+  static constexpr uint64_t CHECK_INTERVAL = 1024;
+
+  SearcherClass& searcher;
+  const bool reporter;
+  // まだ探索器に集めていない、試したノードの数
+  uint64_t num_visited = 0;
+  // 探索を中断する時刻 (has_deadline の場合)
+  bool has_deadline = false;
+  std::chrono::steady_clock::time_point deadline;
+  // 時間切れを検出した (列挙中の値を終えたところで中断する)
+  bool suspend_requested = false;
+
+  SearchMonitor(SearcherClass& searcher, bool reporter)
+      : searcher(searcher), reporter(reporter) {}
+  ~SearchMonitor() { flush(); }
+
+  SearchMonitor(const SearchMonitor&) = delete;
+  SearchMonitor& operator=(const SearchMonitor&) = delete;
+
+  inline bool cancelled() const { return searcher.cancelled; }
+
+  // 時間切れで探索を中断すべきか
+  inline bool should_suspend() const {
+    return suspend_requested ||
+           (has_deadline && std::chrono::steady_clock::now() >= deadline);
+  }
 
-        enum_combinations_recursive(cec, 0, cb);
+  // ノードを 1 つ試したことを記録し、探索を続けてよいか確認
+  inline bool visit() {
+    if (++num_visited < CHECK_INTERVAL) return true;
+    return check();
+  }
 
-        if (upper_error != result_t::SUCCESS) {
-          return upper_error;
-        }
-      }
-    }
+  // 根の子ノードを終えたら、そこを通るトポロジを探索済みとする
+  inline void done(int num_topologies) {
+    searcher.num_topologies_done += num_topologies;
   }
 
-  for (auto& comb : best_combs) {
-    filter_unnormalized_combinations(comb->uppers);
-    filter_unnormalized_combinations(comb->lowers);
-    result_t ret = comb->verify();
-    if (ret != result_t::SUCCESS) {
-      return ret;
+  // 進捗を探索器に集め、中止要求を確認して必要なら進捗を通知
+  bool check() {
+    flush();
+    if (has_deadline && std::chrono::steady_clock::now() >= deadline) {
+      suspend_requested = true;
+    }
+    const auto& control = searcher.control;
+    if (control.cancel_flag && control.cancel_flag->load() != 0) {
+      searcher.cancelled = true;
+    }
+    if (reporter && control.progress_callback && !searcher.cancelled &&
+        searcher.num_nodes_visited >= searcher.next_progress_report) {
+      searcher.next_progress_report =
+          searcher.num_nodes_visited + control.progress_interval;
+      if (!control.progress_callback(searcher.progress())) {
+        searcher.cancelled = true;
+      }
     }
+    return !searcher.cancelled;
   }
 
+  inline void flush() {
+    searcher.num_nodes_visited += num_visited;
+    num_visited = 0;
+  }
+};
+
+// 目標値に最も近い組み合わせ (誤差が同程度なら素子数が最少のもの) の一覧
+// 見つかった値で、探索する根の値域 [min, max] を狭めていく
+struct BestCombinations {
+  const value_t target;
+  const value_t target_min;
+  const value_t target_max;
+  const value_t eps;
+  std::vector<Combination>& combs;
+
+  value_t min;
+  value_t max;
+  value_t error = VALUE_POSITIVE_INFINITY;
+  int num_elems = std::numeric_limits<int>::max();
+
+  BestCombinations(value_t target, value_t target_min, value_t target_max,
+                   std::vector<Combination>& combs)
+      : target(target),
+        target_min(target_min),
+        target_max(target_max),
+        eps(target / 1e9),
+        combs(combs),
+        min(target_min),
+        max(target_max) {}
+
+  // base と同じ状態から、別の一覧に集める (探索を分割する場合)
+  BestCombinations(const BestCombinations& base,
+                   std::vector<Combination>& combs)
+      : target(base.target),
+        target_min(base.target_min),
+        target_max(base.target_max),
+        eps(base.eps),
+        combs(combs),
+        min(base.min),
+        max(base.max),
+        error(base.error),
+        num_elems(base.num_elems) {}
+
+  inline bool in_target_range(value_t value) const {
+    return target_min - eps <= value && value <= target_max + eps;
+  }
+
+  // num_elems 素子で値 value の組み合わせを一覧に加えるべきか判定
+  // 加える場合は、それより悪いものを一覧から除いて値域を狭め、true を返す
+  // (組み合わせは呼び出し側で加える)
+  bool accept(value_t value, int num_elems) {
+    const auto error = std::abs(value - target);
+    if (error - eps > this->error) {
+      return false;
+    } else if (error + eps >= this->error) {
+      if (num_elems > this->num_elems) {
+        return false;
+      } else if (num_elems < this->num_elems) {
+        combs.clear();
+      }
+    } else {
+      combs.clear();
+    }
+    this->error = error;
+    this->num_elems = num_elems;
+    if (value < target) {
+      if (min - eps < value) min = value;
+    } else {
+      if (max + eps > value) max = value;
+    }
+    return true;
+  }
+};
+
+// 部分 shard が受け持つ根の子ノードの範囲 [*begin, *end)
+static inline void shard_root_range(const SearchShard& shard, int num_roots,
+                                    int* begin, int* end) {
+  *begin = static_cast<int>(static_cast<int64_t>(num_roots) * shard.index /
+                            shard.count);
+  *end = static_cast<int>(static_cast<int64_t>(num_roots) *
+                          (shard.index + 1) / shard.count);
+}
+
+// 分圧抵抗の最良の組み合わせの一覧と、それを選ぶ基準
+struct BestDividers {
+  const value_t target;
+  const value_t eps = 1e-9;
+  std::vector<DoubleCombination>& combs;
+
+  value_t error = VALUE_POSITIVE_INFINITY;
+  int num_elems = std::numeric_limits<int>::max();
+
+  BestDividers(value_t target, std::vector<DoubleCombination>& combs)
+      : target(target), combs(combs) {}
+
+  // 既に誤差の無い組み合わせが見つかっているか
+  inline bool exact() const { return error < eps; }
+
+  // num_elems 素子で分圧比 ratio の組み合わせを一覧に加えるべきか判定
+  // 加える場合は、それより悪いものを一覧から除いて true を返す
+  // (組み合わせは呼び出し側で加える)
+  bool accept(value_t ratio, int num_elems) {
+    const value_t error = std::abs(ratio - target);
+    if (error - eps > this->error) {
+      return false;
+    } else if (error + eps >= this->error) {
+      if (num_elems > this->num_elems) {
+        return false;
+      } else if (num_elems < this->num_elems) {
+        combs.clear();
+      }
+    } else {
+      combs.clear();
+    }
+    this->error = error;
+    this->num_elems = num_elems;
+    return true;
+  }
+};
+
+// 並行に探索するトポロジ群の最小素子数 (これ未満は分割しても速くならない)
+static constexpr int PARALLEL_MIN_NUM_ELEMS = 5;
+
+// スレッドあたりの探索の区切りの数 (区切りごとの探索時間の偏りをならす)
+static constexpr int PARALLEL_CHUNKS_PER_THREAD = 4;
+
+// 根の子ノードの並びの接頭辞を共有するトポロジ群の探索コンテキスト
+// 同じ子ノードで始まるトポロジは、その子ノードの値と部分和を 1 回だけ
+// 列挙して続きの各トポロジに展開する
+class PrefixEnumContext {
+ public:
+  const ComponentType type;
+  const ValueList& element_values;
+  const PrefixTrie trie;
+
+  // トライ木の各ノードの子ノードの値を列挙するコンテキスト
+  // (最初に列挙するときに生成する)
+  std::vector<std::shared_ptr<CombinationEnumContext>> node_contexts;
+
+  // 根の値域と目標値
+  value_t min;
+  value_t max;
+  value_t target;
+
+  // 列挙中のトライ木の経路と、各ノードの子ノードの値
+  std::vector<int> path;
+  std::vector<value_t> path_values;
+  int path_length = 0;
+
+  // 根の子ノードを試す順序 (期待される誤差, ノード番号)
+  std::vector<std::pair<value_t, int>> root_order;
+
+  // 最後に見つかった組み合わせのトポロジと値
+  const Topology* topology = nullptr;
+  value_t value = 0;
+  bool aborted = false;
+
+  // 探索木を生成する前に確認するメモリ予算 (nullptr なら無制限)
+  MemoryBudget* budget = nullptr;
+
+  // 進捗の集計と中止要求の確認 (nullptr なら行わない)
+  SearchMonitor* monitor = nullptr;
+
+  // 根の子ノードのうち、試す順で [root_begin, root_end) 番目だけを列挙する
+  // (探索を分割して並行に実行する場合)
+  int root_begin = 0;
+  int root_end = std::numeric_limits<int>::max();
+
+  // 中断した位置 (深さごとの子ノードの位置と、その値の列挙を一時停止した
+  // イテレータ)
+  // in_progress なら、その深さで最後に設定した値の子孫を探索中に中断した
+  struct ResumePoint {
+    int child = 0;
+    bool in_progress = false;
+    std::unique_ptr<CombinationEnumIterator> iterator;
+  };
+  std::vector<ResumePoint> resume_points;
+  int resume_length = 0;
+  // 時間切れで中断した
+  bool suspended = false;
+  // 再開中に、次に resume_points を使う深さ (再開中でなければ -1)
+  int resume_depth = -1;
+
+  PrefixEnumContext(const ValueList& elem_values, const PrefixTrie& trie,
+                    value_t min = 0, value_t max = VALUE_POSITIVE_INFINITY,
+                    value_t target = VALUE_NONE)
+      : type(trie->type),
+        element_values(elem_values),
+        trie(trie),
+        node_contexts(trie->nodes.size()),
+        min(min - min / 1e9),
+        max(max + max / 1e9),
+        target(target),
+        path(trie->max_children),
+        path_values(trie->max_children),
+        resume_points(trie->max_children) {}
+
+  void abort() { aborted = true; }
+
+  // 中断した位置から列挙を再開できるようにする
+  void resume() {
+    suspended = false;
+    resume_depth = (resume_length > 0) ? 0 : -1;
+  }
+
+  // 根の値域と目標値を設定し直す (コンテキストの再利用用)
+  void reset(value_t min, value_t max, value_t target) {
+    this->min = min - min / 1e9;
+    this->max = max + max / 1e9;
+    this->target = target;
+    path_length = 0;
+    topology = nullptr;
+    value = 0;
+    aborted = false;
+    budget = nullptr;
+    monitor = nullptr;
+    root_begin = 0;
+    root_end = std::numeric_limits<int>::max();
+    for (auto& point : resume_points) {
+      point.iterator.reset();
+    }
+    resume_length = 0;
+    suspended = false;
+    resume_depth = -1;
+  }
+
+  // 根の値域を狭める (より良い解が見つかった場合の枝刈り用)
+  void narrow(value_t min, value_t max) {
+    min -= min / 1e9;
+    max += max / 1e9;
+    if (this->min < min) this->min = min;
+    if (this->max > max) this->max = max;
+  }
+
+  // ノードの子ノードの値を列挙するコンテキストを取得
+  CombinationEnumContext& get_node_context(int index) {
+    auto& node_ctx = node_contexts[index];
+    if (!node_ctx) {
+      node_ctx = std::make_shared<CombinationEnumContext>(
+          type, element_values, *trie->nodes[index].topology, 0,
+          VALUE_POSITIVE_INFINITY, VALUE_NONE, true);
+      if (budget) budget->charge(node_ctx->subtree_built_size);
+    }
+    return *node_ctx;
+  }
+
+  // 最後に見つかった組み合わせを Combination に変換
+  Combination bake(const ResultArena& arena = nullptr) const {
+    const int last = path[path_length - 1];
+    if (trie->nodes[last].is_single_leaf()) {
+      return node_contexts[last]->bake(arena);
+    }
+    CombinationList children(resource_of(arena));
+    children.reserve(path_length);
+    for (int i = 0; i < path_length; i++) {
+      children.emplace_back(node_contexts[path[i]]->bake(arena));
+    }
+    return create_combination(arena, *topology, type, std::move(children),
+                              value);
+  }
+};
+
+// PrefixEnumContext をトライ木ごとに使い回すプール
+// コンテキストは探索木ごと保持され、2 回目以降の探索では値域と目標値を
+// 設定し直すだけでヒープ確保を行わない
+// 貸し出し中のコンテキストは借りた探索が占有するので、別スレッドの
+// 探索から同時に借りてよい
+class PrefixEnumContextPool {
+ public:
+  // 使い終わったコンテキストをプールに返すデリータ
+  struct Releaser {
+    PrefixEnumContextPool* pool = nullptr;
+    void operator()(PrefixEnumContext* ctx) const { pool->release(ctx); }
+  };
+  using Lease = std::unique_ptr<PrefixEnumContext, Releaser>;
+
+  Lease acquire(const ValueList& elem_values, const PrefixTrie& trie,
+                value_t min, value_t max, value_t target) {
+    PrefixEnumContext* ctx = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto& idle = idle_contexts[trie.get()];
+      if (!idle.empty()) {
+        ctx = idle.back();
+        idle.pop_back();
+      }
+    }
+    if (ctx) {
+      ctx->reset(min, max, target);
+    } else {
+      auto new_ctx = std::make_unique<PrefixEnumContext>(elem_values, trie,
+                                                         min, max, target);
+      ctx = new_ctx.get();
+      std::lock_guard<std::mutex> lock(mutex);
+      contexts.emplace_back(std::move(new_ctx));
+    }
+    return Lease(ctx, Releaser{this});
+  }
+
+ private:
+  std::vector<std::unique_ptr<PrefixEnumContext>> contexts;
+  // 未使用のコンテキスト (入れ子の探索では同じトライ木を同時に使う)
+  std::map<const PrefixTrieClass*, std::vector<PrefixEnumContext*>>
+      idle_contexts;
+  std::mutex mutex;
+
+  void release(PrefixEnumContext* ctx) {
+    std::lock_guard<std::mutex> lock(mutex);
+    idle_contexts[ctx->trie.get()].push_back(ctx);
+  }
+};
+
+// 素子の値の一覧に紐づいたコンテキストのプールからコンテキストを借りる
+static inline PrefixEnumContextPool::Lease acquire_prefix_context(
+    const ValueList& elem_values, const PrefixTrie& trie, value_t min = 0,
+    value_t max = VALUE_POSITIVE_INFINITY, value_t target = VALUE_NONE) {
+  std::call_once(elem_values.context_pool_created, [&] {
+    elem_values.context_pool = std::make_shared<PrefixEnumContextPool>();
+  });
+  return elem_values.context_pool->acquire(elem_values, trie, min, max,
+                                           target);
+}
+
+// 合成抵抗・合成容量の探索の途中の状態
+// 次に探索するトポロジ群と、途中まで探索したトポロジ群のコンテキストを
+// 持ち、中断したところから再開できる
+struct CombinationSearchState {
+  const CombinationSearchArgs& args;
+  const ResultArena arena;
+  MemoryBudget budget;
+  BestCombinations best;
+
+  // 次に探索するトポロジ群 (素子数と、0: 直列 / 1: 並列)
+  int num_elems;
+  int pattern = 0;
+  // 途中で中断したトポロジ群のコンテキスト
+  PrefixEnumContextPool::Lease pec;
+  bool finished = false;
+
+  CombinationSearchState(const CombinationSearchArgs& args,
+                         std::vector<Combination>& combs,
+                         const ResultArena& arena,
+                         MemoryBudget* whole = nullptr)
+      : args(args),
+        arena(arena),
+        budget(whole ? MemoryBudget(*whole, this->arena)
+                     : MemoryBudget(args.memory_budget, this->arena)),
+        best(args.target, args.target_min, args.target_max, combs),
+        num_elems(args.num_elems_min) {}
+};
+
+// 分圧抵抗の探索の途中の状態
+// 次に探索する下側のトポロジ群と、途中まで探索したトポロジ群の
+// コンテキストを持ち、中断したところから再開できる
+struct DividerSearchState {
+  const DividerSearchArgs& args;
+  const ResultArena arena;
+  MemoryBudget budget;
+  BestDividers best;
+  // 下側・上側の抵抗値の範囲
+  const value_t lower_min;
+  const value_t lower_max;
+  const value_t upper_min;
+  const value_t upper_max;
+  // 下側の値ごとの見つかった組み合わせ
+  std::map<uint32_t, DoubleCombination> result_memo;
+  // 下側の値のキーごとの、見つかった下側の組み合わせ
+  // 一覧の各組み合わせに加える下側は、探索を終えてから見つかった順に
+  // よらずに選ぶ (resolve_divider_lowers)
+  struct LowerCandidate {
+    Combination lower;
+    int num_lowers;
+  };
+  std::map<uint32_t, std::vector<LowerCandidate>> lower_candidates;
+  std::vector<Combination> upper_combs;
+
+  // 次に探索する下側のトポロジ群 (素子数と、0: 直列 / 1: 並列)
+  int num_lowers;
+  int pattern = 0;
+  // 途中で中断したトポロジ群のコンテキスト
+  PrefixEnumContextPool::Lease pec;
+  // 上側の探索で起きたエラー
+  result_t error = result_t::SUCCESS;
+  bool finished = false;
+
+  DividerSearchState(const DividerSearchArgs& args,
+                     std::vector<DoubleCombination>& combs,
+                     const ResultArena& arena)
+      : args(args),
+        arena(arena),
+        budget(args.memory_budget, this->arena),
+        best(args.target_value, combs),
+        lower_min(args.total_min * args.target_min),
+        lower_max(args.total_max * args.target_max),
+        upper_min(args.total_min * (1.0 - args.target_max)),
+        upper_max(args.total_max * (1.0 - args.target_min)),
+        num_lowers(args.num_elems_min - 1) {}
+};
+
+// トライ木のノードの子ノードの値の目安を根の目標値から推定
+static inline value_t implied_node_value(const PrefixEnumContext& ctx,
+                                         const PrefixTrieNode& node,
+                                         value_t accum) {
+  if (node.is_single_leaf()) return ctx.target;
+  return implied_child_value(
+      ctx.trie->inv_sum, ctx.target, accum, node.unit,
+      (node.next_units_min + node.next_units_max) / 2,
+      (node.next_inv_units_min + node.next_inv_units_max) / 2);
+}
+
+// 子ノードを目安の値にどれだけ近づけられそうかの見積もり (比、1 以上)
+static inline value_t expected_error_of(const PrefixEnumContext& ctx,
+                                        const PrefixTrieNode& node,
+                                        value_t implied) {
+  if (!value_is_valid(implied)) return VALUE_POSITIVE_INFINITY;
+
+  // 部分木が取り得る範囲の外なら、その端までの比
+  const auto& values = ctx.element_values.values;
+  const value_t reach_min = node.unit * values.front();
+  const value_t reach_max = node.unit * values.back();
+  if (implied < reach_min) return reach_min / implied;
+  if (implied > reach_max) return implied / reach_max;
+  if (!(*node.topology)->is_leaf()) return 1;
+
+  // 葉なら最も近い素子の値との比
+  const auto it = std::lower_bound(values.begin(), values.end(), implied);
+  value_t error = VALUE_POSITIVE_INFINITY;
+  if (it != values.end()) error = *it / implied;
+  if (it != values.begin()) error = std::min(error, implied / *(it - 1));
+  return error;
+}
+
+// トライ木の子ノードの値域と目標値を、根の値域とここまでの部分和から求める
+// 値域が空なら false を返す
+static inline bool prefix_child_range(const PrefixEnumContext& ctx,
+                                      const PrefixTrieNode& node, int depth,
+                                      value_t accum, value_t* node_min,
+                                      value_t* node_max,
+                                      value_t* node_target) {
+  const bool inv_sum = ctx.trie->inv_sum;
+  const value_t elem_min = ctx.element_values.values.front();
+  const value_t elem_max = ctx.element_values.values.back();
+  const bool has_target = value_is_valid(ctx.target);
+
+  // 枝刈り:
+  // 根の値域とここまでの部分和、弟以降の部分木が取り得る値の範囲から
+  // 子ノードの値域を計算
+  *node_min = ctx.min;
+  *node_max = ctx.max;
+  *node_target = VALUE_NONE;
+  if (node.is_single_leaf()) {
+    *node_target = ctx.target;
+    return true;
+  }
+
+  value_t rest_min, rest_max;
+  if (inv_sum) {
+    rest_min = node.next_inv_units_min / elem_max;
+    rest_max = node.next_inv_units_max / elem_min;
+  } else {
+    rest_min = node.next_units_min * elem_min;
+    rest_max = node.next_units_max * elem_max;
+  }
+  if (!child_range(inv_sum, ctx.min, ctx.max, accum, rest_min, rest_max,
+                   node_min, node_max)) {
+    return false;
+  }
+
+  // 枝刈り:
+  // 同じトポロジーの隣り合うノードは値が降順になるようにする
+  if (depth > 0) {
+    const auto& prev = ctx.trie->nodes[ctx.path[depth - 1]];
+    if ((*prev.topology)->id == (*node.topology)->id &&
+        *node_max > ctx.path_values[depth - 1]) {
+      *node_max = ctx.path_values[depth - 1];
+    }
+  }
+
+  // 最後の子ノードは目標値を設定
+  if (has_target && node.is_terminal()) {
+    const value_t partial_val = inv_sum ? (1 / accum) : accum;
+    if (inv_sum) {
+      *node_target = partial_val * ctx.target / (partial_val - ctx.target);
+    } else {
+      *node_target = ctx.target - partial_val;
+    }
+  }
+  return true;
+}
+
+// トライ木のノード parent の子ノードを列挙
+// accum は兄ノードまでの積算値、depth は根から数えた子ノードの位置
+// monitor に期限がある場合は子ノードの値をイテレータで列挙し、時間切れなら
+// 各深さのイテレータを resume_points に残して中断する
+template <class callback_t>
+void enum_prefix_children(PrefixEnumContext& ctx, int parent, int depth,
+                          value_t accum, const callback_t& callback) {
+  const bool inv_sum = ctx.trie->inv_sum;
+  const bool has_target = value_is_valid(ctx.target);
+  const bool resumable = ctx.monitor && ctx.monitor->has_deadline;
+
+  // 目標値がある場合は、期待される誤差が小さいトポロジから試して
+  // 早い段階で値域を狭める
+  // (同じ見積もりの場合はノード番号順 = トポロジの生成順)
+  const auto& children = ctx.trie->nodes[parent].children;
+  const int num_children = static_cast<int>(children.size());
+  const bool reorder = has_target && depth == 0 && num_children > 1;
+  if (reorder) {
+    auto& order = ctx.root_order;
+    order.clear();
+    for (int index : children) {
+      const auto& node = ctx.trie->nodes[index];
+      order.emplace_back(
+          expected_error_of(ctx, node, implied_node_value(ctx, node, accum)),
+          index);
+    }
+    std::sort(order.begin(), order.end());
+  }
+
+  int i_begin = 0;
+  int i_end = num_children;
+  if (depth == 0) {
+    i_begin = std::min(ctx.root_begin, num_children);
+    i_end = std::min(ctx.root_end, num_children);
+  }
+
+  // 中断した位置から再開する場合は、その子ノードの列挙の続きから
+  PrefixEnumContext::ResumePoint* resume = nullptr;
+  if (ctx.resume_depth == depth) {
+    resume = &ctx.resume_points[depth];
+    i_begin = resume->child;
+    ctx.resume_depth = (depth + 1 < ctx.resume_length) ? (depth + 1) : -1;
+  }
+
+  for (int i = i_begin; i < i_end; i++) {
+    const int index = reorder ? ctx.root_order[i].second : children[i];
+    const auto& node = ctx.trie->nodes[index];
+    const bool resuming = resume && i == i_begin;
+
+    if (!resuming) {
+      value_t node_min, node_max, node_target;
+      if (!prefix_child_range(ctx, node, depth, accum, &node_min, &node_max,
+                              &node_target)) {
+        if (depth == 0 && ctx.monitor) ctx.monitor->done(node.num_topologies);
+        continue;
+      }
+
+      if (!ctx.node_contexts[index] && ctx.budget &&
+          !ctx.budget->reserve(
+              estimate_search_state_memory(*node.topology))) {
+        // メモリ予算を超えるので探索木を生成せずに中止
+        ctx.abort();
+        return;
+      }
+      const value_t node_hint =
+          has_target ? (value_is_valid(node_target)
+                            ? node_target
+                            : implied_node_value(ctx, node, accum))
+                     : VALUE_NONE;
+      ctx.get_node_context(index).reset(node_min, node_max, node_target,
+                                        node_hint);
+    }
+    auto& node_ctx = *ctx.node_contexts[index];
+    CombinationEnumIterator it =
+        resuming ? *resume->iterator : CombinationEnumIterator(node_ctx);
+
+    // 子ノードの値 node_val で根まで値を求めるか、続きのトポロジへ展開
+    const auto expand = [&](value_t node_val) {
+      ctx.path[depth] = index;
+      ctx.path_values[depth] = node_val;
+      value_t node_accum = accum;
+      if (inv_sum) {
+        node_accum += 1 / node_val;
+      } else {
+        node_accum += node_val;
+      }
+
+      if (node.is_terminal()) {
+        // 最後の子ノードまで揃ったら根の値を求めてコールバック
+        value_t value;
+        if (node.is_single_leaf()) {
+          value = node_val;
+        } else {
+          value = inv_sum ? (1 / node_accum) : node_accum;
+        }
+        if (ctx.min <= value && value <= ctx.max) {
+          ctx.path_length = depth + 1;
+          ctx.topology = node.whole;
+          ctx.value = value;
+          callback(ctx, value);
+        }
+      } else {
+        // 続きのトポロジへ展開
+        enum_prefix_children(ctx, index, depth + 1, node_accum, callback);
+      }
+
+      if (ctx.aborted) {
+        // 中止
+        node_ctx.abort();
+        return;
+      }
+      const bool in_progress = ctx.suspended;
+      if (!in_progress && !(resumable && ctx.monitor->suspend_requested)) {
+        return;
+      }
+      // 時間切れなので、この値の子孫 (in_progress) か次の値から再開する
+      if (!in_progress) {
+        ctx.suspended = true;
+        ctx.resume_length = depth + 1;
+      }
+      it.pause();
+      auto& point = ctx.resume_points[depth];
+      point.child = i;
+      point.in_progress = in_progress;
+      point.iterator = std::make_unique<CombinationEnumIterator>(it);
+    };
+
+    const auto cb = [&](CombinationEnumContext& node_ctx, value_t node_val) {
+      if (ctx.monitor && !ctx.monitor->visit()) {
+        // 中止要求
+        ctx.abort();
+        node_ctx.abort();
+        return;
+      }
+      expand(node_val);
+    };
+
+    if (resuming) {
+      const bool in_progress = resume->in_progress;
+      resume->iterator.reset();
+      if (in_progress) {
+        // 中断した値の子孫の続き
+        expand(ctx.path_values[depth]);
+      }
+      if (!ctx.aborted && !ctx.suspended) it.run(cb);
+    } else if (resumable) {
+      it.run(cb);
+    } else {
+      enum_combinations(node_ctx, cb);
+    }
+
+    if (ctx.aborted || ctx.suspended) {
+      // 中止または中断
+      return;
+    }
+    if (depth == 0 && ctx.monitor) ctx.monitor->done(node.num_topologies);
+  }
+}
+
+// トライ木の全トポロジを列挙
+template <class callback_t>
+void enum_prefix_combinations(PrefixEnumContext& ctx,
+                              const callback_t& callback) {
+  if (ctx.element_values.size() == 0) return;
+  enum_prefix_children(ctx, 0, 0, 0, callback);
+}
+
+static void update_target_of_next_brother_of(SearchStateClass* st) {
+  if (st->is_root() || st->is_last_child()) {
+    return;
+  }
+
+  // 枝刈り:
+  // 親ノードの min/max とここまでの部分和、弟以降の部分木が取り得る
+  // 値の範囲から兄弟ノードの min/max を計算
+  const auto brother = st->next_brother.get();
+  const auto parent = st->parent.get();
+  value_t brother_min = 0;
+  value_t brother_max = VALUE_POSITIVE_INFINITY;
+  if (!child_range(parent->inv_sum, parent->min, parent->max, st->accum,
+                   brother->rest_min, brother->rest_max, &brother_min,
+                   &brother_max)) {
+    brother->mark_infeasible();
+    return;
+  }
+
+  // 枝刈り:
+  // 同じトポロジーの隣り合うノードは値が降順になるようにする
+  if (st->topology->id == brother->topology->id) {
+    if (brother_max > st->value) {
+      brother_max = st->value;
+    }
+  }
+
+  // 弟ノードとその子ノードの min/max を更新
+  brother->update_min_max(brother_min, brother_max);
+
+  // 弟が木の右端に位置する場合は目標値を更新
+  if (value_is_valid(parent->target) && brother->is_finisher) {
+    const value_t partial_val =
+        parent->inv_sum ? (1 / st->accum) : st->accum;
+    const value_t parent_target = parent->target;
+    if (parent->inv_sum) {
+      brother->target =
+          partial_val * parent_target / (partial_val - parent_target);
+    } else {
+      brother->target = parent_target - partial_val;
+    }
+  }
+}
+
+template <class list_t>
+static void filter_unnormalized_combinations(list_t& combs);
+template <class list_t>
+static void sort_in_generation_order(list_t& combs);
+static void sort_in_generation_order(std::vector<DoubleCombination>& combs);
+static DoubleCombination resolve_divider_lowers(const DividerSearchState& st,
+                                                const DoubleCombination& comb,
+                                                const ResultArena& arena);
+
+// 合成抵抗・合成容量の探索
+// 結果は探索ごとのアリーナに確保し、全て解放されたときにまとめて解放する
+result_t SearcherClass::search_combinations(
+    CombinationSearchArgs& args, std::vector<Combination>& best_combs) {
+  begin_search();
+  std::string key;
+  if (result_cache) {
+    key = args.cache_key();
+    if (result_cache->find(key, best_combs)) return result_t::SUCCESS;
+  }
+  result_t ret = search_combinations(args, best_combs, create_result_arena());
+  if (result_cache && ret == result_t::SUCCESS) {
+    result_cache->store(key, best_combs);
+  }
+  return ret;
+}
+
+void SearcherClass::begin_search() {
+  num_topologies_done = 0;
+  num_nodes_visited = 0;
+  cancelled = false;
+  next_progress_report = control.progress_interval;
+}
+
+result_t SearcherClass::search_combinations(
+    CombinationSearchArgs& args, std::vector<Combination>& best_combs,
+    const ResultArena& arena, MemoryBudget* whole) {
+  result_t ret;
+  ret = args.validate();
+  if (ret != result_t::SUCCESS) {
+    return ret;
+  }
+  stats.num_searches++;
+  CombinationSearchState st(args, best_combs, arena, whole);
+  SearchMonitor monitor(*this, true);
+  run_combination_search(st, monitor);
+
+  // 重複回避のため正規化されているものだけを残す
+  filter_unnormalized_combinations(best_combs);
+  sort_in_generation_order(best_combs);
+
+  for (auto& comb : best_combs) {
+    result_t ret = comb->verify();
+    if (ret != result_t::SUCCESS) {
+      return ret;
+    }
+  }
+
+  stats.num_results += best_combs.size();
+  if (monitor.cancelled()) return result_t::SEARCH_CANCELLED;
+  return st.budget.exceeded ? result_t::SEARCH_SPACE_TOO_LARGE
+                            : result_t::SUCCESS;
+}
+
+void SearcherClass::run_combination_search(CombinationSearchState& st,
+                                           SearchMonitor& monitor) {
+  const auto& args = st.args;
+  const int topo_constr = static_cast<int>(args.topology_constraint);
+
+  // 素子数が少ない順に試す
+  for (; st.num_elems <= args.num_elems_max; st.num_elems++) {
+    const int num_elems = st.num_elems;
+    //  並列・直列パターンを全部試す
+    for (; st.pattern < 2; st.pattern++) {
+      const bool parallel = st.pattern == 1;
+      // 1 素子の場合は直列のみ探索
+      if (num_elems == 1 && parallel) continue;
+
+      // 全トポロジーを接頭辞を共有して試す
+      int t = parallel ? static_cast<int>(topology_constraint_t::PARALLEL)
+                       : static_cast<int>(topology_constraint_t::SERIES);
+      if (num_elems >= 2 && !(t & topo_constr)) continue;
+
+      if (st.pec) {
+        // 中断したトポロジ群の続きから探索
+        if (!search_combination_group(st, st.pec->trie, monitor)) return;
+      } else {
+        // メモリ予算を超えるトポロジは生成しない
+        if (!st.budget.reserve(estimate_prefix_trie_memory(
+                args.type, num_elems, parallel, args.max_depth))) {
+          break;
+        }
+        const auto trie =
+            get_prefix_trie(args.type, num_elems, parallel, args.max_depth);
+        if (pool && pool->size() > 1 &&
+            num_elems >= PARALLEL_MIN_NUM_ELEMS) {
+          search_combination_group_parallel(args, trie, num_elems, st.best,
+                                            st.budget, monitor, st.arena);
+        } else if (!search_combination_group(st, trie, monitor)) {
+          return;
+        }
+      }
+      if (monitor.cancelled()) break;
+      if (monitor.should_suspend()) {
+        // 時間切れなので次のトポロジ群から再開する
+        st.pattern++;
+        return;
+      }
+    }
+    st.pattern = 0;
+
+    if (st.budget.exceeded || monitor.cancelled()) {
+      // メモリ予算を超えたか中止要求があればそれまでの結果を返す
+      break;
+    }
+
+    if (st.best.error < st.best.eps) {
+      // 十分良い解が見つかったら終了
+      break;
+    }
+  }
+  st.finished = true;
+}
+
+bool SearcherClass::search_combination_group(CombinationSearchState& st,
+                                             const PrefixTrie& trie,
+                                             SearchMonitor& monitor) {
+  const auto& args = st.args;
+  auto& best = st.best;
+  auto& budget = st.budget;
+  const auto& arena = st.arena;
+  const int num_elems = st.num_elems;
+  if (st.pec) {
+    st.pec->resume();
+  } else {
+    st.pec = acquire_prefix_context(args.element_values, trie, best.min,
+                                    best.max, args.target);
+    st.pec->budget = &budget;
+    if (!args.shard.is_whole()) {
+      shard_root_range(args.shard,
+                       static_cast<int>(trie->nodes[0].children.size()),
+                       &st.pec->root_begin, &st.pec->root_end);
+    }
+  }
+  auto& pec = st.pec;
+  pec->monitor = &monitor;
+
+  const auto cb = [&](PrefixEnumContext& ctx, value_t value) {
+    if (!best.in_target_range(value)) {
+      return;
+    }
+    stats.num_candidates++;
+
+    if (!best.accept(value, num_elems)) {
+      return;
+    }
+    best.combs.emplace_back(ctx.bake(arena));
+    ctx.narrow(best.min, best.max);
+    if (!budget.check()) {
+      ctx.abort();
+    }
+  };
+  enum_prefix_combinations(*pec, cb);
+
+  if (pec->suspended) return false;
+  pec.reset();
+  return true;
+}
+
+// 根の子ノードを試す順に区切って各スレッドで探索し、区切りの順に
+// 結果を選び直す
+// 各区切りは見つかった値域を共有して枝刈りするが、それで除かれるのは
+// 他の区切りで見つかった解より悪いものだけなので、結果は区切らずに
+// 探索した場合と同じになる
+void SearcherClass::search_combination_group_parallel(
+    const CombinationSearchArgs& args, const PrefixTrie& trie, int num_elems,
+    BestCombinations& best, MemoryBudget& budget, SearchMonitor& monitor,
+    const ResultArena& arena) {
+  // 受け持つ部分の根の子ノードをさらに区切る
+  int shard_begin, shard_end;
+  shard_root_range(args.shard,
+                   static_cast<int>(trie->nodes[0].children.size()),
+                   &shard_begin, &shard_end);
+  const int num_roots = shard_end - shard_begin;
+  if (num_roots <= 0) return;
+  const int num_workers = pool->size();
+  const int num_chunks =
+      std::min(num_roots, num_workers * PARALLEL_CHUNKS_PER_THREAD);
+
+  // 結果のアリーナは 1 スレッドでしか使えないのでワーカーごとに用意する
+  // (ワーカー 0 は呼び出し元のスレッド)
+  std::vector<ResultArena> arenas(num_workers);
+  arenas[0] = arena;
+  for (int i = 1; i < num_workers; i++) {
+    arenas[i] = create_result_arena();
+  }
+  // メモリ予算は探索全体と合わせて数える
+  std::vector<std::unique_ptr<MemoryBudget>> budgets(num_workers);
+  for (int i = 0; i < num_workers; i++) {
+    budgets[i] = std::make_unique<MemoryBudget>(budget, arenas[i]);
+  }
+  // 進捗の通知は呼び出し元のスレッドだけが行う
+  std::vector<std::unique_ptr<SearchMonitor>> worker_monitors(num_workers);
+  for (int i = 1; i < num_workers; i++) {
+    worker_monitors[i] = std::make_unique<SearchMonitor>(*this, false);
+  }
+  // 区切りごとの探索は中断できないので、トポロジ群を終えるまで期限を無視する
+  const bool has_deadline = monitor.has_deadline;
+  monitor.has_deadline = false;
+
+  struct Chunk {
+    std::vector<Combination> combs;
+    uint64_t num_candidates = 0;
+  };
+  std::vector<Chunk> chunks(num_chunks);
+
+  // 見つかった値域 (全ての区切りで共有)
+  std::mutex range_mutex;
+  value_t shared_min = best.min;
+  value_t shared_max = best.max;
+  std::atomic<bool> aborted = false;
+
+  pool->run(num_chunks, [&](int c, int worker) {
+    if (aborted || monitor.cancelled()) return;
+    auto& chunk = chunks[c];
+    auto& worker_budget = *budgets[worker];
+    BestCombinations local(best, chunk.combs);
+    {
+      std::lock_guard<std::mutex> lock(range_mutex);
+      local.min = shared_min;
+      local.max = shared_max;
+    }
+
+    auto pec = acquire_prefix_context(args.element_values, trie, local.min,
+                                      local.max, args.target);
+    pec->budget = &worker_budget;
+    pec->monitor = (worker == 0) ? &monitor : worker_monitors[worker].get();
+    pec->root_begin = shard_begin + static_cast<int>(
+        static_cast<int64_t>(num_roots) * c / num_chunks);
+    pec->root_end = shard_begin + static_cast<int>(
+        static_cast<int64_t>(num_roots) * (c + 1) / num_chunks);
+
+    const auto cb = [&](PrefixEnumContext& ctx, value_t value) {
+      if (!local.in_target_range(value)) {
+        return;
+      }
+      chunk.num_candidates++;
+
+      if (local.accept(value, num_elems)) {
+        chunk.combs.emplace_back(ctx.bake(arenas[worker]));
+        std::lock_guard<std::mutex> lock(range_mutex);
+        if (shared_min < local.min) shared_min = local.min;
+        if (shared_max > local.max) shared_max = local.max;
+        local.min = shared_min;
+        local.max = shared_max;
+      }
+      ctx.narrow(local.min, local.max);
+      if (!worker_budget.check()) {
+        aborted = true;
+      }
+      if (aborted) {
+        ctx.abort();
+      }
+    };
+    enum_prefix_combinations(*pec, cb);
+    if (worker_budget.exceeded) {
+      aborted = true;
+    }
+  });
+  monitor.has_deadline = has_deadline;
+
+  // 区切りの順に、区切らずに探索した場合と同じ基準で選び直す
+  for (auto& chunk : chunks) {
+    stats.num_candidates += chunk.num_candidates;
+    for (auto& comb : chunk.combs) {
+      if (best.accept(comb->value, num_elems)) {
+        best.combs.emplace_back(std::move(comb));
+      }
+    }
+  }
+  for (const auto& worker_budget : budgets) {
+    if (worker_budget->exceeded) {
+      budget.exceeded = true;
+    }
+  }
+}
+
+// 分圧抵抗の探索
+result_t SearcherClass::search_dividers(
+    DividerSearchArgs& args, std::vector<DoubleCombination>& best_combs) {
+  result_t ret;
+  ret = args.validate();
+  if (ret != result_t::SUCCESS) {
+    return ret;
+  }
+  begin_search();
+  if (result_cache && result_cache->find(args.cache_key(), best_combs)) {
+    return result_t::SUCCESS;
+  }
+  stats.num_searches++;
+
+  DividerSearchState st(args, best_combs, create_result_arena());
+  SearchMonitor monitor(*this, true);
+  run_divider_search(st, monitor);
+  return finish_divider_search(st, monitor);
+}
+
+void SearcherClass::run_divider_search(DividerSearchState& st,
+                                       SearchMonitor& monitor) {
+  const auto& args = st.args;
+  const int topo_constr = static_cast<int>(args.topology_constraint);
+
+  // 下側の抵抗値を列挙する
+  for (; st.num_lowers <= args.num_elems_max - 1; st.num_lowers++) {
+    const int num_lowers = st.num_lowers;
+    //  並列・直列パターンを全部試す
+    for (; st.pattern < 2; st.pattern++) {
+      const bool parallel = st.pattern == 1;
+      if (st.pec) {
+        // 中断したトポロジ群の続きから探索
+        if (!search_divider_group(st, st.pec->trie, monitor)) return;
+      } else {
+        // 1 素子の場合は直列のみ探索
+        if (num_lowers == 1 && parallel) continue;
+
+        // 既に誤差の無い組み合わせが見つかっている場合は上側の素子数を絞る
+        if (st.best.exact() && st.best.num_elems - num_lowers <= 0) {
+          continue;
+        }
+
+        // 全トポロジーを接頭辞を共有して試す
+        int t = parallel ? static_cast<int>(topology_constraint_t::PARALLEL)
+                         : static_cast<int>(topology_constraint_t::SERIES);
+        if (num_lowers >= 2 && !(t & topo_constr)) continue;
+
+        // メモリ予算を超えるトポロジは生成しない
+        if (!st.budget.reserve(estimate_prefix_trie_memory(
+                ComponentType::Resistor, num_lowers, parallel,
+                args.max_depth))) {
+          break;
+        }
+        const auto trie = get_prefix_trie(ComponentType::Resistor, num_lowers,
+                                          parallel, args.max_depth);
+        if (!search_divider_group(st, trie, monitor)) return;
+      }
+      if (st.error != result_t::SUCCESS || monitor.cancelled()) break;
+      if (monitor.should_suspend()) {
+        // 時間切れなので次のトポロジ群から再開する
+        st.pattern++;
+        return;
+      }
+    }
+    st.pattern = 0;
+
+    if (st.error != result_t::SUCCESS || st.budget.exceeded ||
+        monitor.cancelled()) {
+      // メモリ予算を超えたか中止要求があればそれまでの結果を返す
+      break;
+    }
+  }
+  st.finished = true;
+}
+
+bool SearcherClass::search_divider_group(DividerSearchState& st,
+                                         const PrefixTrie& trie,
+                                         SearchMonitor& monitor) {
+  const auto& args = st.args;
+  auto& budget = st.budget;
+  const auto& arena = st.arena;
+  if (st.pec) {
+    st.pec->resume();
+  } else {
+    st.pec = acquire_prefix_context(args.element_values, trie, st.lower_min,
+                                    st.lower_max);
+    st.pec->budget = &budget;
+    if (!args.shard.is_whole()) {
+      shard_root_range(args.shard,
+                       static_cast<int>(trie->nodes[0].children.size()),
+                       &st.pec->root_begin, &st.pec->root_end);
+    }
+  }
+  auto& pec = st.pec;
+  pec->monitor = &monitor;
+
+  const auto cb = [&](PrefixEnumContext& ctx, value_t lower_val) {
+    const auto bake_lower = [&]() { return ctx.bake(arena); };
+    const auto search_upper = [&](CombinationSearchArgs& vsa,
+                                  std::vector<Combination>& upper_combs) {
+      return search_combinations(vsa, upper_combs, arena, &budget);
+    };
+    if (!add_divider_lower(st, lower_val, bake_lower, search_upper)) {
+      ctx.abort();
+    }
+  };
+  enum_prefix_combinations(*pec, cb);
+
+  if (pec->suspended) return false;
+  pec.reset();
+  return true;
+}
+
+template <class bake_t, class search_t>
+bool SearcherClass::add_divider_lower(DividerSearchState& st,
+                                      value_t lower_val,
+                                      const bake_t& bake_lower,
+                                      const search_t& search_upper) {
+  const auto& args = st.args;
+  auto& best = st.best;
+  auto& budget = st.budget;
+  auto& result_memo = st.result_memo;
+  auto& upper_combs = st.upper_combs;
+  const auto& arena = st.arena;
+  const int num_lowers = st.num_lowers;
+  const value_t eps = best.eps;
+  stats.num_candidates++;
+
+  // 上側の最大素子数
+  int upper_max_elements = args.num_elems_max - num_lowers;
+  if (best.exact()) {
+    // 既に誤差の無い組み合わせが見つかっている場合は素子数を絞る
+    upper_max_elements = best.num_elems - num_lowers;
+    if (upper_max_elements <= 0) {
+      return true;
+    }
+  }
+
+  const value_t est_upper_val = lower_val / args.target_value - lower_val;
+  const value_t est_total_min = lower_val + est_upper_val;
+  const value_t est_total_max = lower_val + est_upper_val;
+  if (est_total_max < args.total_min - eps ||
+      args.total_max + eps < est_total_min) {
+    return true;
+  }
+
+  const uint32_t lower_key = valueKeyOf(lower_val);
+  if (result_memo.contains(lower_key)) {
+    // 既知の結果の lower と一致
+    auto& memo = result_memo[lower_key];
+    const int memo_lowers = memo->lowers[0]->num_leafs();
+    const int memo_elems = memo_lowers + memo->uppers[0]->num_leafs();
+    if (num_lowers <= memo_lowers && memo_elems <= best.num_elems) {
+      st.lower_candidates[lower_key].push_back({bake_lower(), num_lowers});
+      if (!budget.check()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // 下側の抵抗値に対応する上側の抵抗を列挙する
+  CombinationSearchArgs vsa(ComponentType::Resistor, args.element_values, 1,
+                            upper_max_elements, est_upper_val, st.upper_min,
+                            st.upper_max);
+  vsa.topology_constraint = args.topology_constraint;
+  vsa.max_depth = args.max_depth;
+  vsa.memory_budget = args.memory_budget;
+  upper_combs.clear();
+  result_t ret = search_upper(vsa, upper_combs);
+  if (ret == result_t::SEARCH_SPACE_TOO_LARGE) {
+    // 上側の探索がメモリ予算を超えた
+    budget.exceeded = true;
+    return false;
+  } else if (ret == result_t::SEARCH_CANCELLED) {
+    // 上側の探索中に中止要求があった
+    return false;
+  } else if (ret != result_t::SUCCESS) {
+    st.error = result_t::INTERNAL_CORRUPTION;
+    return false;
+  }
+  if (upper_combs.empty()) {
+    // 条件を満たす上位側の組み合わせなし
+    return true;
+  }
+  const value_t upper_val = upper_combs[0]->value;
+  const value_t total_val = lower_val + upper_val;
+  const value_t ratio = lower_val / total_val;
+  if (ratio < args.target_min - eps || args.target_max + eps < ratio) {
+    return true;
+  }
+  if (total_val < args.total_min - eps || args.total_max + eps < total_val) {
+    return true;
+  }
+
+  const int num_elems = num_lowers + upper_combs[0]->num_leafs();
+
+  if (!best.accept(ratio, num_elems)) {
+    // 同じキーの下側どうしの分圧比の差はキーの分解能 (相対 1e-6) 程度
+    // なので、それ以内で最良に届くものは、同じキーの結果が後から
+    // 採用されたときに加えられるように取っておく
+    const value_t error = std::abs(ratio - args.target_value);
+    if (error - eps > best.error + ratio * 1e-6) {
+      return true;
+    }
+    st.lower_candidates[lower_key].push_back({bake_lower(), num_lowers});
+    return budget.check();
+  }
+
+  auto double_comb = create_double_combination(arena, ratio);
+  double_comb->uppers.assign(upper_combs.begin(), upper_combs.end());
+  double_comb->lowers.emplace_back(bake_lower());
+  st.lower_candidates[lower_key].push_back(
+      {double_comb->lowers[0], num_lowers});
+  result_memo[lower_key] = double_comb;
+  best.combs.emplace_back(std::move(double_comb));
+  return budget.check();
+}
+
+result_t SearcherClass::finish_divider_search(DividerSearchState& st,
+                                              SearchMonitor& monitor) {
+  // 結果はアリーナが保持するので、コンテキストだけ先に返す
+  st.pec.reset();
+  if (st.error != result_t::SUCCESS) return st.error;
+
+  auto& best_combs = st.best.combs;
+  for (auto& comb : best_combs) {
+    comb = resolve_divider_lowers(st, comb, st.arena);
+    filter_unnormalized_combinations(comb->uppers);
+    filter_unnormalized_combinations(comb->lowers);
+    result_t ret = comb->verify();
+    if (ret != result_t::SUCCESS) {
+      return ret;
+    }
+  }
+  sort_in_generation_order(best_combs);
+
+  stats.num_results += best_combs.size();
+  if (monitor.cancelled()) return result_t::SEARCH_CANCELLED;
+  if (st.budget.exceeded) return result_t::SEARCH_SPACE_TOO_LARGE;
+  if (result_cache) result_cache->store(st.args.cache_key(), best_combs);
+  return result_t::SUCCESS;
+}
+
+// 一時的な探索器で合成抵抗・合成容量を探索
+result_t search_combinations(CombinationSearchArgs& args,
+                             std::vector<Combination>& best_combs) {
+  SearcherClass searcher;
+  return searcher.search_combinations(args, best_combs);
+}
+
+// 一時的な探索器で分圧抵抗を探索
+result_t search_dividers(DividerSearchArgs& args,
+                         std::vector<DoubleCombination>& best_combs) {
+  SearcherClass searcher;
+  return searcher.search_dividers(args, best_combs);
+}
+
+SearchTaskClass::SearchTaskClass(const Searcher& searcher,
+                                 const CombinationSearchArgs& args)
+    : searcher(searcher), args(args) {}
+
+SearchTaskClass::SearchTaskClass(const Searcher& searcher,
+                                 const DividerSearchArgs& args)
+    : searcher(searcher), divider_args(args) {}
+
+SearchTaskClass::~SearchTaskClass() = default;
+
+result_t SearchTaskClass::start() {
+  state.reset();
+  divider_state.reset();
+  combs.clear();
+  dividers.clear();
+  status = is_divider() ? divider_args->validate() : args->validate();
+  if (status != result_t::SUCCESS) {
+    return status;
+  }
+  searcher->begin_search();
+  // 同じ条件の結果を保持していれば探索しない
+  const auto& cache = searcher->result_cache;
+  if (is_divider()) {
+    if (cache && cache->find(divider_args->cache_key(), dividers)) {
+      return result_t::SUCCESS;
+    }
+  } else if (cache && cache->find(args->cache_key(), combs)) {
+    return result_t::SUCCESS;
+  }
+  status = result_t::SEARCH_IN_PROGRESS;
+  searcher->stats.num_searches++;
+  if (is_divider()) {
+    divider_state = std::make_unique<DividerSearchState>(
+        *divider_args, dividers, create_result_arena());
+  } else {
+    state = std::make_unique<CombinationSearchState>(*args, combs,
+                                                     create_result_arena());
+  }
+  return result_t::SUCCESS;
+}
+
+bool SearchTaskClass::step(double budget_ms) {
+  if (!state && !divider_state && !finished() &&
+      start() != result_t::SUCCESS) {
+    return true;
+  }
+  if (finished()) return true;
+
+  SearchMonitor monitor(*searcher, true);
+  monitor.has_deadline = true;
+  monitor.deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::microseconds(static_cast<int64_t>(budget_ms * 1000));
+  if (divider_state) {
+    searcher->run_divider_search(*divider_state, monitor);
+    if (!divider_state->finished) return false;
+    status = searcher->finish_divider_search(*divider_state, monitor);
+    return true;
+  }
+  searcher->run_combination_search(*state, monitor);
+  if (!state->finished) return false;
+
+  // 重複回避のため正規化されているものだけを残す
+  filter_unnormalized_combinations(combs);
+  sort_in_generation_order(combs);
+
+  status = result_t::SUCCESS;
+  for (auto& comb : combs) {
+    result_t ret = comb->verify();
+    if (ret != result_t::SUCCESS) {
+      status = ret;
+      break;
+    }
+  }
+  searcher->stats.num_results += combs.size();
+  if (status == result_t::SUCCESS) {
+    if (monitor.cancelled()) {
+      status = result_t::SEARCH_CANCELLED;
+    } else if (state->budget.exceeded) {
+      status = result_t::SEARCH_SPACE_TOO_LARGE;
+    } else if (searcher->result_cache) {
+      searcher->result_cache->store(args->cache_key(), combs);
+    }
+  }
+  // 結果はアリーナが保持するので、コンテキストだけ先に返す
+  state->pec.reset();
+  return true;
+}
+
+result_t SearchTaskClass::results(std::vector<Combination>& out_combs) const {
+  if (is_divider()) {
+    out_combs.clear();
+    return result_t::PARAMETER_OUT_OF_RANGE;
+  }
+  out_combs.assign(combs.begin(), combs.end());
+  if (!finished()) {
+    filter_unnormalized_combinations(out_combs);
+    sort_in_generation_order(out_combs);
+  }
+  return status;
+}
+
+result_t SearchTaskClass::results(
+    std::vector<DoubleCombination>& out_combs) const {
+  if (!is_divider()) {
+    out_combs.clear();
+    return result_t::PARAMETER_OUT_OF_RANGE;
+  }
+  if (finished()) {
+    out_combs.assign(dividers.begin(), dividers.end());
+    return status;
+  }
+  // 探索中の組み合わせは後で上側・下側が加わるので、写しを整えて返す
+  out_combs.clear();
+  for (const auto& comb : dividers) {
+    auto copy = resolve_divider_lowers(*divider_state, comb, nullptr);
+    filter_unnormalized_combinations(copy->uppers);
+    filter_unnormalized_combinations(copy->lowers);
+    out_combs.emplace_back(std::move(copy));
+  }
+  sort_in_generation_order(out_combs);
+  return status;
+}
+
+bool CandidateCacheClass::prepare(const CombinationSearchArgs& args) {
+  if (args.validate() != result_t::SUCCESS) return false;
+  if (!has_key || !matches(args)) {
+    clear();
+    set_key(args);
+    return false;
+  }
+
+  // 探索で目標値の範囲に含めるのと同じ誤差を見込む
+  const value_t eps = args.target / 1e9;
+  return extend(candidates, args, args.target_min - eps, args.target_max + eps,
+                args.target);
+}
+
+bool CandidateCacheClass::prepare(const DividerSearchArgs& args) {
+  if (args.validate() != result_t::SUCCESS) return false;
+  if (!has_key || !matches(args)) {
+    clear();
+    set_key(args);
+    return false;
+  }
+
+  // 下側は探索で範囲に含めるのと同じ誤差を見込む
+  const value_t lower_min = args.total_min * args.target_min;
+  const value_t lower_max = args.total_max * args.target_max;
+  CombinationSearchArgs lower_args(ComponentType::Resistor, args.element_values,
+                                   args.num_elems_min - 1,
+                                   args.num_elems_max - 1, lower_max,
+                                   lower_min, lower_max);
+  lower_args.topology_constraint = args.topology_constraint;
+  lower_args.max_depth = args.max_depth;
+  lower_args.memory_budget = args.memory_budget;
+  lower_args.shard = args.shard;
+
+  // 上側の探索の目標値は全体の抵抗値の上限を超えないので、その誤差を見込む
+  const value_t upper_min = args.total_min * (1.0 - args.target_max);
+  const value_t upper_max = args.total_max * (1.0 - args.target_min);
+  const value_t upper_eps = (args.total_max + 1) / 1e9;
+  CombinationSearchArgs upper_args(ComponentType::Resistor, args.element_values,
+                                   1, args.num_elems_max - args.num_elems_min + 1,
+                                   upper_max, upper_min, upper_max);
+  upper_args.topology_constraint = args.topology_constraint;
+  upper_args.max_depth = args.max_depth;
+  upper_args.memory_budget = args.memory_budget;
+
+  return extend(candidates, lower_args, lower_min - lower_min / 1e9,
+                lower_max + lower_max / 1e9, args.total_max) &&
+         extend(upper_candidates, upper_args, upper_min - upper_eps,
+                upper_max + upper_eps, args.total_max);
+}
+
+result_t CandidateCacheClass::search_combinations(
+    CombinationSearchArgs& args, std::vector<Combination>& out_combs) {
+  if (!prepare(args)) {
+    return searcher->search_combinations(args, out_combs);
+  }
+  return select(args, out_combs);
+}
+
+result_t CandidateCacheClass::search_dividers(
+    DividerSearchArgs& args, std::vector<DoubleCombination>& out_combs) {
+  if (!prepare(args)) {
+    return searcher->search_dividers(args, out_combs);
+  }
+  return select(args, out_combs);
+}
+
+void CandidateCacheClass::clear() {
+  for (auto set : {&candidates, &upper_candidates}) {
+    clear_candidates(*set);
+    set->failed_width = VALUE_POSITIVE_INFINITY;
+  }
+  has_key = false;
+  element_values.clear();
+}
+
+void CandidateCacheClass::set_key(const CombinationSearchArgs& args) {
+  has_key = true;
+  divider = false;
+  type = args.type;
+  const auto& values = args.element_values.values;
+  element_values.assign(values.begin(), values.end());
+  num_elems_min = args.num_elems_min;
+  num_elems_max = args.num_elems_max;
+  topology_constraint = args.topology_constraint;
+  max_depth = args.max_depth;
+  shard = args.shard;
+}
+
+void CandidateCacheClass::set_key(const DividerSearchArgs& args) {
+  has_key = true;
+  divider = true;
+  type = ComponentType::Resistor;
+  const auto& values = args.element_values.values;
+  element_values.assign(values.begin(), values.end());
+  num_elems_min = args.num_elems_min;
+  num_elems_max = args.num_elems_max;
+  topology_constraint = args.topology_constraint;
+  max_depth = args.max_depth;
+  shard = args.shard;
+}
+
+void CandidateCacheClass::clear_candidates(CandidateSet& set) {
+  num_candidates -= set.size;
+  set.valid = false;
+  set.groups.clear();
+  set.size = 0;
+  set.arena.reset();
+}
+
+bool CandidateCacheClass::matches(const CombinationSearchArgs& args) const {
+  const auto& values = args.element_values.values;
+  return !divider && type == args.type &&
+         std::equal(element_values.begin(), element_values.end(),
+                    values.begin(), values.end()) &&
+         num_elems_min == args.num_elems_min &&
+         num_elems_max == args.num_elems_max &&
+         topology_constraint == args.topology_constraint &&
+         max_depth == args.max_depth && shard.index == args.shard.index &&
+         shard.count == args.shard.count;
+}
+
+bool CandidateCacheClass::matches(const DividerSearchArgs& args) const {
+  const auto& values = args.element_values.values;
+  return divider &&
+         std::equal(element_values.begin(), element_values.end(),
+                    values.begin(), values.end()) &&
+         num_elems_min == args.num_elems_min &&
+         num_elems_max == args.num_elems_max &&
+         topology_constraint == args.topology_constraint &&
+         max_depth == args.max_depth && shard.index == args.shard.index &&
+         shard.count == args.shard.count;
+}
+
+// set が値域 [lo, hi] の候補を保持している状態にする
+// 足りない値域だけを列挙し、保持できなければ false を返す
+// (scale は値域の幅を比べるための基準の値)
+bool CandidateCacheClass::extend(CandidateSet& set,
+                                 const CombinationSearchArgs& args, value_t lo,
+                                 value_t hi, value_t scale) {
+  if (set.valid && set.min <= lo && hi <= set.max) return true;
+
+  // 保持している値域と離れていれば、間を列挙せずに列挙し直す
+  if (set.valid && (hi < set.min || set.max < lo)) clear_candidates(set);
+  const value_t new_min = set.valid ? std::min(set.min, lo) : lo;
+  const value_t new_max = set.valid ? std::max(set.max, hi) : hi;
+  const value_t width = (new_max - new_min) / scale;
+  if (width >= set.failed_width) return false;
+  if (!collect(set, args, new_min, new_max)) {
+    clear_candidates(set);
+    set.failed_width = width;
+    return false;
+  }
+  return true;
+}
+
+// 値域 [lo, hi] の候補のうち、まだ set に保持していないものを列挙して加える
+bool CandidateCacheClass::collect(CandidateSet& set,
+                                  const CombinationSearchArgs& args,
+                                  value_t lo, value_t hi) {
+  // 列挙する値域 (保持している値域は除く)
+  std::vector<std::pair<value_t, value_t>> ranges;
+  if (set.valid) {
+    if (lo < set.min) ranges.emplace_back(lo, set.min);
+    if (set.max < hi) ranges.emplace_back(set.max, hi);
+  } else {
+    set.groups.assign(args.num_elems_max * 2, {});
+    set.arena = create_result_arena();
+    ranges.emplace_back(lo, hi);
+  }
+
+  auto& s = *searcher;
+  s.begin_search();
+  MemoryBudget budget(args.memory_budget, set.arena);
+  SearchMonitor monitor(s, true);
+  const int topo_constr = static_cast<int>(args.topology_constraint);
+
+  for (int num_elems = args.num_elems_min; num_elems <= args.num_elems_max;
+       num_elems++) {
+    for (int pattern = 0; pattern < 2; pattern++) {
+      const bool parallel = pattern == 1;
+      if (num_elems == 1 && parallel) continue;
+      int t = parallel ? static_cast<int>(topology_constraint_t::PARALLEL)
+                       : static_cast<int>(topology_constraint_t::SERIES);
+      if (num_elems >= 2 && !(t & topo_constr)) continue;
+
+      if (!budget.reserve(estimate_prefix_trie_memory(
+              args.type, num_elems, parallel, args.max_depth))) {
+        return false;
+      }
+      const auto trie =
+          get_prefix_trie(args.type, num_elems, parallel, args.max_depth);
+      auto& group = set.groups[(num_elems - 1) * 2 + pattern];
+      for (const auto& range : ranges) {
+        auto pec = acquire_prefix_context(args.element_values, trie,
+                                          range.first, range.second);
+        pec->budget = &budget;
+        pec->monitor = &monitor;
+        if (!args.shard.is_whole()) {
+          shard_root_range(args.shard,
+                           static_cast<int>(trie->nodes[0].children.size()),
+                           &pec->root_begin, &pec->root_end);
+        }
+        const auto cb = [&](PrefixEnumContext& ctx, value_t value) {
+          // 値域の端の誤差で、保持している候補を重複して加えないようにする
+          if (value < lo || hi < value) return;
+          if (set.valid && set.min <= value && value <= set.max) return;
+          group.emplace_back(ctx.bake(set.arena));
+          set.size++;
+          if (++num_candidates > max_candidates || !budget.check()) {
+            ctx.abort();
+          }
+        };
+        enum_prefix_combinations(*pec, cb);
+        if (pec->aborted || monitor.cancelled()) return false;
+      }
+    }
+  }
+
+  set.valid = true;
+  set.min = lo;
+  set.max = hi;
+  return true;
+}
+
+// set の num_elems_min ～ num_elems_max 素子の候補から、通常の探索と同じ順と
+// 基準で best に選ぶ
+void CandidateCacheClass::select_from(const CandidateSet& set,
+                                      int num_elems_min, int num_elems_max,
+                                      BestCombinations& best) {
+  auto& stats = searcher->stats;
+  for (int num_elems = num_elems_min; num_elems <= num_elems_max;
+       num_elems++) {
+    for (int pattern = 0; pattern < 2; pattern++) {
+      for (const auto& comb : set.groups[(num_elems - 1) * 2 + pattern]) {
+        if (!best.in_target_range(comb->value)) continue;
+        stats.num_candidates++;
+        if (best.accept(comb->value, num_elems)) {
+          best.combs.emplace_back(comb);
+        }
+      }
+    }
+    if (best.error < best.eps) break;
+  }
+}
+
+// 保持している候補を通常の探索と同じ順と基準で選び直す
+result_t CandidateCacheClass::select(const CombinationSearchArgs& args,
+                                     std::vector<Combination>& best_combs) {
+  auto& stats = searcher->stats;
+  stats.num_searches++;
+  BestCombinations best(args.target, args.target_min, args.target_max,
+                        best_combs);
+  select_from(candidates, args.num_elems_min, args.num_elems_max, best);
+
+  // 重複回避のため正規化されているものだけを残す
+  filter_unnormalized_combinations(best_combs);
+  sort_in_generation_order(best_combs);
+
+  for (auto& comb : best_combs) {
+    result_t ret = comb->verify();
+    if (ret != result_t::SUCCESS) {
+      return ret;
+    }
+  }
+  stats.num_results += best_combs.size();
+  return result_t::SUCCESS;
+}
+
+// 保持している下側の候補を通常の探索と同じ順に試し、それぞれの上側は
+// 保持している上側の候補から選び直す
+result_t CandidateCacheClass::select(const DividerSearchArgs& args,
+                                     std::vector<DoubleCombination>& best_combs) {
+  auto& s = *searcher;
+  s.stats.num_searches++;
+  DividerSearchState st(args, best_combs, create_result_arena());
+  SearchMonitor monitor(s, true);
+
+  const auto search_upper = [&](CombinationSearchArgs& vsa,
+                                std::vector<Combination>& upper_combs) {
+    result_t ret = vsa.validate();
+    if (ret != result_t::SUCCESS) return ret;
+    BestCombinations best(vsa.target, vsa.target_min, vsa.target_max,
+                          upper_combs);
+    select_from(upper_candidates, 1, vsa.num_elems_max, best);
+    filter_unnormalized_combinations(upper_combs);
+    sort_in_generation_order(upper_combs);
+    for (auto& comb : upper_combs) {
+      ret = comb->verify();
+      if (ret != result_t::SUCCESS) return ret;
+    }
+    return result_t::SUCCESS;
+  };
+
+  // 探索で下側の範囲に含めるのと同じ誤差を見込む
+  const value_t lower_min = st.lower_min - st.lower_min / 1e9;
+  const value_t lower_max = st.lower_max + st.lower_max / 1e9;
+  for (; st.num_lowers <= args.num_elems_max - 1; st.num_lowers++) {
+    for (int pattern = 0; pattern < 2; pattern++) {
+      // 既に誤差の無い組み合わせが見つかっている場合は上側の素子数を絞る
+      if (st.best.exact() && st.best.num_elems - st.num_lowers <= 0) {
+        continue;
+      }
+      const auto& group = candidates.groups[(st.num_lowers - 1) * 2 + pattern];
+      for (const auto& lower : group) {
+        if (lower->value < lower_min || lower_max < lower->value) continue;
+        const auto bake_lower = [&]() { return lower; };
+        if (!s.add_divider_lower(st, lower->value, bake_lower, search_upper)) {
+          break;
+        }
+      }
+      if (st.error != result_t::SUCCESS || st.budget.exceeded) break;
+    }
+    if (st.error != result_t::SUCCESS || st.budget.exceeded) break;
+  }
+  st.finished = true;
+  return s.finish_divider_search(st, monitor);
+}
+
+// 部分ごとの結果の組み合わせを、分割せずに探索した場合に見つかる
+// トポロジ群の順 (素子数、直列・並列の順) に並べる
+// (同じトポロジ群の中では部分の番号順、統合後に生成順に並べ直す)
+template <class comb_t, class key_t>
+static std::vector<comb_t*> order_shard_results(
+    std::vector<std::vector<comb_t>>& shard_combs, const key_t& group_of) {
+  std::vector<comb_t*> ordered;
+  for (auto& combs : shard_combs) {
+    for (auto& comb : combs) {
+      ordered.push_back(&comb);
+    }
+  }
+  std::stable_sort(ordered.begin(), ordered.end(),
+                   [&](const comb_t* a, const comb_t* b) {
+                     return group_of(*a) < group_of(*b);
+                   });
+  return ordered;
+}
+
+// 部分ごとの合成抵抗・合成容量の結果を統合
+// 各部分の結果を見つかる順に並べ直し、分割しない探索と同じ基準で選び直す
+result_t merge_combination_shards(
+    const CombinationSearchArgs& args,
+    std::vector<std::vector<Combination>>& shard_combs,
+    std::vector<Combination>& best_combs) {
+  BestCombinations best(args.target, args.target_min, args.target_max,
+                        best_combs);
+  const auto group_of = [](const Combination& comb) {
+    return comb->num_leafs() * 2 + (comb->topology->parallel ? 1 : 0);
+  };
+  for (auto comb : order_shard_results(shard_combs, group_of)) {
+    if (best.accept((*comb)->value, (*comb)->num_leafs())) {
+      best_combs.emplace_back(std::move(*comb));
+    }
+  }
+  sort_in_generation_order(best_combs);
+  return result_t::SUCCESS;
+}
+
+// 部分ごとの分圧抵抗の結果を統合
+// 下側の値が同じものは、分割しない探索と同様に先に見つかったものに
+// 下側の組み合わせを加える
+result_t merge_divider_shards(
+    const DividerSearchArgs& args,
+    std::vector<std::vector<DoubleCombination>>& shard_combs,
+    std::vector<DoubleCombination>& best_combs) {
+  BestDividers best(args.target_value, best_combs);
+  std::map<uint32_t, DoubleCombination> result_memo;
+  const auto group_of = [](const DoubleCombination& comb) {
+    const auto& lower = comb->lowers[0];
+    return lower->num_leafs() * 2 + (lower->topology->parallel ? 1 : 0);
+  };
+  for (auto comb : order_shard_results(shard_combs, group_of)) {
+    auto& double_comb = *comb;
+    if (double_comb->uppers.empty() || double_comb->lowers.empty()) {
+      return result_t::INTERNAL_CORRUPTION;
+    }
+    const int num_lowers = double_comb->lowers[0]->num_leafs();
+    const int num_elems = num_lowers + double_comb->uppers[0]->num_leafs();
+
+    const uint32_t lower_key = valueKeyOf(double_comb->lowers[0]->value);
+    if (result_memo.contains(lower_key)) {
+      // 既知の結果の lower と一致
+      auto& memo = result_memo[lower_key];
+      const int memo_lowers = memo->lowers[0]->num_leafs();
+      const int memo_elems = memo_lowers + memo->uppers[0]->num_leafs();
+      if (num_lowers <= memo_lowers && memo_elems <= best.num_elems) {
+        memo->lowers.insert(memo->lowers.end(), double_comb->lowers.begin(),
+                            double_comb->lowers.end());
+      }
+      continue;
+    }
+
+    if (!best.accept(double_comb->ratio, num_elems)) {
+      continue;
+    }
+    result_memo[lower_key] = double_comb;
+    best_combs.emplace_back(std::move(double_comb));
+  }
+  sort_in_generation_order(best_combs);
   return result_t::SUCCESS;
 }
 
+// 探索で使用しているメモリの見積もり
+// (トポロジとトライ木のキャッシュ、探索木、部分木の値の集合、結果)
+// 並行に実行している他の探索の分も含むプロセス全体の量で、表示用
+// (メモリ予算はこれではなく探索ごとに MemoryBudget で数える)
+size_t get_memory_usage(const ValueList& values, const ResultArena& arena) {
+  size_t size = topology_memory_size + prefix_trie_memory_size +
+                search_state_memory_size() + values.memory_size();
+  if (arena) {
+    size += arena->memory_size();
+  }
+  return size;
+}
+
+// 素子数が max_num_leafs を超えるトポロジとそのトライ木を解放
+// 探索中のものは探索が終わったときに解放される
+// (ValueList に残っている探索木は ValueList と共に解放される)
+void release_topologies(int max_num_leafs) {
+  release_prefix_tries(max_num_leafs);
+  release_cached_topologies(max_num_leafs);
+}
+
+// 同じトポロジの組み合わせ a, b の葉の値を行きがけ順に比べる
+static int compare_leaf_values(const CombinationClass& a,
+                               const CombinationClass& b) {
+  if (a.is_leaf()) {
+    return (a.value < b.value) ? -1 : (b.value < a.value) ? 1 : 0;
+  }
+  for (size_t i = 0; i < a.children.size(); i++) {
+    const int c = compare_leaf_values(*a.children[i], *b.children[i]);
+    if (c != 0) return c;
+  }
+  return 0;
+}
+
+// トポロジを生成順に、葉の値を先頭の葉から昇順に総当たりした場合に
+// a が b より先に見つかるか
+static bool generated_before(const Combination& a, const Combination& b) {
+  const auto& ta = *a->topology;
+  const auto& tb = *b->topology;
+  if (ta.num_leafs != tb.num_leafs) return ta.num_leafs < tb.num_leafs;
+  if (ta.parallel != tb.parallel) return !ta.parallel;
+  if (ta.id != tb.id) return ta.id < tb.id;
+  return compare_leaf_values(*a, *b) < 0;
+}
+
+// 総当たりで見つかる位置 (トポロジと、行きがけ順の葉の値)
+struct GenerationKey {
+  const TopologyClass* topology;
+  std::vector<value_t> leaf_values;
+
+  bool operator<(const GenerationKey& other) const {
+    const auto& ta = *topology;
+    const auto& tb = *other.topology;
+    if (ta.num_leafs != tb.num_leafs) return ta.num_leafs < tb.num_leafs;
+    if (ta.parallel != tb.parallel) return !ta.parallel;
+    if (ta.id != tb.id) return ta.id < tb.id;
+    return leaf_values < other.leaf_values;
+  }
+};
+
+// comb の葉の値を行きがけ順に out に加える
+static void append_leaf_values(const CombinationClass& comb,
+                               std::vector<value_t>& out) {
+  if (comb.is_leaf()) {
+    out.push_back(comb.value);
+    return;
+  }
+  for (const auto& child : comb.children) {
+    append_leaf_values(*child, out);
+  }
+}
+
+static GenerationKey generation_key_of(const Combination& comb) {
+  GenerationKey key{comb->topology.get(), {}};
+  append_leaf_values(*comb, key.leaf_values);
+  return key;
+}
+
+// 総当たりで各ノードに設定される値の上限
+// 上限が無限大の並列の末子は上限が求まらない (NaN になる) ので、
+// 同じトポロジの兄との降順の制約が効かず、正規化されていない並びでも見つかる
+enum class EnumBound { FINITE, INFINITE, UNDEFINED };
+
+// comb を同じトポロジの兄弟を入れ替えた並びも含めて総当たりで最初に
+// 見つかる並びにしたときの葉の値を、行きがけ順に out に加える
+// bound は comb に設定される上限
+static void append_earliest_leaf_values(const CombinationClass& comb,
+                                        EnumBound bound,
+                                        std::vector<value_t>& out) {
+  if (comb.is_leaf()) {
+    out.push_back(comb.value);
+    return;
+  }
+  const bool parallel = comb.topology->parallel;
+  const size_t n = comb.children.size();
+
+  // 位置 i の子に設定される上限 (兄との降順の制約は含まない)
+  const auto bound_at = [&](size_t i) {
+    if (parallel) {
+      if (i + 1 < n) return EnumBound::INFINITE;
+      return (bound == EnumBound::FINITE) ? EnumBound::FINITE
+                                          : EnumBound::UNDEFINED;
+    }
+    return bound;
+  };
+
+  // 同じトポロジの兄弟 (隣り合う) を order の並びで位置 first から置く
+  const auto append_run = [&](const std::vector<const CombinationClass*>& order,
+                              size_t first, std::vector<value_t>& values) {
+    for (size_t j = 0; j < order.size(); j++) {
+      EnumBound b = bound_at(first + j);
+      // 兄との降順の制約が効くと上限は兄の値になる
+      if (j > 0 && b != EnumBound::UNDEFINED) b = EnumBound::FINITE;
+      append_earliest_leaf_values(*order[j], b, values);
+    }
+  };
+  const auto by_value_desc = [](const CombinationClass* a,
+                                const CombinationClass* b) {
+    return b->value < a->value;
+  };
+
+  for (size_t first = 0; first < n;) {
+    size_t last = first + 1;
+    while (last < n && comb.children[last]->topology->id ==
+                           comb.children[first]->topology->id) {
+      last++;
+    }
+    std::vector<const CombinationClass*> run;
+    for (size_t i = first; i < last; i++) {
+      run.push_back(comb.children[i].get());
+    }
+
+    if (run.size() >= 2 && !parallel && bound == EnumBound::UNDEFINED) {
+      // 制約が全く効かないので、それぞれ最初に見つかる並びの昇順に置く
+      std::vector<std::pair<std::vector<value_t>, const CombinationClass*>>
+          keyed;
+      for (const auto* child : run) {
+        keyed.emplace_back();
+        append_earliest_leaf_values(*child, bound, keyed.back().first);
+        keyed.back().second = child;
+      }
+      std::stable_sort(
+          keyed.begin(), keyed.end(),
+          [](const auto& a, const auto& b) { return a.first < b.first; });
+      for (const auto& k : keyed) {
+        out.insert(out.end(), k.first.begin(), k.first.end());
+      }
+    } else if (run.size() >= 2 && last == n &&
+               bound_at(n - 1) == EnumBound::UNDEFINED) {
+      // 末子だけは制約が効かないので、末子にする兄弟ごとに試す
+      std::vector<value_t> best;
+      for (size_t k = 0; k < run.size(); k++) {
+        std::vector<const CombinationClass*> order;
+        for (size_t i = 0; i < run.size(); i++) {
+          if (i != k) order.push_back(run[i]);
+        }
+        std::stable_sort(order.begin(), order.end(), by_value_desc);
+        order.push_back(run[k]);
+        std::vector<value_t> values;
+        append_run(order, first, values);
+        if (k == 0 || values < best) best = std::move(values);
+      }
+      out.insert(out.end(), best.begin(), best.end());
+    } else {
+      // 正規化した並び (値の降順) で見つかる
+      std::stable_sort(run.begin(), run.end(), by_value_desc);
+      append_run(run, first, out);
+    }
+    first = last;
+  }
+}
+
+// 下側の組み合わせ comb が総当たりで最初に見つかる位置
+// (下側の値の上限は有限なので、根の上限は有限)
+static GenerationKey earliest_key_of(const Combination& comb) {
+  GenerationKey key{comb->topology.get(), {}};
+  append_earliest_leaf_values(*comb, EnumBound::FINITE, key.leaf_values);
+  return key;
+}
+
+// 分圧抵抗の一覧の組み合わせ comb の下側を、見つかった順によらずに
+// 選び直した組み合わせを返す
+// 同じキーの下側のうち最良の一覧に入る誤差のものから、総当たりで
+// (同じトポロジの兄弟を入れ替えた並びも含めて) 最初に見つかるものを選んで
+// その分圧比を使い、総当たりでそれ以降に見つかる下側を全て加える
+static DoubleCombination resolve_divider_lowers(const DividerSearchState& st,
+                                                const DoubleCombination& comb,
+                                                const ResultArena& arena) {
+  const Combination& first = comb->lowers[0];
+  const value_t upper_val = comb->uppers[0]->value;
+  const auto it = st.lower_candidates.find(valueKeyOf(first->value));
+  if (it == st.lower_candidates.end()) {
+    auto copy = create_double_combination(arena, comb->ratio);
+    copy->uppers.assign(comb->uppers.begin(), comb->uppers.end());
+    copy->lowers.assign(comb->lowers.begin(), comb->lowers.end());
+    return copy;
+  }
+  const auto& cands = it->second;
+  const auto ratio_of = [&](const Combination& lower) {
+    return lower->value / (lower->value + upper_val);
+  };
+
+  // 分圧比を決める下側 (先に採用したものは誤差によらず候補にする)
+  const DividerSearchState::LowerCandidate* origin = nullptr;
+  GenerationKey origin_key;
+  for (const auto& cand : cands) {
+    const value_t error = std::abs(ratio_of(cand.lower) - st.best.target);
+    if (cand.lower != first && error - st.best.eps > st.best.error) continue;
+    GenerationKey key = earliest_key_of(cand.lower);
+    if (!origin || key < origin_key) {
+      origin = &cand;
+      origin_key = std::move(key);
+    }
+  }
+
+  auto resolved = create_double_combination(
+      arena, origin->lower == first ? comb->ratio : ratio_of(origin->lower));
+  resolved->uppers.assign(comb->uppers.begin(), comb->uppers.end());
+  for (const auto& cand : cands) {
+    if (cand.num_lowers > origin->num_lowers) continue;
+    if (generation_key_of(cand.lower) < origin_key) continue;
+    resolved->lowers.emplace_back(cand.lower);
+  }
+  return resolved;
+}
+
+// 結果を総当たりで見つかる順に並べる
+// 接頭辞の共有や目標値に近い順の探索で見つかる順が変わっても、
+// 出力の順は変わらないようにする
+template <class list_t>
+static void sort_in_generation_order(list_t& combs) {
+  std::stable_sort(combs.begin(), combs.end(), generated_before);
+}
+
+// 分圧比を決めた下側 (分圧比が最も近い下側のうち、兄弟を入れ替えた
+// 並びも含めて総当たりで最初に見つかるもの) の見つかる位置
+static GenerationKey origin_key_of(const DoubleCombination& comb) {
+  const value_t upper_val = comb->uppers[0]->value;
+  std::vector<value_t> diffs;
+  value_t min_diff = VALUE_POSITIVE_INFINITY;
+  for (const auto& lower : comb->lowers) {
+    const value_t ratio = lower->value / (lower->value + upper_val);
+    diffs.push_back(std::abs(ratio - comb->ratio));
+    min_diff = std::min(min_diff, diffs.back());
+  }
+  // 並びの違いによる丸め誤差の差は同じ分圧比とみなす
+  const value_t tolerance = min_diff + comb->ratio * 1e-12;
+  GenerationKey origin_key{nullptr, {}};
+  for (size_t i = 0; i < comb->lowers.size(); i++) {
+    if (diffs[i] > tolerance) continue;
+    GenerationKey key = earliest_key_of(comb->lowers[i]);
+    if (!origin_key.topology || key < origin_key) {
+      origin_key = std::move(key);
+    }
+  }
+  return origin_key;
+}
+
+// 分圧抵抗は上側・下側の組み合わせを並べ、分圧比を決めた下側が
+// 見つかる順に並べる
+static void sort_in_generation_order(std::vector<DoubleCombination>& combs) {
+  std::vector<std::pair<GenerationKey, DoubleCombination>> keyed;
+  for (auto& comb : combs) {
+    sort_in_generation_order(comb->uppers);
+    sort_in_generation_order(comb->lowers);
+    GenerationKey key{nullptr, {}};
+    if (!comb->uppers.empty() && !comb->lowers.empty()) {
+      key = origin_key_of(comb);
+    }
+    keyed.emplace_back(std::move(key), std::move(comb));
+  }
+  std::stable_sort(keyed.begin(), keyed.end(),
+                   [](const auto& a, const auto& b) {
+                     if (!a.first.topology || !b.first.topology) {
+                       return a.first.topology && !b.first.topology;
+                     }
+                     return a.first < b.first;
+                   });
+  for (size_t i = 0; i < combs.size(); i++) {
+    combs[i] = std::move(keyed[i].second);
+  }
+}
+
 // 正規化されていないトポロジを削除 (重複回避)
-static void filter_unnormalized_combinations(std::vector<Combination>& combs) {
+template <class list_t>
+static void filter_unnormalized_combinations(list_t& combs) {
   for (size_t i = 0; i < combs.size();) {
     if (combs[i]->is_normalized()) {
       i++;
@@ -0,0 +1,106 @@
+#ifndef RCMB_RESULT_ARENA_HPP
+#define RCMB_RESULT_ARENA_HPP
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+
+#include "rcmb/common.hpp"
+
+namespace rcmb {
+
+class ResultArenaClass;
+using ResultArena = std::shared_ptr<ResultArenaClass>;
+
+// ヒープから確保した量を数えるメモリリソース
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  inline size_t size() const { return allocated; }
+
+ private:
+  size_t allocated = 0;
+
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    void* p = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    allocated += bytes;
+    return p;
+  }
+
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    allocated -= bytes;
+  }
+
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+// 探索結果のオブジェクトを確保するアリーナ
+// 探索中に捨てられた結果の領域はアリーナ内で使い回し、アリーナから
+// 確保した結果が全て解放されたときにまとめてヒープに返す
+// (同時に確保・解放できるのは 1 スレッドのみ)
+class ResultArenaClass {
+ public:
+  CountingResource heap;
+  std::pmr::unsynchronized_pool_resource resource{&heap};
+
+  // アリーナがヒープから確保している量
+  inline size_t memory_size() const { return heap.size(); }
+};
+
+static inline ResultArena create_result_arena() {
+  return std::make_shared<ResultArenaClass>();
+}
+
+// アリーナのメモリリソース (アリーナが無い場合は通常のヒープ)
+static inline std::pmr::memory_resource* resource_of(const ResultArena& arena) {
+  return arena ? &arena->resource : std::pmr::get_default_resource();
+}
+
+// アリーナから確保するアロケータ
+// 確保したオブジェクトが生きている間はアリーナを保持する
+template <class T>
+class ResultAllocator {
+ public:
+  using value_type = T;
+
+  ResultArena arena;
+
+  ResultAllocator(const ResultArena& arena) : arena(arena) {}
+
+  template <class U>
+  ResultAllocator(const ResultAllocator<U>& other) : arena(other.arena) {}
+
+  inline T* allocate(size_t n) {
+    return static_cast<T*>(
+        arena->resource.allocate(n * sizeof(T), alignof(T)));
+  }
+
+  inline void deallocate(T* p, size_t n) {
+    arena->resource.deallocate(p, n * sizeof(T), alignof(T));
+  }
+
+  template <class U>
+  inline bool operator==(const ResultAllocator<U>& other) const {
+    return arena == other.arena;
+  }
+};
+
+// アリーナ (無い場合は通常のヒープ) にオブジェクトを確保
+template <class T, class... Args>
+static inline std::shared_ptr<T> allocate_result(const ResultArena& arena,
+                                                 Args&&... args) {
+  if (arena) {
+    return std::allocate_shared<T>(ResultAllocator<T>(arena),
+                                   std::forward<Args>(args)...);
+  } else {
+    return std::make_shared<T>(std::forward<Args>(args)...);
+  }
+}
+
+}  // namespace rcmb
+
+#endif
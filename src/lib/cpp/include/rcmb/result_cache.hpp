@@ -0,0 +1,384 @@
+#ifndef RCMB_RESULT_CACHE_HPP
+#define RCMB_RESULT_CACHE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "rcmb/binary_writer.hpp"
+#include "rcmb/combination.hpp"
+#include "rcmb/common.hpp"
+#include "rcmb/double_combination.hpp"
+
+namespace rcmb {
+
+// 結果のキャッシュが保持する既定の最大エントリ数
+static constexpr size_t DEFAULT_RESULT_CACHE_ENTRIES = 256;
+
+// 探索条件を表すキーを組み立てる
+// 値をそのままのバイト列で連結するので、同じ条件なら同じキーになる
+class ResultCacheKey {
+ public:
+  explicit ResultCacheKey(char kind) { bytes.push_back(kind); }
+
+  template <class T>
+  inline void put(const T& value) {
+    bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  inline void put_values(std::span<const value_t> values) {
+    put(static_cast<uint64_t>(values.size()));
+    bytes.append(reinterpret_cast<const char*>(values.data()),
+                 values.size_bytes());
+  }
+
+  inline std::string take() { return std::move(bytes); }
+
+ private:
+  std::string bytes;
+};
+
+class ResultCacheClass;
+using ResultCache = std::shared_ptr<ResultCacheClass>;
+
+// 同じ条件の探索の結果を保持する LRU キャッシュ
+// 結果はバイナリ表現で保持し、取り出すたびに組み合わせを生成する
+// (探索のアリーナを保持し続けないようにするため)
+// ファイルに保存して次回の実行で読み込める (同じ環境でのみ有効)
+// 読み込むエントリはチェックサムで破損を確認し、取り出すときにも値を検証する
+// 複数のスレッドの探索器で 1 つのキャッシュを共有できる
+class ResultCacheClass {
+ public:
+  ResultCacheClass(size_t max_entries = DEFAULT_RESULT_CACHE_ENTRIES)
+      : max_entries(max_entries) {}
+
+  ResultCacheClass(const ResultCacheClass&) = delete;
+  ResultCacheClass& operator=(const ResultCacheClass&) = delete;
+
+  // key の結果を保持していれば out_combs に取り出して true を返す
+  bool find(const std::string& key, std::vector<Combination>& out_combs);
+  bool find(const std::string& key,
+            std::vector<DoubleCombination>& out_combs);
+
+  // key の結果を保持する (最大エントリ数を超えたら最も古いものを捨てる)
+  void store(const std::string& key, const std::vector<Combination>& combs);
+  void store(const std::string& key,
+             const std::vector<DoubleCombination>& combs);
+
+  void clear();
+
+  inline size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+  }
+  inline uint64_t hits() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return num_hits;
+  }
+  inline uint64_t misses() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return num_misses;
+  }
+
+  // ファイルに保存する / ファイルから読み込む
+  // 読み込んだエントリは既に保持しているものより新しいものとして扱う
+  result_t save(const std::string& path) const;
+  result_t load(const std::string& path);
+
+ private:
+  static constexpr uint8_t KIND_COMBINATION = 0;
+  static constexpr uint8_t KIND_DIVIDER = 1;
+
+  struct Entry {
+    std::string key;
+    uint8_t kind = KIND_COMBINATION;
+    uint8_t type = 0;
+    uint32_t num_results = 0;
+    BinaryWriter binary;
+  };
+
+  const size_t max_entries;
+  mutable std::mutex mutex;
+  // 先頭ほど最近使ったもの
+  std::list<Entry> entries;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  uint64_t num_hits = 0;
+  uint64_t num_misses = 0;
+
+  Entry* lookup(const std::string& key, uint8_t kind);
+  void insert(Entry&& entry);
+  void erase(const std::string& key);
+
+  static bool is_valid_kind(uint8_t kind, uint8_t type);
+  static uint64_t checksum_of(const Entry& entry);
+};
+
+static inline ResultCache create_result_cache(
+    size_t max_entries = DEFAULT_RESULT_CACHE_ENTRIES) {
+  return std::make_shared<ResultCacheClass>(max_entries);
+}
+
+#ifdef RCMB_IMPLEMENTATION
+
+// キャッシュのファイルの先頭 (形式を変えたら末尾の版数を上げる)
+static constexpr char RESULT_CACHE_MAGIC[8] = {'R', 'C', 'M', 'B',
+                                               'R', 'C', '0', '2'};
+
+// ファイルから読み込む 1 つのエントリの大きさの上限 (壊れたファイル対策)
+static constexpr uint32_t MAX_RESULT_CACHE_ENTRY_SIZE = 1 << 26;
+
+bool ResultCacheClass::find(const std::string& key,
+                            std::vector<Combination>& out_combs) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Entry* entry = lookup(key, KIND_COMBINATION);
+  if (!entry) {
+    num_misses++;
+    return false;
+  }
+  const auto& bin = entry->binary;
+  BinaryReader reader(bin.tags.data(), bin.tags.size(), bin.values.data(),
+                      bin.values.size());
+  std::vector<Combination> combs;
+  for (uint32_t i = 0; i < entry->num_results; i++) {
+    Combination comb = read_combination_binary(
+        reader, static_cast<ComponentType>(entry->type));
+    if (!comb || comb->verify() != result_t::SUCCESS) break;
+    combs.emplace_back(std::move(comb));
+  }
+  if (combs.size() != entry->num_results || !reader.at_end()) {
+    RCMB_DEBUG_PRINT("Broken result cache entry\n");
+    erase(key);
+    num_misses++;
+    return false;
+  }
+  num_hits++;
+  out_combs = std::move(combs);
+  return true;
+}
+
+bool ResultCacheClass::find(const std::string& key,
+                            std::vector<DoubleCombination>& out_combs) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Entry* entry = lookup(key, KIND_DIVIDER);
+  if (!entry) {
+    num_misses++;
+    return false;
+  }
+  const auto& bin = entry->binary;
+  BinaryReader reader(bin.tags.data(), bin.tags.size(), bin.values.data(),
+                      bin.values.size());
+  std::vector<DoubleCombination> combs;
+  for (uint32_t i = 0; i < entry->num_results; i++) {
+    DoubleCombination comb = read_double_combination_binary(reader);
+    if (!comb || comb->verify() != result_t::SUCCESS) break;
+    combs.emplace_back(std::move(comb));
+  }
+  if (combs.size() != entry->num_results || !reader.at_end()) {
+    RCMB_DEBUG_PRINT("Broken result cache entry\n");
+    erase(key);
+    num_misses++;
+    return false;
+  }
+  num_hits++;
+  out_combs = std::move(combs);
+  return true;
+}
+
+void ResultCacheClass::store(const std::string& key,
+                             const std::vector<Combination>& combs) {
+  Entry entry;
+  entry.key = key;
+  entry.kind = KIND_COMBINATION;
+  entry.type = combs.empty() ? 0 : static_cast<uint8_t>(combs[0]->type);
+  entry.num_results = static_cast<uint32_t>(combs.size());
+  for (const auto& comb : combs) {
+    comb->write_binary(entry.binary);
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  insert(std::move(entry));
+}
+
+void ResultCacheClass::store(const std::string& key,
+                             const std::vector<DoubleCombination>& combs) {
+  Entry entry;
+  entry.key = key;
+  entry.kind = KIND_DIVIDER;
+  entry.type = static_cast<uint8_t>(ComponentType::Resistor);
+  entry.num_results = static_cast<uint32_t>(combs.size());
+  for (const auto& comb : combs) {
+    comb->write_binary(entry.binary);
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  insert(std::move(entry));
+}
+
+void ResultCacheClass::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  entries.clear();
+  index.clear();
+}
+
+// key のエントリを探して最近使ったものにする
+ResultCacheClass::Entry* ResultCacheClass::lookup(const std::string& key,
+                                                  uint8_t kind) {
+  auto it = index.find(key);
+  if (it == index.end() || it->second->kind != kind) {
+    return nullptr;
+  }
+  entries.splice(entries.begin(), entries, it->second);
+  return &entries.front();
+}
+
+void ResultCacheClass::insert(Entry&& entry) {
+  erase(entry.key);
+  entries.emplace_front(std::move(entry));
+  index[entries.front().key] = entries.begin();
+  while (entries.size() > max_entries) {
+    index.erase(entries.back().key);
+    entries.pop_back();
+  }
+}
+
+void ResultCacheClass::erase(const std::string& key) {
+  auto it = index.find(key);
+  if (it == index.end()) return;
+  entries.erase(it->second);
+  index.erase(it);
+}
+
+// エントリの種類と素子の種類が既知の組か
+bool ResultCacheClass::is_valid_kind(uint8_t kind, uint8_t type) {
+  const uint8_t resistor = static_cast<uint8_t>(ComponentType::Resistor);
+  const uint8_t capacitor = static_cast<uint8_t>(ComponentType::Capacitor);
+  if (kind == KIND_COMBINATION) {
+    return type == resistor || type == capacitor;
+  }
+  return kind == KIND_DIVIDER && type == resistor;
+}
+
+// ファイルの破損を検出するための、エントリの内容の FNV-1a ハッシュ
+uint64_t ResultCacheClass::checksum_of(const Entry& entry) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  const auto feed = [&](const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+  };
+  feed(entry.key.data(), entry.key.size());
+  feed(&entry.kind, sizeof(entry.kind));
+  feed(&entry.type, sizeof(entry.type));
+  feed(&entry.num_results, sizeof(entry.num_results));
+  feed(entry.binary.tags.data(), entry.binary.tags.size());
+  feed(entry.binary.values.data(),
+       entry.binary.values.size() * sizeof(double));
+  return hash;
+}
+
+// ファイルの形式 (数値はこの環境のバイト順):
+//   先頭 RESULT_CACHE_MAGIC、エントリ数 (uint32)
+//   古いものから順に各エントリ:
+//     キーの長さ (uint32)、キー、種類 (uint8)、素子の種類 (uint8)、
+//     結果の数・タグの数・値の数 (uint32 x 3)、タグの列、値の列、
+//     ここまでの内容のチェックサム (uint64、checksum_of())
+result_t ResultCacheClass::save(const std::string& path) const {
+  FILE* fp = std::fopen(path.c_str(), "wb");
+  if (!fp) {
+    RCMB_DEBUG_PRINT("Failed to open result cache: %s\n", path.c_str());
+    return result_t::FILE_IO_ERROR;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  const auto put = [&](const void* data, size_t size) {
+    return size == 0 || std::fwrite(data, size, 1, fp) == 1;
+  };
+  const uint32_t num_entries = static_cast<uint32_t>(entries.size());
+  bool ok = put(RESULT_CACHE_MAGIC, sizeof(RESULT_CACHE_MAGIC)) &&
+            put(&num_entries, sizeof(num_entries));
+  for (auto it = entries.rbegin(); ok && it != entries.rend(); it++) {
+    const uint32_t sizes[] = {
+        static_cast<uint32_t>(it->key.size()),
+        it->num_results,
+        static_cast<uint32_t>(it->binary.tags.size()),
+        static_cast<uint32_t>(it->binary.values.size()),
+    };
+    const uint64_t checksum = checksum_of(*it);
+    ok = put(&sizes[0], sizeof(uint32_t)) &&
+         put(it->key.data(), it->key.size()) &&
+         put(&it->kind, sizeof(it->kind)) &&
+         put(&it->type, sizeof(it->type)) &&
+         put(&sizes[1], sizeof(uint32_t) * 3) &&
+         put(it->binary.tags.data(), it->binary.tags.size()) &&
+         put(it->binary.values.data(),
+             it->binary.values.size() * sizeof(double)) &&
+         put(&checksum, sizeof(checksum));
+  }
+  if (std::fclose(fp) != 0) ok = false;
+  return ok ? result_t::SUCCESS : result_t::FILE_IO_ERROR;
+}
+
+result_t ResultCacheClass::load(const std::string& path) {
+  FILE* fp = std::fopen(path.c_str(), "rb");
+  if (!fp) {
+    return result_t::FILE_IO_ERROR;
+  }
+  const auto get = [&](void* data, size_t size) {
+    return size == 0 || std::fread(data, size, 1, fp) == 1;
+  };
+
+  // 全て読めた場合だけ加える
+  std::vector<Entry> loaded;
+  char magic[sizeof(RESULT_CACHE_MAGIC)];
+  uint32_t num_entries = 0;
+  bool ok = get(magic, sizeof(magic)) &&
+            std::equal(magic, magic + sizeof(magic), RESULT_CACHE_MAGIC) &&
+            get(&num_entries, sizeof(num_entries));
+  for (uint32_t i = 0; ok && i < num_entries; i++) {
+    Entry entry;
+    uint32_t key_size;
+    uint32_t sizes[3];
+    ok = get(&key_size, sizeof(key_size)) &&
+         key_size <= MAX_RESULT_CACHE_ENTRY_SIZE;
+    if (!ok) break;
+    entry.key.resize(key_size);
+    ok = get(entry.key.data(), key_size) &&
+         get(&entry.kind, sizeof(entry.kind)) &&
+         get(&entry.type, sizeof(entry.type)) &&
+         is_valid_kind(entry.kind, entry.type) &&
+         get(sizes, sizeof(sizes)) &&
+         sizes[1] <= MAX_RESULT_CACHE_ENTRY_SIZE &&
+         sizes[2] <= MAX_RESULT_CACHE_ENTRY_SIZE;
+    if (!ok) break;
+    entry.num_results = sizes[0];
+    entry.binary.tags.resize(sizes[1]);
+    entry.binary.values.resize(sizes[2]);
+    uint64_t checksum;
+    ok = get(entry.binary.tags.data(), sizes[1]) &&
+         get(entry.binary.values.data(), sizes[2] * sizeof(double)) &&
+         get(&checksum, sizeof(checksum)) && checksum == checksum_of(entry);
+    if (ok) loaded.emplace_back(std::move(entry));
+  }
+  std::fclose(fp);
+  if (!ok) {
+    RCMB_DEBUG_PRINT("Invalid result cache: %s\n", path.c_str());
+    return result_t::INVALID_CACHE_FILE;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto& entry : loaded) {
+    insert(std::move(entry));
+  }
+  return result_t::SUCCESS;
+}
+
+#endif
+
+}  // namespace rcmb
+
+#endif
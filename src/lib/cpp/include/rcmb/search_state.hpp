@@ -1,6 +1,7 @@
 #ifndef RCMB_SEARCH_STATE_HPP
 #define RCMB_SEARCH_STATE_HPP
 
+#include <atomic>
 #include <cstdint>
 #include <map>
 #include <memory>
@@ -13,7 +14,7 @@
 
 namespace rcmb {
 
-extern uint32_t num_search_states;
+extern std::atomic<uint32_t> num_search_states;
 
 class SearchStateClass;
 using SearchState = std::shared_ptr<SearchStateClass>;
@@ -36,6 +37,19 @@ class SearchStateClass {
   value_t min = 0;
   value_t max = VALUE_POSITIVE_INFINITY;
 
+  // 全ての葉の値が 1 のときの値と、弟ノード全体のその和・逆数和
+  value_t unit = 1;
+  value_t next_units = 0;
+  value_t next_inv_units = 0;
+
+  // 部分木が取り得る値の範囲
+  value_t reach_min = 0;
+  value_t reach_max = VALUE_POSITIVE_INFINITY;
+
+  // 弟ノード全体の積算値が取り得る範囲
+  value_t rest_min = 0;
+  value_t rest_max = VALUE_POSITIVE_INFINITY;
+
   SearchStateClass(const Topology& topo, bool inv_sum, bool is_finisher)
       : id(generate_object_id()),
         topology(topo),
@@ -68,11 +82,73 @@ class SearchStateClass {
   inline bool is_root() const { return !parent; }
 
   void update_min_max(value_t min, value_t max);
+  void update_reach(value_t elem_min, value_t elem_max);
+
+  // 条件を満たす値が無いことを長男方向に伝播
+  inline void mark_infeasible() {
+    for (auto st = this; st; st = st->first_child.get()) {
+      st->min = VALUE_POSITIVE_INFINITY;
+      st->max = 0;
+    }
+  }
+
+  value_t implied_value(value_t root_val) const;
 
-  Combination bake(ComponentType type) const;
+  Combination bake(ComponentType type,
+                   const ResultArena& arena = nullptr) const;
   std::string to_string() const;
 };
 
+// 親ノードの値域 [min, max]、兄ノードまでの積算値 partial、
+// 弟ノード全体の積算値の範囲 [rest_min, rest_max] から子ノードの値域を求める
+// 条件を満たす値が無い場合は false を返す
+static inline bool child_range(bool inv_sum, value_t min, value_t max,
+                               value_t partial, value_t rest_min,
+                               value_t rest_max, value_t* child_min,
+                               value_t* child_max) {
+  value_t lo, hi;
+  if (inv_sum) {
+    // 並列和: 1 / max <= partial + 1 / child + rest <= 1 / min
+    const value_t inv_lo = 1 / max - partial - rest_max;
+    const value_t inv_hi = 1 / min - partial - rest_min;
+    if (inv_hi <= 0) return false;
+    lo = 1 / inv_hi;
+    hi = inv_lo > 0 ? (1 / inv_lo) : VALUE_POSITIVE_INFINITY;
+  } else {
+    // 直列和: min <= partial + child + rest <= max
+    lo = min - partial - rest_max;
+    hi = max - partial - rest_min;
+    if (hi <= 0) return false;
+    if (lo < 0) lo = 0;
+  }
+  if (lo > hi) return false;
+  *child_min = lo;
+  *child_max = hi;
+  return true;
+}
+
+// 親ノードの値 parent_val と兄ノードまでの積算値 partial から、弟ノードが
+// それぞれの単位値に比例した値を取ると仮定したときの子ノードの値を推定する
+// (unit は子ノード、next_units/next_inv_units は弟ノード全体の単位値の和)
+// 推定できない場合は VALUE_NONE を返す
+static inline value_t implied_child_value(bool inv_sum, value_t parent_val,
+                                          value_t partial, value_t unit,
+                                          value_t next_units,
+                                          value_t next_inv_units) {
+  if (inv_sum) {
+    // 残りのコンダクタンスを単位値の逆数に比例して分配
+    const value_t rest = 1 / parent_val - partial;
+    if (rest <= 0) return VALUE_NONE;
+    const value_t inv_unit = 1 / unit;
+    return (inv_unit + next_inv_units) / (rest * inv_unit);
+  } else {
+    // 残りの値を単位値に比例して分配
+    const value_t rest = parent_val - partial;
+    if (rest <= 0) return VALUE_NONE;
+    return rest * unit / (unit + next_units);
+  }
+}
+
 static inline SearchState create_search_state(const Topology& topo,
                                               bool inv_sum, bool is_finisher) {
   return std::make_shared<SearchStateClass>(topo, inv_sum, is_finisher);
@@ -81,10 +157,25 @@ static inline SearchState create_search_state(const Topology& topo,
 SearchState build_search_state_tree(ComponentType type,
                                     std::vector<SearchState>& leafs,
                                     Topology& node, bool is_finisher = true);
+value_t unit_value_of(ComponentType type, const Topology& topology);
+
+// 生存している探索木のノードが使用するメモリの見積もり
+static inline size_t search_state_memory_size() {
+  return num_search_states * (sizeof(SearchStateClass) + CONTROL_BLOCK_SIZE);
+}
+
+// topology の探索木を生成する場合に必要なメモリの見積もり
+static inline size_t estimate_search_state_memory(const Topology& topology) {
+  size_t size = sizeof(SearchStateClass) + CONTROL_BLOCK_SIZE;
+  for (const auto& child : topology->children) {
+    size += estimate_search_state_memory(child);
+  }
+  return size;
+}
 
 #ifdef RCMB_IMPLEMENTATION
 
-uint32_t num_search_states = 0;
+std::atomic<uint32_t> num_search_states = 0;
 
 // このノードとその長男ノードに再帰的に min/max を設定
 void SearchStateClass::update_min_max(value_t min, value_t max) {
@@ -98,27 +189,72 @@ void SearchStateClass::update_min_max(value_t min, value_t max) {
   max += max / 1e9;
 
   while (st) {
+    // 部分木が取り得る値の範囲で絞り込む
+    if (min < st->reach_min) min = st->reach_min;
+    if (max > st->reach_max) max = st->reach_max;
+    if (min > max) {
+      st->mark_infeasible();
+      return;
+    }
+
     st->min = min;
     st->max = max;
-    if (st->inv_sum) {
-      max = VALUE_POSITIVE_INFINITY;
-    } else {
-      min = 0;
+
+    // 長男の値域は弟ノード全体が取り得る範囲を除いて求める
+    const auto child = st->first_child.get();
+    if (child && !child_range(st->inv_sum, min, max, 0, child->rest_min,
+                              child->rest_max, &min, &max)) {
+      child->mark_infeasible();
+      return;
     }
-    st = st->first_child.get();
+    st = child;
+  }
+}
+
+// 素子の値の範囲から、部分木と弟ノード全体が取り得る値の範囲を設定
+void SearchStateClass::update_reach(value_t elem_min, value_t elem_max) {
+  reach_min = unit * elem_min;
+  reach_max = unit * elem_max;
+  reach_min -= reach_min / 1e9;
+  reach_max += reach_max / 1e9;
+
+  if (parent && parent->inv_sum) {
+    rest_min = next_inv_units / elem_max;
+    rest_max = next_inv_units / elem_min;
+  } else {
+    rest_min = next_units * elem_min;
+    rest_max = next_units * elem_max;
+  }
+
+  for (auto child = first_child.get(); child;
+       child = child->next_brother.get()) {
+    child->update_reach(elem_min, elem_max);
   }
 }
 
+// 根の値が root_val になるために、兄ノードまでの値を固定したとき
+// このノードが取るべき値を推定する
+value_t SearchStateClass::implied_value(value_t root_val) const {
+  if (is_root()) return root_val;
+  const value_t parent_val = parent->implied_value(root_val);
+  if (!value_is_valid(parent_val)) return VALUE_NONE;
+  const value_t partial = prev_brother ? prev_brother->accum : 0;
+  return implied_child_value(parent->inv_sum, parent_val, partial, unit,
+                             next_units, next_inv_units);
+}
+
 // 検索結果を Combination に変換
-Combination SearchStateClass::bake(ComponentType type) const {
-  std::vector<Combination> child_combs;
+Combination SearchStateClass::bake(ComponentType type,
+                                   const ResultArena& arena) const {
+  CombinationList child_combs(resource_of(arena));
+  child_combs.reserve(topology->children.size());
   auto child = this->first_child;
   while (child) {
-    child_combs.emplace_back(child->bake(type));
+    child_combs.emplace_back(child->bake(type, arena));
     child = child->next_brother;
   }
-  return create_combination(this->topology, type, std::move(child_combs),
-                            this->value);
+  return create_combination(arena, this->topology, type,
+                            std::move(child_combs), this->value);
 }
 
 std::string SearchStateClass::to_string() const {
@@ -177,11 +313,39 @@ SearchState build_search_state_tree(ComponentType type,
       }
       prev_brother = child_st;
     }
+
+    // 部分木の値域計算用の係数
+    value_t units = 0;
+    value_t inv_units = 0;
+    for (auto child = prev_brother; child; child = child->prev_brother) {
+      child->next_units = units;
+      child->next_inv_units = inv_units;
+      units += child->unit;
+      inv_units += 1 / child->unit;
+    }
+    st->unit = inv_sum ? (1 / inv_units) : units;
   }
 
   return st;
 }
 
+// 全ての葉の値が 1 のときの部分木の値
+value_t unit_value_of(ComponentType type, const Topology& topology) {
+  if (topology->is_leaf()) {
+    return 1;
+  }
+  const bool inv_sum = (type == ComponentType::Resistor) ? topology->parallel
+                                                         : !topology->parallel;
+  value_t units = 0;
+  value_t inv_units = 0;
+  for (const auto& child : topology->children) {
+    const value_t unit = unit_value_of(type, child);
+    units += unit;
+    inv_units += 1 / unit;
+  }
+  return inv_sum ? (1 / inv_units) : units;
+}
+
 #endif
 
 }  // namespace rcmb
@@ -0,0 +1,264 @@
+#ifndef RCMB_SUBTREE_CACHE_HPP
+#define RCMB_SUBTREE_CACHE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#include "rcmb/common.hpp"
+#include "rcmb/topology.hpp"
+
+namespace rcmb {
+
+// 1 つの部分木に格納する最大エントリ数 (これを超える場合は作らない)
+static constexpr size_t MAX_SUBTREE_SET_SIZE = 1 << 14;
+
+// キャッシュ全体で保持する最大の値の個数
+static constexpr size_t MAX_SUBTREE_CACHE_VALUES = 1 << 22;
+
+// 部分木が取り得る全ての値の集合 (値の昇順)
+// 重複回避のため、同じトポロジの隣り合う兄弟が降順のものだけを格納する
+class SubtreeValueSet {
+ public:
+  // 1 エントリあたりの子孫ノード数
+  const int stride;
+  std::vector<value_t> values;
+  // 各エントリの子孫ノードの値 (行きがけ順)
+  std::vector<value_t> nodes;
+
+  SubtreeValueSet(int stride) : stride(stride) {}
+
+  inline size_t size() const { return values.size(); }
+
+  // 値が [min, max] に入る範囲の先頭インデックスを返す
+  int get_range(value_t min, value_t max, int* count) const {
+    const auto begin = std::lower_bound(values.begin(), values.end(), min);
+    const auto end = std::upper_bound(begin, values.end(), max);
+    *count = static_cast<int>(end - begin);
+    return static_cast<int>(begin - values.begin());
+  }
+
+  // [min, max] の範囲で target を挟む前後の値 (同値のものを含む)
+  // の範囲の先頭インデックスを返す
+  int get_nearest(value_t target, value_t min, value_t max, int* count) const {
+    int n;
+    const int offset = get_range(min, max, &n);
+    const value_t* range = values.data() + offset;
+    int i_start = static_cast<int>(std::lower_bound(range, range + n, target) -
+                                   range);
+    int i_end = i_start;
+    if (i_start > 0) {
+      const value_t lower = range[--i_start];
+      while (i_start > 0 && range[i_start - 1] >= lower - lower / 1e9) {
+        i_start--;
+      }
+    }
+    if (i_end < n) {
+      const value_t upper = range[i_end++];
+      while (i_end < n && range[i_end] <= upper + upper / 1e9) {
+        i_end++;
+      }
+    }
+    *count = i_end - i_start;
+    return offset + i_start;
+  }
+};
+
+// トポロジ ID ごとの部分木の値の集合のキャッシュ
+class SubtreeValueCache {
+ public:
+  // built_size を指定すると、この呼び出しで新たに生成した集合の
+  // メモリ使用量をそこに加算する
+  const SubtreeValueSet* get(const Topology& topo, bool inv_sum,
+                             std::span<const value_t> elems,
+                             size_t* built_size = nullptr);
+
+  // キャッシュが使用するメモリの見積もり
+  size_t memory_size() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return num_values * sizeof(value_t);
+  }
+
+ private:
+  // 子ノードの値の集合 (葉の場合は素子の値そのもの)
+  struct ChildView {
+    uint32_t id;
+    const value_t* values;
+    const value_t* nodes;
+    int stride;
+    int size;
+  };
+
+  std::map<uint64_t, std::unique_ptr<SubtreeValueSet>> sets;
+  size_t num_values = 0;
+  // 別スレッドの探索から同時に呼ばれることがある (生成は再帰的)
+  std::recursive_mutex mutex;
+
+  std::unique_ptr<SubtreeValueSet> build(const Topology& topo, bool inv_sum,
+                                         std::span<const value_t> elems);
+  static bool count_entries(const std::vector<ChildView>& children,
+                            size_t pos, value_t limit, size_t* count);
+};
+
+#ifdef RCMB_IMPLEMENTATION
+
+// 同じトポロジの兄の値以下のエントリ数
+static inline int num_entries_below(const value_t* values, int size,
+                                    value_t limit) {
+  return static_cast<int>(std::upper_bound(values, values + size, limit) -
+                          values);
+}
+
+// 子ノードの値を組み合わせたエントリ数を数える (上限を超えたら false)
+bool SubtreeValueCache::count_entries(const std::vector<ChildView>& children,
+                                      size_t pos, value_t limit,
+                                      size_t* count) {
+  const auto& c = children[pos];
+  const bool same = pos > 0 && c.id == children[pos - 1].id;
+  const int n = same ? num_entries_below(c.values, c.size, limit) : c.size;
+  if (pos + 1 >= children.size()) {
+    *count += n;
+    return *count <= MAX_SUBTREE_SET_SIZE;
+  }
+  for (int i = 0; i < n; i++) {
+    if (!count_entries(children, pos + 1, c.values[i], count)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// 部分木の値の集合を取得 (初回に生成、大きすぎる場合は nullptr)
+const SubtreeValueSet* SubtreeValueCache::get(const Topology& topo,
+                                              bool inv_sum,
+                                              std::span<const value_t> elems,
+                                              size_t* built_size) {
+  if (topo->is_leaf()) {
+    return nullptr;
+  }
+
+  const uint64_t key =
+      (static_cast<uint64_t>(topo->id) << 1) | (inv_sum ? 1 : 0);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  const auto it = sets.find(key);
+  if (it != sets.end()) {
+    return it->second.get();
+  }
+
+  // 子ノードの集合も再帰的に生成するので、生成した量は増分で求める
+  const size_t num_values_before = num_values;
+  auto set = build(topo, inv_sum, elems);
+  const SubtreeValueSet* ret = set.get();
+  if (set) {
+    num_values += set->size() * (1 + set->stride);
+  }
+  sets[key] = std::move(set);
+  if (built_size) {
+    *built_size += (num_values - num_values_before) * sizeof(value_t);
+  }
+  return ret;
+}
+
+std::unique_ptr<SubtreeValueSet> SubtreeValueCache::build(
+    const Topology& topo, bool inv_sum, std::span<const value_t> elems) {
+  // 子ノードの値の集合を収集
+  std::vector<ChildView> children;
+  int stride = 0;
+  for (const auto& child : topo->children) {
+    if (child->is_leaf()) {
+      children.push_back({child->id, elems.data(), nullptr, 0,
+                          static_cast<int>(elems.size())});
+      stride += 1;
+    } else {
+      const auto child_set = get(child, !inv_sum, elems);
+      if (!child_set) {
+        return nullptr;
+      }
+      children.push_back({child->id, child_set->values.data(),
+                          child_set->nodes.data(), child_set->stride,
+                          static_cast<int>(child_set->size())});
+      stride += 1 + child_set->stride;
+    }
+  }
+
+  // エントリ数を数えて大きすぎる場合は作らない
+  size_t count = 0;
+  if (!count_entries(children, 0, 0, &count)) {
+    return nullptr;
+  }
+  if (num_values + count * (1 + stride) > MAX_SUBTREE_CACHE_VALUES) {
+    return nullptr;
+  }
+
+  // 子ノードの値を総当たりで組み合わせる
+  std::vector<value_t> entry_values;
+  std::vector<value_t> entry_nodes;
+  entry_values.reserve(count);
+  entry_nodes.reserve(count * stride);
+  std::vector<int> indices(children.size(), 0);
+  std::vector<int> ends(children.size(), 0);
+  const int num_children = static_cast<int>(children.size());
+  int pos = 0;
+  ends[0] = children[0].size;
+  indices[0] = 0;
+  while (pos >= 0) {
+    if (indices[pos] >= ends[pos]) {
+      pos--;
+      if (pos >= 0) indices[pos]++;
+      continue;
+    }
+    if (pos + 1 < num_children) {
+      // 次の子ノードへ (同じトポロジの兄の値以下に限る)
+      const auto& next = children[pos + 1];
+      pos++;
+      indices[pos] = 0;
+      const auto& prev = children[pos - 1];
+      ends[pos] = next.id == prev.id
+                      ? num_entries_below(next.values, next.size,
+                                          prev.values[indices[pos - 1]])
+                      : next.size;
+      continue;
+    }
+
+    // 探索木での積算と同じ順序で計算して丸め誤差を揃える
+    value_t accum = 0;
+    for (int i = 0; i < num_children; i++) {
+      const auto& c = children[i];
+      const value_t v = c.values[indices[i]];
+      accum += inv_sum ? (1 / v) : v;
+      entry_nodes.push_back(v);
+      const value_t* desc = c.nodes + static_cast<size_t>(indices[i]) * c.stride;
+      entry_nodes.insert(entry_nodes.end(), desc, desc + c.stride);
+    }
+    entry_values.push_back(inv_sum ? (1 / accum) : accum);
+    indices[pos]++;
+  }
+
+  // 値の昇順に並べ替え
+  std::vector<int> order(entry_values.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    return entry_values[a] < entry_values[b];
+  });
+
+  auto set = std::make_unique<SubtreeValueSet>(stride);
+  set->values.reserve(order.size());
+  set->nodes.reserve(order.size() * stride);
+  for (int i : order) {
+    set->values.push_back(entry_values[i]);
+    const value_t* desc = entry_nodes.data() + static_cast<size_t>(i) * stride;
+    set->nodes.insert(set->nodes.end(), desc, desc + stride);
+  }
+  return set;
+}
+
+#endif
+
+}  // namespace rcmb
+
+#endif
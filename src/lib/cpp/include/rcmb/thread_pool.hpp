@@ -0,0 +1,166 @@
+#ifndef RCMB_THREAD_POOL_HPP
+#define RCMB_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rcmb {
+
+class ThreadPoolClass;
+using ThreadPool = std::shared_ptr<ThreadPoolClass>;
+
+// 探索を分割して並行に実行するスレッドプール
+// run() を呼んだスレッドもワーカーの 1 つとしてタスクを実行する
+class ThreadPoolClass {
+ public:
+  // task(タスク番号, ワーカー番号)
+  // ワーカー番号は 0 .. size() - 1 で、0 は run() を呼んだスレッド
+  using task_t = std::function<void(int task, int worker)>;
+
+  // num_threads は run() を呼ぶスレッドを含む数 (1 なら別スレッドを作らない)
+  ThreadPoolClass(int num_threads);
+  ~ThreadPoolClass();
+
+  ThreadPoolClass(const ThreadPoolClass&) = delete;
+  ThreadPoolClass& operator=(const ThreadPoolClass&) = delete;
+
+  inline int size() const { return static_cast<int>(threads.size()) + 1; }
+
+  // num_tasks 個のタスクを並行に実行し、全て終わるまで待つ
+  // 起動が間に合わないワーカーがあっても、残りのワーカーで全て実行する
+  // (別スレッドからの run() は順に実行する、タスク内から呼んではいけない)
+  void run(int num_tasks, const task_t& task);
+
+ private:
+  std::vector<std::thread> threads;
+
+  // run() の直列化
+  std::mutex run_mutex;
+
+  std::mutex mutex;
+  std::condition_variable start_cv;
+  std::condition_variable done_cv;
+  const task_t* current_task = nullptr;
+  int num_tasks = 0;
+  // run() の世代 (上位 32 ビット) と次に実行するタスク番号 (下位 32 ビット)
+  // 前の run() のタスクを探していたワーカーが、次の run() のタスクを
+  // 取り違えないように世代と一緒に更新する
+  std::atomic<uint64_t> next_task = 0;
+  std::atomic<int> num_done_tasks = 0;
+  uint32_t generation = 0;
+  bool stopping = false;
+
+  void worker_main(int worker);
+  void consume(uint32_t generation, const task_t& task, int num_tasks,
+               int worker);
+};
+
+static inline ThreadPool create_thread_pool(int num_threads) {
+  return std::make_shared<ThreadPoolClass>(num_threads);
+}
+
+// 既定のスレッド数 (論理コア数、取得できない場合は 1)
+static inline int default_num_threads() {
+  return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+#ifdef RCMB_IMPLEMENTATION
+
+ThreadPoolClass::ThreadPoolClass(int num_threads) {
+  for (int i = 1; i < num_threads; i++) {
+    threads.emplace_back([this, i] { worker_main(i); });
+  }
+}
+
+ThreadPoolClass::~ThreadPoolClass() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  start_cv.notify_all();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+void ThreadPoolClass::run(int num_tasks, const task_t& task) {
+  if (num_tasks <= 0) return;
+  std::lock_guard<std::mutex> run_lock(run_mutex);
+  if (threads.empty() || num_tasks == 1) {
+    for (int i = 0; i < num_tasks; i++) {
+      task(i, 0);
+    }
+    return;
+  }
+
+  uint32_t gen;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    gen = ++generation;
+    current_task = &task;
+    this->num_tasks = num_tasks;
+    num_done_tasks = 0;
+    next_task = static_cast<uint64_t>(gen) << 32;
+  }
+  start_cv.notify_all();
+
+  consume(gen, task, num_tasks, 0);
+
+  // 他のワーカーが手持ちのタスクを終えるまで待つ
+  std::unique_lock<std::mutex> lock(mutex);
+  done_cv.wait(lock, [&] { return num_done_tasks == num_tasks; });
+  current_task = nullptr;
+}
+
+void ThreadPoolClass::worker_main(int worker) {
+  uint32_t last_generation = 0;
+  while (true) {
+    const task_t* task;
+    int num_tasks;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      start_cv.wait(lock, [&] {
+        return stopping ||
+               (current_task != nullptr && generation != last_generation);
+      });
+      if (stopping) return;
+      last_generation = generation;
+      task = current_task;
+      num_tasks = this->num_tasks;
+    }
+    consume(last_generation, *task, num_tasks, worker);
+  }
+}
+
+// 世代 gen のタスクが残っている間、取り出して実行
+void ThreadPoolClass::consume(uint32_t gen, const task_t& task, int num_tasks,
+                              int worker) {
+  uint64_t next = next_task.load();
+  while (true) {
+    if (static_cast<uint32_t>(next >> 32) != gen) return;
+    const int i = static_cast<int>(next & 0xffffffff);
+    if (i >= num_tasks) return;
+    if (!next_task.compare_exchange_weak(next, next + 1)) continue;
+
+    task(i, worker);
+
+    if (++num_done_tasks == num_tasks) {
+      std::lock_guard<std::mutex> lock(mutex);
+      done_cv.notify_all();
+    }
+    next = next_task.load();
+  }
+}
+
+#endif
+
+}  // namespace rcmb
+
+#endif
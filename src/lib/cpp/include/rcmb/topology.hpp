@@ -1,16 +1,19 @@
 #ifndef RCMB_TOPOLOGY_HPP
 #define RCMB_TOPOLOGY_HPP
 
+#include <atomic>
 #include <cstdint>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include "rcmb/common.hpp"
 
 namespace rcmb {
 
-extern uint32_t num_topologies;
+extern std::atomic<uint32_t> num_topologies;
+extern std::atomic<size_t> topology_memory_size;
 
 class TopologyClass;
 using Topology = std::shared_ptr<TopologyClass>;
@@ -58,12 +61,22 @@ class TopologyClass {
         depth(count_depth(this->children)),
         id(generate_object_id()) {
     num_topologies++;
+    topology_memory_size += memory_size();
   }
 
-  ~TopologyClass() { num_topologies--; }
+  ~TopologyClass() {
+    num_topologies--;
+    topology_memory_size -= memory_size();
+  }
 
   inline bool is_leaf() const { return num_leafs == 1; }
 
+  // このノードが使用するメモリの見積もり (キャッシュ内の参照を含む)
+  inline size_t memory_size() const {
+    return sizeof(TopologyClass) + CONTROL_BLOCK_SIZE +
+           (children.size() + 1) * sizeof(Topology);
+  }
+
 #ifdef RCMB_DEBUG
   inline std::string to_string() const {
     if (is_leaf()) {
@@ -91,7 +104,16 @@ static inline Topology create_topology_node(bool parallel,
   return std::make_shared<TopologyClass>(parallel, std::move(children));
 }
 
+// 同じ素子数・並列/直列のトポロジの一覧
+using TopologyList = std::shared_ptr<std::vector<Topology>>;
+
+TopologyList get_topology_list(int num_leafs, bool parallel);
 std::vector<Topology>& get_topologies(int num_leafs, bool parallel);
+size_t estimate_num_topologies(int num_leafs);
+size_t estimate_topology_memory(int num_leafs, bool parallel);
+void release_cached_topologies(int max_num_leafs);
+Topology find_cached_topology(bool parallel,
+                              const std::vector<Topology>& children);
 
 std::vector<int> get_num_topologies();
 
@@ -99,7 +121,14 @@ std::vector<int> get_num_topologies();
 
 static int PARALLEL_OFFSET = 1024;
 
-uint32_t num_topologies = 0;
+std::atomic<uint32_t> num_topologies = 0;
+std::atomic<size_t> topology_memory_size = 0;
+
+// 並列・直列それぞれのトポロジの数 (直並列回路の数 A000084 の半分)
+static constexpr size_t NUM_TOPOLOGIES[] = {
+    0,    1,     1,     2,     5,      12,     33,     90,
+    261,  766,   2312,  7068,  21965,  68954,  218751, 699534,
+};
 
 // ノード分割のコンテキスト
 struct NodeDivideContext {
@@ -109,23 +138,31 @@ struct NodeDivideContext {
 };
 
 // トポロジのキャッシュ
-std::map<int, std::vector<Topology>> cache;
+// 生成済みのトポロジは変更しないので、参照は排他せずに共有できる
+std::map<int, TopologyList> cache;
+// 生成は再帰的に行われるため再帰ロックで保護する
+std::recursive_mutex cache_mutex;
 
 static void split_children_recursive(NodeDivideContext& ctx, int num_parts,
                                      int leafs_remaining);
 static void collect_children(NodeDivideContext& ctx, int num_parts);
 
+static inline uint32_t topology_cache_key(int num_leafs, bool parallel) {
+  return num_leafs + ((num_leafs >= 2 && parallel) ? PARALLEL_OFFSET : 0);
+}
+
 // num_children個の子ノードを持つ全トポロジーを取得
-std::vector<Topology>& get_topologies(int num_leafs, bool parallel) {
-  const uint32_t key =
-      num_leafs + ((num_leafs >= 2 && parallel) ? PARALLEL_OFFSET : 0);
+// 返した一覧はキャッシュが解放されても参照している間は有効
+TopologyList get_topology_list(int num_leafs, bool parallel) {
+  const uint32_t key = topology_cache_key(num_leafs, parallel);
 
+  std::lock_guard<std::recursive_mutex> lock(cache_mutex);
   if (!cache.contains(key)) {
     if (num_leafs == 1) {
       // 葉ノードの生成
       const auto leaf = create_topology_node(parallel, std::vector<Topology>{});
-      const std::vector<Topology> nodes = {leaf};
-      cache[key] = nodes;
+      cache[key] = std::make_shared<std::vector<Topology>>(
+          std::vector<Topology>{leaf});
     } else if (num_leafs > 1) {
       // 子ノードを再帰的に分割
       std::vector<Topology> nodes;
@@ -135,7 +172,8 @@ std::vector<Topology>& get_topologies(int num_leafs, bool parallel) {
           .nodes = nodes,
       };
       split_children_recursive(ctx, 0, num_leafs);
-      cache[key] = ctx.nodes;
+      cache[key] =
+          std::make_shared<std::vector<Topology>>(std::move(ctx.nodes));
     } else {
       throw std::runtime_error("num_leafs must be >= 1");
     }
@@ -145,7 +183,7 @@ std::vector<Topology>& get_topologies(int num_leafs, bool parallel) {
     //   RCMB_DEBUG_PRINT("new topology: %s\n", topo->to_string().c_str());
     // }
     RCMB_DEBUG_PRINT("Generated %d topologies for n=%d, parallel=%d\n",
-                       static_cast<int>(cache[key].size()), num_leafs,
+                       static_cast<int>(cache[key]->size()), num_leafs,
                        parallel ? 1 : 0);
 #endif
   }
@@ -153,6 +191,73 @@ std::vector<Topology>& get_topologies(int num_leafs, bool parallel) {
   return cache[key];
 }
 
+// num_children個の子ノードを持つ全トポロジーを取得
+// 返した参照は release_cached_topologies() で解放されるまで有効
+std::vector<Topology>& get_topologies(int num_leafs, bool parallel) {
+  return *get_topology_list(num_leafs, parallel);
+}
+
+// トポロジの数の見積もり (並列・直列それぞれ)
+size_t estimate_num_topologies(int num_leafs) {
+  if (num_leafs < 1) return 0;
+  if (num_leafs <= MAX_COMBINATION_ELEMENTS) return NUM_TOPOLOGIES[num_leafs];
+  return std::numeric_limits<size_t>::max() / 1024;
+}
+
+// トポロジを生成する場合に新たに必要なメモリの見積もり
+// (生成済みなら 0)
+size_t estimate_topology_memory(int num_leafs, bool parallel) {
+  std::lock_guard<std::recursive_mutex> lock(cache_mutex);
+  size_t size = 0;
+  for (int n = 1; n <= num_leafs; n++) {
+    for (bool p : {false, true}) {
+      if (n == num_leafs && p != parallel) continue;
+      if (cache.contains(topology_cache_key(n, p))) continue;
+      // 子ノードは平均 3 個弱
+      size += estimate_num_topologies(n) *
+              (sizeof(TopologyClass) + CONTROL_BLOCK_SIZE +
+               4 * sizeof(Topology));
+    }
+  }
+  return size;
+}
+
+// 素子数が max_num_leafs を超えるトポロジをキャッシュから解放
+// (探索中のトライ木などが参照しているものは、参照が無くなったときに
+// 解放される)
+void release_cached_topologies(int max_num_leafs) {
+  std::lock_guard<std::recursive_mutex> lock(cache_mutex);
+  for (auto it = cache.begin(); it != cache.end();) {
+    const int num_leafs = it->first % PARALLEL_OFFSET;
+    if (num_leafs > max_num_leafs) {
+      it = cache.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+// 子ノードの並びが children (キャッシュのトポロジ) であるトポロジを
+// キャッシュから探す (まだ生成していなければ生成する)
+// 正規化された並びでなければ nullptr を返す
+Topology find_cached_topology(bool parallel,
+                              const std::vector<Topology>& children) {
+  int num_leafs = 0;
+  for (const auto& child : children) {
+    num_leafs += child->num_leafs;
+  }
+  if (children.size() < 2 || MAX_COMBINATION_ELEMENTS < num_leafs) {
+    return nullptr;
+  }
+  const TopologyList list = get_topology_list(num_leafs, parallel);
+  for (const auto& topo : *list) {
+    if (topo->children == children) {
+      return topo;
+    }
+  }
+  return nullptr;
+}
+
 static void split_children_recursive(NodeDivideContext& ctx, int num_parts,
                                      int leafs_remaining) {
   if (leafs_remaining == 0) {
@@ -225,15 +330,16 @@ static void collect_children(NodeDivideContext& ctx, int num_parts) {
 }
 
 std::vector<int> get_num_topologies() {
+  std::lock_guard<std::recursive_mutex> lock(cache_mutex);
   std::vector<int> result;
   uint32_t n = 1;
   while (true) {
     int num_topos = 0;
     if (cache.contains(n)) {
-      num_topos += static_cast<int>(cache[n].size());
+      num_topos += static_cast<int>(cache[n]->size());
     }
     if (cache.contains(n | PARALLEL_OFFSET)) {
-      num_topos += static_cast<int>(cache[n | PARALLEL_OFFSET].size());
+      num_topos += static_cast<int>(cache[n | PARALLEL_OFFSET]->size());
     }
     if (num_topos == 0) {
       break;
@@ -2,16 +2,35 @@
 #define RCMB_VALUE_LIST_HPP
 
 #include "rcmb/common.hpp"
+#include "rcmb/subtree_cache.hpp"
+#include "rcmb/topology.hpp"
 
 #include <algorithm>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <vector>
 
 namespace rcmb {
+
+class PrefixEnumContextPool;
+
 class ValueList {
+ private:
+  // 値の一覧をコピーして持つ場合の領域
+  const std::vector<value_t> storage;
+
  public:
-  const std::vector<value_t> values;
+  // 昇順の値の一覧
+  const std::span<const value_t> values;
 
-  ValueList(const std::vector<value_t>& vals) : values(sort_values(vals)) {}
+  ValueList(const std::vector<value_t>& vals)
+      : storage(sort_values(vals)), values(storage) {}
+
+  // 昇順に並んだ呼び出し側の領域をコピーせずに使う
+  // (ValueList を破棄するまで領域を保持すること)
+  ValueList(const value_t* sorted_values, size_t size)
+      : values(sorted_values, size) {}
 
   inline size_t size() const { return values.size(); }
 
@@ -26,51 +45,52 @@ class ValueList {
         RCMB_DEBUG_PRINT("Duplicate element in value list: %.9f\n", v);
         return result_t::INVALID_ELEMENT_VALUE_LIST;
       }
+      if (v < prev_value) {
+        RCMB_DEBUG_PRINT("Unsorted element in value list: %.9f\n", v);
+        return result_t::INVALID_ELEMENT_VALUE_LIST;
+      }
       prev_value = v;
     }
     return result_t::SUCCESS;
   }
 
-  // todo: optimize
+  // 値域 [min, max] に含まれる値を取得 (昇順なので二分探索で求める)
   const value_t* get_values(value_t min, value_t max, int* count) const {
-    int i_start = -1;
-    for (size_t i = 0; i < values.size(); i++) {
-      if (values[i] >= min) {
-        i_start = i;
-        break;
-      }
-    }
-
-    if (i_start < 0) {
-      *count = 0;
-      return nullptr;
-    }
-
-    int i_end = i_start;
-    for (size_t i = i_start; i < values.size(); i++) {
-      if (values[i] > max) {
-        break;
-      }
-      i_end = i;
-    }
-    *count = i_end - i_start + 1;
-    return &values[i_start];
+    const auto begin = std::lower_bound(values.begin(), values.end(), min);
+    const auto end = std::upper_bound(begin, values.end(), max);
+    *count = static_cast<int>(end - begin);
+    return *count > 0 ? &*begin : nullptr;
   }
 
-  // todo: optimize
+  // target に最も近い値を取得 (誤差が等しい場合は小さい方)
   const value_t* get_nearest(value_t target, int* count) const {
-    value_t best_error = VALUE_POSITIVE_INFINITY;
-    int best_index = -1;
-    for (size_t i = 0; i < values.size(); i++) {
-      value_t error = std::abs(values[i] - target);
-      if (error < best_error) {
-        best_error = error;
-        best_index = i;
-      }
+    const auto it = std::lower_bound(values.begin(), values.end(), target);
+    size_t index = it - values.begin();
+    if (index >= values.size() ||
+        (index > 0 && target - values[index - 1] <= values[index] - target)) {
+      index--;
     }
     *count = 1;
-    return &values[best_index];
+    return &values[index];
+  }
+
+  // この値の一覧で探索する際に使い回すコンテキスト (rcmb.hpp で生成)
+  mutable std::shared_ptr<PrefixEnumContextPool> context_pool;
+  mutable std::once_flag context_pool_created;
+
+  // 値の一覧と部分木の値の集合が使用するメモリの見積もり
+  size_t memory_size() const {
+    return values.size() * sizeof(value_t) + subtree_cache.memory_size();
   }
+
+  // 部分木が取り得る値の集合を取得 (初回に生成、大きすぎる場合は nullptr)
+  const SubtreeValueSet* get_subtree_values(
+      const Topology& topo, bool inv_sum, size_t* built_size = nullptr) const {
+    return subtree_cache.get(topo, inv_sum, values, built_size);
+  }
+
+ private:
+  mutable SubtreeValueCache subtree_cache;
 };
 
 }  // namespace rcmb
@@ -39,9 +39,24 @@ export type FindDividerArgs = {
   targetMax: number,
 };
 
+// 1 つの探索を複数のワーカーで分担する場合の、受け持つ部分
+export type SearchShard = {
+  index: number,
+  count: number,
+};
+
+// 探索中のワーカーから通知される進捗
+export type SearchProgress = {
+  numTopologiesDone: number,
+  numNodesVisited: number,
+};
+
+// id はワーカーが結果と進捗に付けて返す (中止した探索の結果を見分ける)
 export type WorkerCommand = {
   method: Method,
   args: FindCombinationArgs|FindDividerArgs,
+  shard?: SearchShard,
+  id?: number,
 }
 
 export const MAX_COMBINATION_ELEMENTS = 15;
@@ -13,9 +13,68 @@ export declare interface RcmbWasm {
        topology_constraint: number, max_depth: number, total_min: number,
        total_max: number, target_value: number, target_min: number,
        target_max: number) => string;
+  // 素子の値を書き込む WASM のヒープ上の領域 (次の呼び出しまで有効)
+  getElementValueBuffer: (size: number) => Float64Array;
+  // values_ptr/num_values は getElementValueBuffer() の領域 (昇順) を指す
+  // shard_index/num_shards は分担して探索する部分 (全体なら 0/1)
+  findCombinationsBinary:
+      (capacitor: boolean, values_ptr: number, num_values: number,
+       num_elems_min: number, num_elems_max: number,
+       topology_constraint: number, max_depth: number, target_value: number,
+       target_min: number, target_max: number, shard_index: number,
+       num_shards: number) => RcmbWasmBinaryResult;
+  findDividersBinary:
+      (values_ptr: number, num_values: number, num_elems_min: number,
+       num_elems_max: number, topology_constraint: number, max_depth: number,
+       total_min: number, total_max: number, target_value: number,
+       target_min: number, target_max: number, shard_index: number,
+       num_shards: number) => RcmbWasmBinaryResult;
+  // 探索の中止フラグ (長さ 1 のビュー、0 以外を書き込むと探索を中止する)
+  // スレッド版では SharedArrayBuffer 上にあり、探索中に他のスレッドから
+  // Atomics.store で書き込める (探索を始めるときに 0 に戻る)
+  getCancelFlag: () => Int32Array;
+  // 探索中に進捗を通知する関数を設定する (false を返すと探索を中止する)
+  setProgressCallback:
+      (callback: ((numTopologiesDone: number, numNodesVisited: number) =>
+                      boolean | void)|undefined) => void;
+  // 時分割で進める組み合わせの探索を始める (前の探索は破棄する)
+  // 引数は findCombinationsBinary と同じ (値はコピーして持つ)
+  // 前回と同じ条件で目標値や許容誤差だけが変わった場合は、前の探索の
+  // 候補からその場で答える (stepSearch はすぐに true を返す)
+  startCombinationSearch:
+      (capacitor: boolean, values_ptr: number, num_values: number,
+       num_elems_min: number, num_elems_max: number,
+       topology_constraint: number, max_depth: number, target_value: number,
+       target_min: number, target_max: number, shard_index: number,
+       num_shards: number) => void;
+  // 時分割で進める分圧抵抗の探索を始める (前の探索は破棄する)
+  // 引数は findDividersBinary と同じ (値はコピーして持つ)
+  // 候補から答えられる場合は startCombinationSearch と同じ
+  startDividerSearch:
+      (values_ptr: number, num_values: number, num_elems_min: number,
+       num_elems_max: number, topology_constraint: number, max_depth: number,
+       total_min: number, total_max: number, target_value: number,
+       target_min: number, target_max: number, shard_index: number,
+       num_shards: number) => void;
+  // 探索を budget_ms [ms] 程度進め、終わったら true を返す
+  stepSearch: (budget_ms: number) => boolean;
+  // 探索の結果を返して探索を破棄する (探索中ならそれまでの最良のもの)
+  takeSearchResultsBinary: () => RcmbWasmBinaryResult;
+  // 探索を結果を取らずに破棄する
+  abortSearch: () => void;
   VectorDouble: new() => VectorDouble;
 }
 
+// バイナリ形式の探索結果
+// tags/values は WASM のヒープを指すビューで、次の呼び出しまでしか有効でない
+export declare interface RcmbWasmBinaryResult {
+  error?: string;
+  numResults?: number;
+  tags?: Uint8Array;
+  values?: Float64Array;
+  meta?: string;
+}
+
 export type RcmbWasmResultMetaInfo = {
   topologyCountList: number[]; heapSize: number;
 };
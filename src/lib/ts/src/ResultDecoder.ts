@@ -0,0 +1,81 @@
+// rcmb::BinaryWriter で書き出した探索結果を JSON 形式と同じ形のオブジェクトに
+// 展開する (形式は binary_writer.hpp を参照)
+
+export const TAG_LEAF = 0x00;
+export const TAG_PARALLEL = 0x80;
+export const TAG_NUM_CHILDREN_MASK = 0x7f;
+
+// ワーカーから UI スレッドに転送するバイナリ形式の結果
+export type BinaryResult = {
+  numResults: number,
+  tags: Uint8Array,
+  values: Float64Array,
+};
+
+class Reader {
+  iTag = 0;
+  iValue = 0;
+
+  constructor(public tags: Uint8Array, public values: Float64Array) {}
+
+  readValue(): number {
+    if (this.iValue >= this.values.length) {
+      throw new Error('Broken binary result');
+    }
+    return this.values[this.iValue++];
+  }
+
+  readCombination(): any {
+    if (this.iTag >= this.tags.length) {
+      throw new Error('Broken binary result');
+    }
+    const tag = this.tags[this.iTag++];
+    const value = this.readValue();
+    if (tag === TAG_LEAF) {
+      return value;
+    }
+    const numChildren = tag & TAG_NUM_CHILDREN_MASK;
+    const children: any[] = [];
+    for (let i = 0; i < numChildren; i++) {
+      children.push(this.readCombination());
+    }
+    return {
+      parallel: (tag & TAG_PARALLEL) !== 0,
+      value: value,
+      children: children,
+    };
+  }
+
+  readDoubleCombination(): any {
+    const ratio = this.readValue();
+    const numUppers = this.readValue();
+    const numLowers = this.readValue();
+    const uppers: any[] = [];
+    const lowers: any[] = [];
+    for (let i = 0; i < numUppers; i++) {
+      uppers.push(this.readCombination());
+    }
+    for (let i = 0; i < numLowers; i++) {
+      lowers.push(this.readCombination());
+    }
+    return {ratio: ratio, uppers: uppers, lowers: lowers};
+  }
+}
+
+export function decodeCombinations(bin: BinaryResult): any[] {
+  const reader = new Reader(bin.tags, bin.values);
+  const result: any[] = [];
+  for (let i = 0; i < bin.numResults; i++) {
+    result.push(reader.readCombination());
+  }
+  return result;
+}
+
+export function decodeDoubleCombinations(bin: BinaryResult): any[] {
+  const reader = new Reader(bin.tags, bin.values);
+  const result: any[] = [];
+  for (let i = 0; i < bin.numResults; i++) {
+    result.push(reader.readDoubleCombination());
+  }
+  return result;
+}
@@ -0,0 +1,117 @@
+// 複数のワーカーで分担して探索した結果を統合する
+// (rcmb::merge_combination_shards / merge_divider_shards と同じ処理を
+//  ResultDecoder で展開した形の結果に対して行う)
+// 展開した結果にはトポロジの生成順が無いので、同じトポロジ群の中の
+// 並び順は C++ 側の統合 (生成順に並べ直す) と異なり部分の番号順になる
+
+import {FindCombinationArgs, FindDividerArgs} from './RcmbJS';
+
+function valueOf(comb: any): number {
+  return (typeof comb === 'number') ? comb : comb.value;
+}
+
+function numLeafsOf(comb: any): number {
+  if (typeof comb === 'number') return 1;
+  let n = 0;
+  for (const child of comb.children) {
+    n += numLeafsOf(child);
+  }
+  return n;
+}
+
+// 値を有効数字 7 桁で丸めた照合用のキー (rcmb::valueKeyOf と同じ)
+function valueKeyOf(value: number): number {
+  const exp = Math.floor(Math.log10(value)) - 6;
+  const frac = Math.round(value * Math.pow(10, -exp));
+  return (exp + 128) * 0x1000000 + (frac & 0xffffff);
+}
+
+// 分割しない探索で見つかる順 (素子数、直列・並列の順) の番号
+function groupOf(comb: any): number {
+  const parallel = (typeof comb === 'number') ? false : comb.parallel;
+  return numLeafsOf(comb) * 2 + (parallel ? 1 : 0);
+}
+
+// 部分ごとの結果を見つかる順に並べる
+// (同じトポロジ群の中では部分の番号順、Array.prototype.sort は安定)
+function orderShardResults(shards: any[][], groupOfResult: (r: any) => number):
+    any[] {
+  const ordered: any[] = [];
+  for (const results of shards) {
+    ordered.push(...results);
+  }
+  return ordered
+      .map((r) => ({group: groupOfResult(r), result: r}))
+      .sort((a, b) => a.group - b.group)
+      .map((e) => e.result);
+}
+
+// 最良の組み合わせを選ぶ基準 (rcmb::BestCombinations::accept と同じ)
+class BestSelector {
+  error = Infinity;
+  numElems = Number.MAX_SAFE_INTEGER;
+  results: any[] = [];
+
+  constructor(public target: number, public eps: number) {}
+
+  accept(value: number, numElems: number): boolean {
+    const error = Math.abs(value - this.target);
+    if (error - this.eps > this.error) {
+      return false;
+    } else if (error + this.eps >= this.error) {
+      if (numElems > this.numElems) {
+        return false;
+      } else if (numElems < this.numElems) {
+        this.results = [];
+      }
+    } else {
+      this.results = [];
+    }
+    this.error = error;
+    this.numElems = numElems;
+    return true;
+  }
+}
+
+// shards は部分の番号順の、各部分の合成抵抗・合成容量の結果
+export function mergeCombinationShards(
+    args: FindCombinationArgs, shards: any[][]): any[] {
+  const best = new BestSelector(args.targetValue, args.targetValue / 1e9);
+  for (const comb of orderShardResults(shards, groupOf)) {
+    if (best.accept(valueOf(comb), numLeafsOf(comb))) {
+      best.results.push(comb);
+    }
+  }
+  return best.results;
+}
+
+// shards は部分の番号順の、各部分の分圧抵抗の結果
+// 下側の値が同じものは、先に見つかったものに下側の組み合わせを加える
+// (shards の結果のオブジェクトをそのまま書き換えて使う)
+export function mergeDividerShards(args: FindDividerArgs, shards: any[][]):
+    any[] {
+  const best = new BestSelector(args.targetValue, 1e-9);
+  const memo = new Map<number, any>();
+  const ordered =
+      orderShardResults(shards, (div: any) => groupOf(div.lowers[0]));
+  for (const div of ordered) {
+    const numLowers = numLeafsOf(div.lowers[0]);
+    const numElems = numLowers + numLeafsOf(div.uppers[0]);
+    const key = valueKeyOf(valueOf(div.lowers[0]));
+    const known = memo.get(key);
+    if (known !== undefined) {
+      const knownLowers = numLeafsOf(known.lowers[0]);
+      const knownElems = knownLowers + numLeafsOf(known.uppers[0]);
+      if (numLowers <= knownLowers && knownElems <= best.numElems) {
+        known.lowers.push(...div.lowers);
+      }
+      continue;
+    }
+    if (!best.accept(div.ratio, numElems)) {
+      continue;
+    }
+    memo.set(key, div);
+    best.results.push(div);
+  }
+  return best.results;
+}
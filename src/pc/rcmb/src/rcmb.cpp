@@ -1,19 +1,41 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <condition_variable>
+#include <csignal>
 #include <cstdio>
+#include <cstring>
+#include <deque>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <stack>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 #include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include <rcmb/rcmb.hpp>
 
+// 要求の JSON の読み取りは serve / バッチでしか使わないので、
+// ライブラリには含めずここで実装を取り込む
+#define RCMB_IMPLEMENTATION
+#include <rcmb/json_reader.hpp>
+#undef RCMB_IMPLEMENTATION
+
 using namespace rcmb;
 
 enum class output_format_t {
   TEXT,
   JSON,
+  // 結果ごとに 1 行の JSON (問い合わせを並行に処理する)
+  NDJSON,
 };
 
 static constexpr char OPT_SERIES = 's';
@@ -28,6 +50,10 @@ static constexpr char OPT_TOTAL_MIN = 0x87;
 static constexpr char OPT_TOTAL_MAX = 0x88;
 static constexpr char OPT_SERIES_MIN = 0x89;
 static constexpr char OPT_SERIES_MAX = 0x8A;
+static constexpr char OPT_THREADS = 'j';
+static constexpr char OPT_CACHE = 0x8B;
+static constexpr char OPT_SOCKET = 0x8C;
+static constexpr char OPT_INPUT = 0x8D;
 
 static struct option long_opts[] = {
     {"series", required_argument, 0, OPT_SERIES},
@@ -42,9 +68,39 @@ static struct option long_opts[] = {
     {"total-min", required_argument, 0, OPT_TOTAL_MIN},
     {"total-max", required_argument, 0, OPT_TOTAL_MAX},
     {"format", required_argument, 0, OPT_FORMAT},
+    {"threads", required_argument, 0, OPT_THREADS},
+    {"cache", required_argument, 0, OPT_CACHE},
+    {"socket", required_argument, 0, OPT_SOCKET},
+    {"input", required_argument, 0, OPT_INPUT},
     {0, 0, 0, 0},
 };
 
+// serve やバッチで扱う 1 つの問い合わせ
+// (r / c / d のコマンドライン引数に相当)
+struct Query {
+  std::string method = "r";
+  std::string series = "e3";
+  value_t target = VALUE_NONE;
+  value_t target_tol_min = -0.5;
+  value_t target_tol_max = 0.5;
+  int num_elems_min = 1;
+  int num_elems_max = 3;
+  value_t series_min = VALUE_NONE;
+  value_t series_max = VALUE_NONE;
+  value_t total_min = 10000;
+  value_t total_max = 100000;
+};
+
+static Query default_query(const std::string& method) {
+  Query q;
+  q.method = method;
+  if (method == "d") {
+    q.num_elems_min = 2;
+    q.num_elems_max = 4;
+  }
+  return q;
+}
+
 const std::vector<value_t> e1 = {100};
 const std::vector<value_t> e3 = {100, 220, 470};
 const std::vector<value_t> e6 = {100, 150, 220, 330, 470, 680};
@@ -185,7 +241,25 @@ std::map<int, std::vector<TestTopology>> topologies;
 bool test_search_combinations(ComponentType type, std::vector<value_t>& series,
                               int max_elements, value_t target);
 bool test_search_dividers(std::vector<value_t>& series, int max_elements,
-                          value_t target, bool verbose = false);
+                          value_t target, bool verbose = false,
+                          const char* expected = nullptr);
+bool test_concurrent_searchers(std::vector<value_t>& series, int max_elements,
+                               int num_threads);
+bool test_parallel_search(std::vector<value_t>& series, int max_elements,
+                          int num_threads);
+bool test_shard_search(std::vector<value_t>& series, int max_elements,
+                       int num_shards);
+bool test_search_control(std::vector<value_t>& series, int max_elements,
+                         int num_threads);
+bool test_search_task(std::vector<value_t>& series, int max_elements,
+                      int num_threads);
+bool test_candidate_cache(std::vector<value_t>& series, int max_elements);
+bool test_result_cache(std::vector<value_t>& series, int max_elements);
+bool test_json_reader();
+bool test_memory_budget(std::vector<value_t>& series, int max_elements,
+                        value_t target);
+bool test_adopted_value_list(std::vector<value_t>& series, int max_elements,
+                             value_t target);
 TestCombination test_calc_value(bool bake, ComponentType type,
                                 TestTopology& topo, const value_t* leaf_values,
                                 int pos, value_t* out_value = nullptr);
@@ -199,6 +273,22 @@ output_format_t parse_output_format(const std::string& format_str);
 int main_xcmb(ComponentType type, int argc, char** argv);
 int main_rdiv(int argc, char** argv);
 int main_alt(int argc, char** argv);
+int main_serve(int argc, char** argv);
+int main_batch(const Query& base, const std::string& target_str,
+               const std::string& input_path, int num_threads,
+               const std::string& cache_path);
+
+// serve で読み取り済みで未処理の要求の数の上限
+static constexpr size_t SERVE_QUEUE_SIZE = 1024;
+
+// バッチで一度に読み込む問い合わせのスレッドあたりの数
+static constexpr size_t BATCH_CHUNK_SIZE_PER_THREAD = 64;
+
+// serve で要求の間で共有する値の一覧の数の上限
+static constexpr size_t SERVE_VALUE_LISTS_SIZE = 64;
+
+ResultCache load_result_cache(const std::string& path);
+void save_result_cache(const ResultCache& cache, const std::string& path);
 
 std::vector<value_t> get_values_vector(
     const std::string& series,
@@ -223,6 +313,8 @@ int main(int argc, char** argv) {
     return main_xcmb(ComponentType::Capacitor, argc - 1, &argv[1]);
   } else if (method == "d") {
     return main_rdiv(argc - 1, &argv[1]);
+  } else if (method == "serve") {
+    return main_serve(argc - 1, &argv[1]);
   } else {
     printf("Unknown method: '%s'\n", method.c_str());
     return -1;
@@ -240,10 +332,14 @@ int main_xcmb(ComponentType type, int argc, char** argv) {
   value_t target_tol_max = VALUE_NONE;
   value_t series_min = VALUE_NONE;
   value_t series_max = VALUE_NONE;
+  int num_threads = 1;
+  std::string cache_path = "";
+  std::string input_path = "";
 
   char short_opts[256];
-  snprintf(short_opts, sizeof(short_opts), "%c:%c:%c:%c:%c:", OPT_SERIES,
-           OPT_TARGET, OPT_FORMAT, OPT_NUM_ELEMS_MAX, OPT_TARGET_TOL);
+  snprintf(short_opts, sizeof(short_opts), "%c:%c:%c:%c:%c:%c:", OPT_SERIES,
+           OPT_TARGET, OPT_FORMAT, OPT_NUM_ELEMS_MAX, OPT_TARGET_TOL,
+           OPT_THREADS);
 
   int opt;
   while ((opt = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
@@ -278,6 +374,15 @@ int main_xcmb(ComponentType type, int argc, char** argv) {
       case OPT_SERIES_MAX:
         series_max = parse_prefixed(optarg);
         break;
+      case OPT_THREADS:
+        num_threads = std::stoi(optarg);
+        break;
+      case OPT_CACHE:
+        cache_path = optarg;
+        break;
+      case OPT_INPUT:
+        input_path = optarg;
+        break;
       case '?':
         return 1;
     }
@@ -304,8 +409,33 @@ int main_xcmb(ComponentType type, int argc, char** argv) {
     target_tol_max = 0.5;
   }
 
+  // 入力の各行の問い合わせや、1 行ずつ書き出す場合の各目標値は、
+  // 問い合わせの間で並行に処理する
+  if (output_format == output_format_t::NDJSON || !input_path.empty()) {
+    Query base =
+        default_query(type == ComponentType::Capacitor ? "c" : "r");
+    base.series = series_str;
+    base.target_tol_min = target_tol_min;
+    base.target_tol_max = target_tol_max;
+    base.num_elems_min = num_elems_min;
+    base.num_elems_max = num_elems_max;
+    base.series_min = series_min;
+    base.series_max = series_max;
+    return main_batch(base, target_str, input_path, num_threads, cache_path);
+  }
+
+  // 2 スレッド以上なら大きな探索を分割して並行に実行する
+  Searcher searcher = create_searcher(
+      num_threads > 1 ? create_thread_pool(num_threads) : nullptr);
+
+  // 前回までの実行と同じ条件の探索は保存しておいた結果を使う
+  ResultCache result_cache = load_result_cache(cache_path);
+  searcher->set_result_cache(result_cache);
+
+  // JSON は結果ごとに文字列を作らずに標準出力に書き出す
+  JsonWriter json(stdout);
   if (output_format == output_format_t::JSON) {
-    std::printf("[\n");
+    json.put("[\n");
   }
 
   std::vector<value_t> target_values = get_values_vector(target_str);
@@ -332,7 +462,7 @@ int main_xcmb(ComponentType type, int argc, char** argv) {
     CombinationSearchArgs vsa(type, value_list, num_elems_min, num_elems_max, target,
                         target_min, target_max);
     std::vector<Combination> combs;
-    result_t res = search_combinations(vsa, combs);
+    result_t res = searcher->search_combinations(vsa, combs);
     if (res != result_t::SUCCESS) {
       std::fprintf(stderr, "*ERROR: search_combinations failed: %s\n",
                    result_to_string(res));
@@ -340,22 +470,22 @@ int main_xcmb(ComponentType type, int argc, char** argv) {
     }
 
     if (output_format == output_format_t::JSON) {
-      std::printf("  [\n");
+      json.put("  [\n");
       for (size_t i = 0; i < combs.size(); i++) {
-        const auto& comb = combs[i];
-        std::printf("    %s", comb->to_json_string().c_str());
+        json.put("    ");
+        combs[i]->write_json(json);
         if (i + 1 < combs.size()) {
-          std::printf(",\n");
+          json.put(",\n");
         } else {
-          std::printf("\n");
+          json.put('\n');
         }
       }
-      std::printf("  ]");
+      json.put("  ]");
 
       if (ti + 1 < target_values.size()) {
-        std::printf(",\n");
+        json.put(",\n");
       } else {
-        std::printf("\n");
+        json.put('\n');
       }
     } else if (output_format == output_format_t::TEXT) {
       std::printf("Target: %s\n", value_to_prefixed(target).c_str());
@@ -371,8 +501,9 @@ int main_xcmb(ComponentType type, int argc, char** argv) {
   }
 
   if (output_format == output_format_t::JSON) {
-    std::printf("]\n");
+    json.put("]\n");
   }
+  save_result_cache(result_cache, cache_path);
   return 0;
 }
 
@@ -389,11 +520,14 @@ int main_rdiv(int argc, char** argv) {
   value_t series_max = VALUE_NONE;
   value_t total_min = 10000;
   value_t total_max = 100000;
+  int num_threads = 1;
+  std::string cache_path = "";
+  std::string input_path = "";
 
   char short_opts[256];
-  snprintf(short_opts, sizeof(short_opts), "%c:%c:%c:%c:%c:%c:%c:", OPT_SERIES,
-           OPT_TARGET, OPT_FORMAT, OPT_NUM_ELEMS_MAX, OPT_TARGET_TOL,
-           OPT_TOTAL_MIN, OPT_TOTAL_MAX);
+  snprintf(short_opts, sizeof(short_opts), "%c:%c:%c:%c:%c:%c:%c:%c:",
+           OPT_SERIES, OPT_TARGET, OPT_FORMAT, OPT_NUM_ELEMS_MAX,
+           OPT_TARGET_TOL, OPT_TOTAL_MIN, OPT_TOTAL_MAX, OPT_THREADS);
 
   int opt;
   while ((opt = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
@@ -428,6 +562,15 @@ int main_rdiv(int argc, char** argv) {
       case OPT_SERIES_MAX:
         series_max = parse_prefixed(optarg);
         break;
+      case OPT_THREADS:
+        num_threads = std::stoi(optarg);
+        break;
+      case OPT_CACHE:
+        cache_path = optarg;
+        break;
+      case OPT_INPUT:
+        input_path = optarg;
+        break;
       case OPT_TOTAL_MIN:
         total_min = parse_prefixed(optarg);
         break;
@@ -460,8 +603,34 @@ int main_rdiv(int argc, char** argv) {
     target_tol_max = 0.5;
   }
 
+  // 入力の各行の問い合わせや、1 行ずつ書き出す場合の各目標値は、
+  // 問い合わせの間で並行に処理する
+  if (output_format == output_format_t::NDJSON || !input_path.empty()) {
+    Query base = default_query("d");
+    base.series = series_str;
+    base.target_tol_min = target_tol_min;
+    base.target_tol_max = target_tol_max;
+    base.num_elems_min = num_elems_min;
+    base.num_elems_max = num_elems_max;
+    base.series_min = series_min;
+    base.series_max = series_max;
+    base.total_min = total_min;
+    base.total_max = total_max;
+    return main_batch(base, target_str, input_path, num_threads, cache_path);
+  }
+
+  // 2 スレッド以上なら大きな探索を分割して並行に実行する
+  Searcher searcher = create_searcher(
+      num_threads > 1 ? create_thread_pool(num_threads) : nullptr);
+
+  // 前回までの実行と同じ条件の探索は保存しておいた結果を使う
+  ResultCache result_cache = load_result_cache(cache_path);
+  searcher->set_result_cache(result_cache);
+
+  // JSON は結果ごとに文字列を作らずに標準出力に書き出す
+  JsonWriter json(stdout);
   if (output_format == output_format_t::JSON) {
-    std::printf("[\n");
+    json.put("[\n");
   }
 
   std::vector<value_t> target_values = get_values_vector(target_str);
@@ -488,7 +657,7 @@ int main_rdiv(int argc, char** argv) {
     DividerSearchArgs dsa(value_list, num_elems_min, num_elems_max, total_min,
                           total_max, target, target_min, target_max);
     std::vector<DoubleCombination> combs;
-    result_t res = search_dividers(dsa, combs);
+    result_t res = searcher->search_dividers(dsa, combs);
     if (res != result_t::SUCCESS) {
       std::fprintf(stderr, "*ERROR: search_combinations failed: %s\n",
                    result_to_string(res));
@@ -496,22 +665,22 @@ int main_rdiv(int argc, char** argv) {
     }
 
     if (output_format == output_format_t::JSON) {
-      std::printf("  [\n");
+      json.put("  [\n");
       for (size_t i = 0; i < combs.size(); i++) {
-        const auto& comb = combs[i];
-        std::printf("    %s", comb->to_json_string().c_str());
+        json.put("    ");
+        combs[i]->write_json(json);
         if (i + 1 < combs.size()) {
-          std::printf(",\n");
+          json.put(",\n");
         } else {
-          std::printf("\n");
+          json.put('\n');
         }
       }
-      std::printf("  ]");
+      json.put("  ]");
 
       if (ti + 1 < target_values.size()) {
-        std::printf(",\n");
+        json.put(",\n");
       } else {
-        std::printf("\n");
+        json.put('\n');
       }
     } else if (output_format == output_format_t::TEXT) {
       std::printf("Target: %s\n", value_to_json_string(target).c_str());
@@ -523,11 +692,772 @@ int main_rdiv(int argc, char** argv) {
   }
 
   if (output_format == output_format_t::JSON) {
-    std::printf("]\n");
+    json.put("]\n");
+  }
+  save_result_cache(result_cache, cache_path);
+  return 0;
+}
+
+// 数値または接頭辞付きの文字列 ("4.7k" など) を読み取る
+static bool get_query_value(const JsonValue& obj, const char* key,
+                            value_t& out) {
+  const JsonValue* v = obj.find(key);
+  if (!v) return true;
+  if (v->is_number()) {
+    out = v->number;
+    return true;
+  } else if (v->is_string()) {
+    try {
+      out = parse_prefixed(v->str);
+    } catch (const std::exception&) {
+      return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+static bool get_query_int(const JsonValue& obj, const char* key, int& out) {
+  const JsonValue* v = obj.find(key);
+  if (!v) return true;
+  if (!v->is_number() || v->number != static_cast<int>(v->number)) {
+    return false;
+  }
+  out = static_cast<int>(v->number);
+  return true;
+}
+
+// JSON のオブジェクトを問い合わせにする
+// 指定の無い項目は q の値のまま (method を変える場合はその既定値) にする
+// 許容誤差は "tol" または "tolMin" と "tolMax" でパーセント単位で指定する
+bool parse_query(const JsonValue& obj, Query& q, std::string& error) {
+  if (!obj.is_object()) {
+    error = "Request must be an object.";
+    return false;
+  }
+  if (const JsonValue* v = obj.find("method")) {
+    if (!v->is_string() ||
+        (v->str != "r" && v->str != "c" && v->str != "d")) {
+      error = "Unknown method.";
+      return false;
+    }
+    if (v->str != q.method) q = default_query(v->str);
+  }
+  if (const JsonValue* v = obj.find("series")) {
+    if (!v->is_string()) {
+      error = "Invalid series.";
+      return false;
+    }
+    q.series = v->str;
+  }
+  value_t tol = VALUE_NONE;
+  value_t tol_min = VALUE_NONE;
+  value_t tol_max = VALUE_NONE;
+  if (!get_query_value(obj, "target", q.target) ||
+      !get_query_value(obj, "tol", tol) ||
+      !get_query_value(obj, "tolMin", tol_min) ||
+      !get_query_value(obj, "tolMax", tol_max) ||
+      !get_query_value(obj, "seriesMin", q.series_min) ||
+      !get_query_value(obj, "seriesMax", q.series_max) ||
+      !get_query_value(obj, "totalMin", q.total_min) ||
+      !get_query_value(obj, "totalMax", q.total_max) ||
+      !get_query_int(obj, "numElemsMin", q.num_elems_min) ||
+      !get_query_int(obj, "numElemsMax", q.num_elems_max)) {
+    error = "Invalid args.";
+    return false;
+  }
+  if (!value_is_valid(q.target)) {
+    error = "No target.";
+    return false;
+  }
+  if (value_is_valid(tol)) {
+    if (value_is_valid(tol_min) || value_is_valid(tol_max)) {
+      error = "Invalid args.";
+      return false;
+    }
+    q.target_tol_min = -tol / 100;
+    q.target_tol_max = tol / 100;
+  } else if (value_is_valid(tol_min) || value_is_valid(tol_max)) {
+    if (!value_is_valid(tol_min) || !value_is_valid(tol_max)) {
+      error = "Invalid args.";
+      return false;
+    }
+    q.target_tol_min = tol_min / 100;
+    q.target_tol_max = tol_max / 100;
+  }
+  return true;
+}
+
+// 系列と値域ごとの値の一覧
+// 同じ値の一覧の問い合わせで ValueList に残る探索木やコンテキストを
+// 使い回すため、問い合わせの間で共有する
+// 上限を超えたら最も古いものを捨てる (探索中のものは探索が終わるまで有効)
+// 複数のスレッドから使える
+class QueryValueLists {
+ public:
+  explicit QueryValueLists(size_t max_entries) : max_entries(max_entries) {}
+
+  std::shared_ptr<const ValueList> get(const std::string& series,
+                                       value_t min, value_t max) {
+    const Key key{series, min, max};
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = index.find(key);
+      if (it != index.end()) {
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+      }
+    }
+    // 値の一覧の生成は排他しない (同時に生成した場合は先に入れた方を使う)
+    auto list = std::make_shared<const ValueList>(
+        get_values_vector(series, min, max));
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it != index.end()) {
+      entries.splice(entries.begin(), entries, it->second);
+      return it->second->second;
+    }
+    entries.emplace_front(key, list);
+    index[key] = entries.begin();
+    if (entries.size() > max_entries) {
+      index.erase(entries.back().first);
+      entries.pop_back();
+    }
+    return list;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+  }
+
+ private:
+  using Key = std::tuple<std::string, value_t, value_t>;
+  using Entry = std::pair<Key, std::shared_ptr<const ValueList>>;
+
+  const size_t max_entries;
+  mutable std::mutex mutex;
+  // 先頭ほど最近使ったもの
+  std::list<Entry> entries;
+  std::map<Key, std::list<Entry>::iterator> index;
+};
+
+// 問い合わせの探索を行い、結果を "results":[...] として json に書き出す
+// value_lists を渡すと値の一覧をそこから取り出す (無ければ毎回生成する)
+result_t run_query(const Searcher& searcher, const Query& q, JsonWriter& json,
+                   QueryValueLists* value_lists = nullptr) {
+  const bool divider = (q.method == "d");
+  value_t series_min = q.series_min;
+  value_t series_max = q.series_max;
+  if (!value_is_valid(series_min)) {
+    series_min = divider ? 1e2 : q.target / 1000;
+  }
+  if (!value_is_valid(series_max)) {
+    series_max = divider ? 1e6 : q.target * 1000;
+  }
+  std::shared_ptr<const ValueList> shared_list;
+  if (value_lists) {
+    shared_list = value_lists->get(q.series, series_min, series_max);
+  } else {
+    shared_list = std::make_shared<const ValueList>(
+        get_values_vector(q.series, series_min, series_max));
+  }
+  const ValueList& value_list = *shared_list;
+  const value_t target_min = q.target * (1 + q.target_tol_min);
+  const value_t target_max = q.target * (1 + q.target_tol_max);
+
+  const auto write_results = [&](const auto& combs) {
+    json.put("\"results\":[");
+    for (size_t i = 0; i < combs.size(); i++) {
+      if (i > 0) json.put(',');
+      combs[i]->write_json(json);
+    }
+    json.put(']');
+  };
+
+  result_t res;
+  if (divider) {
+    DividerSearchArgs dsa(value_list, q.num_elems_min, q.num_elems_max,
+                          q.total_min, q.total_max, q.target, target_min,
+                          target_max);
+    std::vector<DoubleCombination> combs;
+    res = searcher->search_dividers(dsa, combs);
+    if (res == result_t::SUCCESS) write_results(combs);
+  } else {
+    auto type = (q.method == "c") ? ComponentType::Capacitor
+                                  : ComponentType::Resistor;
+    CombinationSearchArgs vsa(type, value_list, q.num_elems_min,
+                              q.num_elems_max, q.target, target_min,
+                              target_max);
+    std::vector<Combination> combs;
+    res = searcher->search_combinations(vsa, combs);
+    if (res == result_t::SUCCESS) write_results(combs);
+  }
+  return res;
+}
+
+// JSON の文字列として書き出す
+static void put_json_string(JsonWriter& json, const std::string& s) {
+  json.put('"');
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      json.put('\\');
+      json.put(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char tmp[8];
+      std::snprintf(tmp, sizeof(tmp), "\\u%04x", c);
+      json.put(tmp);
+    } else {
+      json.put(c);
+    }
+  }
+  json.put('"');
+}
+
+// 要求の "id" を "id":... として書き出す (数値と文字列以外は null)
+static void put_request_id(JsonWriter& json, const JsonValue& request) {
+  json.put("\"id\":");
+  const JsonValue* id = request.find("id");
+  if (id && id->is_number()) {
+    json.put_value(id->number);
+  } else if (id && id->is_string()) {
+    put_json_string(json, id->str);
+  } else {
+    json.put("null");
+  }
+}
+
+// 応答の書き出し先 (標準出力または 1 つの接続)
+// 複数のワーカーから 1 行ずつ書き出す
+class ServeOutput {
+ public:
+  ServeOutput(int fd, bool owned) : fd(fd), owned(owned) {}
+  ~ServeOutput() {
+    if (owned) ::close(fd);
+  }
+
+  ServeOutput(const ServeOutput&) = delete;
+  ServeOutput& operator=(const ServeOutput&) = delete;
+
+  void write_line(const std::string& line) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const char* p = line.data();
+    size_t n = line.size();
+    while (n > 0) {
+      ssize_t ret = ::write(fd, p, n);
+      if (ret < 0 && errno == EINTR) continue;
+      // 相手が切断した場合は捨てる
+      if (ret <= 0) return;
+      p += ret;
+      n -= ret;
+    }
+  }
+
+  // 読み取りを止める (読み取り中のスレッドは EOF を受け取る)
+  void shutdown_read() { ::shutdown(fd, SHUT_RD); }
+
+  const int fd;
+
+ private:
+  const bool owned;
+  std::mutex mutex;
+};
+
+struct ServeJob {
+  std::string line;
+  std::shared_ptr<ServeOutput> output;
+  std::chrono::steady_clock::time_point received;
+};
+
+// 読み取った要求をワーカーに渡すキュー
+// いっぱいの間は読み取りを待たせ、未処理の要求が際限なく増えないようにする
+class ServeQueue {
+ public:
+  ServeQueue(size_t max_jobs) : max_jobs(max_jobs) {}
+
+  bool push(ServeJob&& job) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [&] { return closed || jobs.size() < max_jobs; });
+    if (closed) return false;
+    jobs.emplace_back(std::move(job));
+    not_empty.notify_one();
+    return true;
+  }
+
+  // キューが閉じられて空になったら false
+  bool pop(ServeJob& job) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [&] { return closed || !jobs.empty(); });
+    if (jobs.empty()) return false;
+    job = std::move(jobs.front());
+    jobs.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  // 以降の push を断り、残りの要求を処理したらワーカーを終わらせる
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    not_empty.notify_all();
+    not_full.notify_all();
+  }
+
+ private:
+  const size_t max_jobs;
+  std::mutex mutex;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+  std::deque<ServeJob> jobs;
+  bool closed = false;
+};
+
+// 要求ごとの処理時間の記録
+class ServeStats {
+ public:
+  void record(double latency_ms) {
+    std::lock_guard<std::mutex> lock(mutex);
+    latencies.push_back(latency_ms);
+  }
+
+  size_t num_requests() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return latencies.size();
+  }
+
+  // 処理した要求の数と処理時間の分布を標準エラー出力に書き出す
+  void print_summary() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (latencies.empty()) return;
+    std::vector<double> sorted = latencies;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0;
+    for (double t : sorted) sum += t;
+    const auto at = [&](double p) {
+      return sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+    };
+    std::fprintf(stderr,
+                 "Served %zu requests: mean %.3f ms, p50 %.3f ms, "
+                 "p99 %.3f ms, max %.3f ms\n",
+                 sorted.size(), sum / sorted.size(), at(0.5), at(0.99),
+                 sorted.back());
+  }
+
+ private:
+  mutable std::mutex mutex;
+  std::vector<double> latencies;
+};
+
+// 1 つの要求を処理して応答を書き出す
+// 応答: {"id":..., "results":[...], "latencyMs":...}
+// 失敗した場合は "results" の代わりに "error" にエラーの内容を入れる
+static void serve_request(const Searcher& searcher, const ServeJob& job,
+                          const ResultCache& cache,
+                          QueryValueLists& value_lists, ServeStats& stats) {
+  JsonWriter json;
+  json.put('{');
+  JsonValue request;
+  std::string error;
+  if (parse_json(job.line, request) != result_t::SUCCESS) {
+    error = result_to_string(result_t::INVALID_JSON);
   }
+  put_request_id(json, request);
+  json.put(',');
+
+  const JsonValue* method = request.find("method");
+  if (error.empty() && method && method->is_string() &&
+      method->str == "stats") {
+    // 探索器の状態 (キャッシュが効いているかの確認用)
+    json.put("\"numRequests\":" + std::to_string(stats.num_requests()) +
+             ",\"numTopologies\":" + std::to_string(num_topologies.load()) +
+             ",\"numValueLists\":" + std::to_string(value_lists.size()));
+    if (cache) {
+      json.put(",\"resultCacheHits\":" + std::to_string(cache->hits()) +
+               ",\"resultCacheMisses\":" + std::to_string(cache->misses()) +
+               ",\"resultCacheEntries\":" + std::to_string(cache->size()));
+    }
+    json.put(',');
+  } else if (error.empty()) {
+    Query q;
+    if (parse_query(request, q, error)) {
+      JsonWriter results;
+      result_t res;
+      try {
+        res = run_query(searcher, q, results, &value_lists);
+      } catch (const std::exception&) {
+        res = result_t::PARAMETER_OUT_OF_RANGE;
+      }
+      if (res == result_t::SUCCESS) {
+        json.put(results.str());
+        json.put(',');
+      } else {
+        error = result_to_string(res);
+      }
+    }
+  }
+  if (!error.empty()) {
+    json.put("\"error\":");
+    put_json_string(json, error);
+    json.put(',');
+  }
+
+  const double latency_ms =
+      std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - job.received)
+          .count();
+  json.put("\"latencyMs\":");
+  json.put_value(latency_ms);
+  json.put("}\n");
+  job.output->write_line(json.str());
+  stats.record(latency_ms);
+}
+
+// input から 1 行ずつ要求を読み取ってキューに入れる (EOF まで)
+static void read_requests(FILE* input,
+                          const std::shared_ptr<ServeOutput>& output,
+                          ServeQueue& queue) {
+  char* line = nullptr;
+  size_t capacity = 0;
+  ssize_t len;
+  while ((len = ::getline(&line, &capacity, input)) >= 0) {
+    std::string_view s(line, len);
+    while (!s.empty() && (s.back() == '\n' || s.back() == '\r')) {
+      s.remove_suffix(1);
+    }
+    if (s.empty()) continue;
+    ServeJob job{std::string(s), output, std::chrono::steady_clock::now()};
+    if (!queue.push(std::move(job))) break;
+  }
+  std::free(line);
+}
+
+// Unix ドメインソケットで待ち受けている間に受け取ったシグナル
+static volatile std::sig_atomic_t serve_stop_signal = 0;
+
+static void serve_on_signal(int sig) { serve_stop_signal = sig; }
+
+// path で接続を待ち受け、接続ごとに要求を読み取る
+// SIGINT / SIGTERM を受け取ると、受け取り済みの要求を処理してから戻る
+static int serve_socket(const std::string& path, ServeQueue& queue) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::fprintf(stderr, "*ERROR: Socket path too long.\n");
+    return -1;
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  ::unlink(path.c_str());
+  if (listen_fd < 0 ||
+      ::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) <
+          0 ||
+      ::listen(listen_fd, 16) < 0) {
+    std::fprintf(stderr, "*ERROR: Failed to listen on '%s'.\n",
+                 path.c_str());
+    if (listen_fd >= 0) ::close(listen_fd);
+    return -1;
+  }
+
+  // accept() がシグナルで戻るように SA_RESTART を付けない
+  struct sigaction sa = {};
+  sa.sa_handler = serve_on_signal;
+  sigemptyset(&sa.sa_mask);
+  ::sigaction(SIGINT, &sa, nullptr);
+  ::sigaction(SIGTERM, &sa, nullptr);
+
+  // 接続ごとの読み取りスレッド (終わったものは次の接続で片付ける)
+  struct Reader {
+    std::thread thread;
+    std::weak_ptr<ServeOutput> output;
+    std::shared_ptr<std::atomic<bool>> done;
+  };
+  std::vector<Reader> readers;
+  while (!serve_stop_signal) {
+    int fd = ::accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      std::fprintf(stderr, "*ERROR: accept failed.\n");
+      break;
+    }
+    FILE* input = ::fdopen(::dup(fd), "r");
+    if (!input) {
+      ::close(fd);
+      continue;
+    }
+    auto output = std::make_shared<ServeOutput>(fd, true);
+    auto done = std::make_shared<std::atomic<bool>>(false);
+    std::erase_if(readers, [](Reader& reader) {
+      if (!*reader.done) return false;
+      reader.thread.join();
+      return true;
+    });
+    std::thread thread([input, output, done, &queue]() mutable {
+      read_requests(input, output, queue);
+      std::fclose(input);
+      output.reset();
+      *done = true;
+    });
+    readers.push_back(Reader{std::move(thread), output, done});
+  }
+  ::close(listen_fd);
+  ::unlink(path.c_str());
+
+  // 接続中の読み取りを終わらせる (応答は処理が終わるまで書き出す)
+  for (auto& reader : readers) {
+    if (auto output = reader.output.lock()) output->shutdown_read();
+    reader.thread.join();
+  }
+  return 0;
+}
+
+int main_serve(int argc, char** argv) {
+  int num_threads = default_num_threads();
+  std::string cache_path = "";
+  std::string socket_path = "";
+
+  char short_opts[256];
+  snprintf(short_opts, sizeof(short_opts), "%c:", OPT_THREADS);
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+    switch (opt) {
+      case OPT_THREADS:
+        num_threads = std::stoi(optarg);
+        break;
+      case OPT_CACHE:
+        cache_path = optarg;
+        break;
+      case OPT_SOCKET:
+        socket_path = optarg;
+        break;
+      case '?':
+        return 1;
+    }
+  }
+  if (num_threads < 1) {
+    std::fprintf(stderr, "*ERROR: Invalid args.\n");
+    return -1;
+  }
+
+  // 切断した相手への書き込みでプロセスが終わらないようにする
+  std::signal(SIGPIPE, SIG_IGN);
+
+  // 結果のキャッシュは全てのワーカーで共有する
+  ResultCache result_cache = load_result_cache(cache_path);
+  if (!result_cache) result_cache = create_result_cache();
+  // 値の一覧も全てのワーカーで共有し、要求の間で探索木を使い回す
+  QueryValueLists value_lists(SERVE_VALUE_LISTS_SIZE);
+
+  ServeQueue queue(SERVE_QUEUE_SIZE);
+  ServeStats stats;
+  std::vector<std::thread> workers;
+  for (int i = 0; i < num_threads; i++) {
+    workers.emplace_back([&] {
+      Searcher searcher = create_searcher();
+      searcher->set_result_cache(result_cache);
+      ServeJob job;
+      while (queue.pop(job)) {
+        serve_request(searcher, job, result_cache, value_lists, stats);
+        job = ServeJob();
+      }
+    });
+  }
+
+  int ret = 0;
+  if (socket_path.empty()) {
+    read_requests(stdin, std::make_shared<ServeOutput>(STDOUT_FILENO, false),
+                  queue);
+  } else {
+    ret = serve_socket(socket_path, queue);
+  }
+
+  queue.close();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  stats.print_summary();
+  save_result_cache(cache_path.empty() ? nullptr : result_cache, cache_path);
+  return ret;
+}
+
+// バッチの 1 つの問い合わせ
+// 入力の 1 行 (目標値または JSON の問い合わせ) か、-t で指定した目標値
+struct BatchItem {
+  size_t index = 0;
+  std::string text;
+  value_t target = VALUE_NONE;
+};
+
+// 問い合わせを処理して 1 行の JSON にする
+// {"index":..., ["id":...,] "target":..., "results":[...]}
+// 失敗した場合は "target" と "results" の代わりに "error" を入れる
+static std::string run_batch_item(const Searcher& searcher, const Query& base,
+                                  const BatchItem& item,
+                                  QueryValueLists& value_lists) {
+  JsonWriter json;
+  json.put("{\"index\":" + std::to_string(item.index));
+  Query q = base;
+  std::string error;
+  if (value_is_valid(item.target)) {
+    q.target = item.target;
+  } else if (!item.text.empty() && item.text[0] == '{') {
+    JsonValue request;
+    if (parse_json(item.text, request) != result_t::SUCCESS) {
+      error = result_to_string(result_t::INVALID_JSON);
+    } else {
+      if (request.find("id")) {
+        json.put(',');
+        put_request_id(json, request);
+      }
+      parse_query(request, q, error);
+    }
+  } else {
+    try {
+      q.target = parse_prefixed(item.text);
+    } catch (const std::exception&) {
+      error = "Invalid target.";
+    }
+  }
+
+  if (error.empty()) {
+    JsonWriter results;
+    result_t res;
+    try {
+      res = run_query(searcher, q, results, &value_lists);
+    } catch (const std::exception&) {
+      res = result_t::PARAMETER_OUT_OF_RANGE;
+    }
+    if (res == result_t::SUCCESS) {
+      json.put(",\"target\":");
+      json.put_value(q.target);
+      json.put(',');
+      json.put(results.str());
+    } else {
+      error = result_to_string(res);
+    }
+  }
+  if (!error.empty()) {
+    json.put(",\"error\":");
+    put_json_string(json, error);
+  }
+  json.put("}\n");
+  return json.take();
+}
+
+// 問い合わせを並行に処理し、入力の順に 1 行ずつ結果を書き出す
+// input_path の各行 ("-" なら標準入力)、または target_str の目標値を
+// base の条件で探索する
+// 一度に読み込むのは一定数の問い合わせだけで、入力が大きくても
+// メモリ使用量は増えない
+int main_batch(const Query& base, const std::string& target_str,
+               const std::string& input_path, int num_threads,
+               const std::string& cache_path) {
+  FILE* input = nullptr;
+  if (input_path == "-") {
+    input = stdin;
+  } else if (!input_path.empty()) {
+    input = std::fopen(input_path.c_str(), "r");
+    if (!input) {
+      std::fprintf(stderr, "*ERROR: Failed to open '%s'.\n",
+                   input_path.c_str());
+      return -1;
+    }
+  }
+  std::vector<value_t> targets;
+  if (!input) {
+    targets = get_values_vector(target_str);
+  }
+
+  // 問い合わせの間で並行に探索する (1 つの探索は分割しない)
+  ResultCache result_cache = load_result_cache(cache_path);
+  ThreadPool pool = create_thread_pool(std::max(1, num_threads));
+  std::vector<Searcher> searchers;
+  for (int i = 0; i < pool->size(); i++) {
+    searchers.emplace_back(create_searcher());
+    searchers.back()->set_result_cache(result_cache);
+  }
+
+  const size_t chunk_size = BATCH_CHUNK_SIZE_PER_THREAD * pool->size();
+  std::vector<BatchItem> items;
+  std::vector<std::string> outputs;
+  size_t next_index = 0;
+  char* line = nullptr;
+  size_t capacity = 0;
+  bool eof = false;
+  while (!eof) {
+    items.clear();
+    while (items.size() < chunk_size) {
+      BatchItem item;
+      if (input) {
+        ssize_t len = ::getline(&line, &capacity, input);
+        if (len < 0) {
+          eof = true;
+          break;
+        }
+        std::string_view s(line, len);
+        while (!s.empty() && std::isspace(static_cast<unsigned char>(
+                                 s.back()))) {
+          s.remove_suffix(1);
+        }
+        while (!s.empty() && std::isspace(static_cast<unsigned char>(
+                                 s.front()))) {
+          s.remove_prefix(1);
+        }
+        if (s.empty()) continue;
+        item.text = std::string(s);
+      } else if (next_index < targets.size()) {
+        item.target = targets[next_index];
+      } else {
+        eof = true;
+        break;
+      }
+      item.index = next_index++;
+      items.emplace_back(std::move(item));
+    }
+
+    // 同じ系列と値域の問い合わせはチャンクの中で値の一覧を共有する
+    // (チャンクごとに作り直すので、メモリ使用量は入力の大きさに依らない)
+    QueryValueLists value_lists(items.size());
+    outputs.resize(items.size());
+    pool->run(static_cast<int>(items.size()), [&](int i, int worker) {
+      outputs[i] =
+          run_batch_item(searchers[worker], base, items[i], value_lists);
+    });
+    for (size_t i = 0; i < items.size(); i++) {
+      std::fwrite(outputs[i].data(), 1, outputs[i].size(), stdout);
+    }
+    std::fflush(stdout);
+  }
+  std::free(line);
+  if (input && input != stdin) {
+    std::fclose(input);
+  }
+  save_result_cache(result_cache, cache_path);
   return 0;
 }
 
+// path が空なら nullptr (キャッシュを使わない)
+// ファイルがまだ無ければ空のキャッシュから始める
+ResultCache load_result_cache(const std::string& path) {
+  if (path.empty()) return nullptr;
+  ResultCache cache = create_result_cache();
+  result_t res = cache->load(path);
+  if (res == result_t::INVALID_CACHE_FILE) {
+    std::fprintf(stderr, "*WARNING: Ignored cache file '%s': %s\n",
+                 path.c_str(), result_to_string(res));
+  }
+  return cache;
+}
+
+void save_result_cache(const ResultCache& cache, const std::string& path) {
+  if (!cache) return;
+  result_t res = cache->save(path);
+  if (res != result_t::SUCCESS) {
+    std::fprintf(stderr, "*WARNING: Failed to save cache file '%s': %s\n",
+                 path.c_str(), result_to_string(res));
+  }
+}
+
 std::vector<value_t> get_values_vector(const std::string& series, value_t min,
                                        value_t max) {
   if (series == "e1") {
@@ -655,6 +1585,77 @@ int main_alt(int argc, char** argv) {
     }
   }
 
+  {
+    // 値の近い (キーが同じ) 下側が見つかる順によらず、総当たりと同じ
+    // 下側の一覧になる
+    std::vector<value_t> series = get_values_vector("e24", 1e2, 1e6);
+    const int max_elements = 5;
+    const value_t target = 0.1234;
+    const char* expected =
+        "  ratio: 0.123399999755\n"
+        "    R1:\n"
+        "      11k\n"
+        "    R2:\n"
+        "      1.54848281904k <-- ((15k//1.6k)--110)//330k\n"
+        "      1.54848269823k <-- ((43k//820)--750)//390k\n"
+        "      1.54848346316k <-- ((62k//1.5k)--120)//68k\n"
+        "      1.54848264491k <-- ((150k//1.1k)--47k)//1.6k\n"
+        "      1.54848316024k <-- ((160k//1.1k)--47k)//1.6k\n"
+        "      1.54848334555k <-- ((220k//680)--1.1k)//12k\n"
+        "      1.54848332883k <-- ((270k//43k)--11k)//1.6k\n"
+        "      1.54848277084k <-- ((680k//220)--2.2k)//4.3k\n"
+        "  ratio: 0.1234\n"
+        "    R1:\n"
+        "      13k\n"
+        "    R2:\n"
+        "      1.83002526164k <-- ((8.2k//200)--2k)//11k\n"
+        "      1.83002509697k <-- ((47k//1.2k)--750)//39k\n"
+        "  ratio: 0.12339999939\n"
+        "    R1:\n"
+        "      15k\n"
+        "    R2:\n"
+        "      2.11156740767k <-- ((110k//100k)--150)//2.2k\n"
+        "      2.11156688766k <-- ((200k//1.5k)--8.2k)//2.7k\n";
+    bool ok =
+        test_search_dividers(series, max_elements, target, false, expected);
+    if (!ok) {
+      RCMB_DEBUG_PRINT("Divider test failed: max_elements=%d, target=%.9f\n",
+                       max_elements, target);
+      return -1;
+    }
+  }
+
+  {
+    // 系列が細かくても、結果の一覧と並び順は総当たりと同じになる
+    std::vector<value_t> series = get_values_vector("e48", 1e2, 1e6);
+    const int max_elements = 4;
+    const value_t target = 0.1234;
+    const char* expected =
+        "  ratio: 0.123400000181\n"
+        "    R1:\n"
+        "      16.0544246085k <-- (316k--4.87k)//16.9k\n"
+        "    R2:\n"
+        "      2.26k\n"
+        "  ratio: 0.123399999104\n"
+        "    R1:\n"
+        "      19.262k <-- 18.7k--562\n"
+        "    R2:\n"
+        "      2.7115340866k <-- 261k//2.74k\n"
+        "  ratio: 0.1234\n"
+        "    R1:\n"
+        "      48.7k\n"
+        "    R2:\n"
+        "      6.85555555556k <-- (3.01k//1.4k)--5.9k\n"
+        "      6.85555555556k <-- (21.5k//1k)--5.9k\n";
+    bool ok =
+        test_search_dividers(series, max_elements, target, false, expected);
+    if (!ok) {
+      RCMB_DEBUG_PRINT("Divider test failed: max_elements=%d, target=%.9f\n",
+                       max_elements, target);
+      return -1;
+    }
+  }
+
   {
     int max_elements = 10;
     value_t target = 19.0 / 20.0;
@@ -666,6 +1667,112 @@ int main_alt(int argc, char** argv) {
     }
   }
 
+  {
+    const int max_elements = 5;
+    const int num_threads = 4;
+    bool ok = test_concurrent_searchers(E3, max_elements, num_threads);
+    if (!ok) {
+      RCMB_DEBUG_PRINT("Concurrent test failed: max_elements=%d\n",
+                       max_elements);
+      return -1;
+    }
+  }
+
+  {
+    const int max_elements = 6;
+    const int num_threads = 4;
+    bool ok = test_parallel_search(E3, max_elements, num_threads);
+    if (!ok) {
+      RCMB_DEBUG_PRINT("Parallel search test failed: max_elements=%d\n",
+                       max_elements);
+      return -1;
+    }
+  }
+
+  {
+    const int max_elements = 6;
+    const int num_shards = 3;
+    bool ok = test_shard_search(E3, max_elements, num_shards);
+    if (!ok) {
+      RCMB_DEBUG_PRINT("Shard search test failed: max_elements=%d\n",
+                       max_elements);
+      return -1;
+    }
+  }
+
+  {
+    const int max_elements = 7;
+    const int num_threads = 4;
+    bool ok = test_search_control(E3, max_elements, num_threads);
+    if (!ok) {
+      RCMB_DEBUG_PRINT("Search control test failed: max_elements=%d\n",
+                       max_elements);
+      return -1;
+    }
+  }
+
+  {
+    const int max_elements = 6;
+    const int num_threads = 4;
+    bool ok = test_search_task(E3, max_elements, num_threads);
+    if (!ok) {
+      RCMB_DEBUG_PRINT("Search task test failed: max_elements=%d\n",
+                       max_elements);
+      return -1;
+    }
+  }
+
+  {
+    const int max_elements = 4;
+    bool ok = test_candidate_cache(E3, max_elements);
+    if (!ok) {
+      RCMB_DEBUG_PRINT("Candidate cache test failed: max_elements=%d\n",
+                       max_elements);
+      return -1;
+    }
+  }
+
+  {
+    const int max_elements = 4;
+    bool ok = test_result_cache(E3, max_elements);
+    if (!ok) {
+      RCMB_DEBUG_PRINT("Result cache test failed: max_elements=%d\n",
+                       max_elements);
+      return -1;
+    }
+  }
+
+  {
+    bool ok = test_json_reader();
+    if (!ok) {
+      RCMB_DEBUG_PRINT("JSON reader test failed\n");
+      return -1;
+    }
+  }
+
+  {
+    std::vector<value_t> series = {1};
+    const int max_elements = 12;
+    const value_t target = 3.14;
+    bool ok = test_memory_budget(series, max_elements, target);
+    if (!ok) {
+      RCMB_DEBUG_PRINT("Memory budget test failed: max_elements=%d\n",
+                       max_elements);
+      return -1;
+    }
+  }
+
+  {
+    const int max_elements = 4;
+    const value_t target = 1234;
+    bool ok = test_adopted_value_list(E3, max_elements, target);
+    if (!ok) {
+      RCMB_DEBUG_PRINT("Adopted value list test failed: max_elements=%d\n",
+                       max_elements);
+      return -1;
+    }
+  }
+
   auto t_elapsed = std::chrono::high_resolution_clock::now() - t_start;
   auto ms =
       std::chrono::duration_cast<std::chrono::milliseconds>(t_elapsed).count();
@@ -790,8 +1897,9 @@ bool test_search_combinations(ComponentType type, std::vector<value_t>& series,
   return true;
 }
 
+// expected を指定した場合は結果の文字列表現 (rcmb d の出力と同じ) と比べる
 bool test_search_dividers(std::vector<value_t>& series, int max_elements,
-                          value_t target, bool verbose) {
+                          value_t target, bool verbose, const char* expected) {
   const value_t total_min = 10000;
   const value_t total_max = 100000;
   const value_t target_min = target * 0.5;
@@ -832,6 +1940,18 @@ bool test_search_dividers(std::vector<value_t>& series, int max_elements,
     }
   }
 
+  if (expected) {
+    std::string actual;
+    for (const auto& div : dividers) {
+      actual += div->to_string();
+    }
+    if (actual != expected) {
+      RCMB_DEBUG_PRINT("Divider test failed: target=%.9lf, expected:\n%s",
+                       target, expected);
+      success = false;
+    }
+  }
+
   if (!success || verbose) {
     auto end = std::chrono::high_resolution_clock::now();
     for (const auto& div : dividers) {
@@ -1030,7 +2150,738 @@ output_format_t parse_output_format(const std::string& format_str) {
     return output_format_t::TEXT;
   } else if (format_str == "j" || format_str == "json") {
     return output_format_t::JSON;
+  } else if (format_str == "n" || format_str == "ndjson") {
+    return output_format_t::NDJSON;
   } else {
     throw std::invalid_argument("Invalid output format: '" + format_str + "'");
   }
 }
+
+// 探索の結果 actual が参照の探索の結果 expected と同じ (並び順も含む) か確認
+// 異なる場合は what の結果が異なる旨を表示して false を返す
+template <class comb_t>
+static bool expect_same_results(const std::vector<comb_t>& actual,
+                                const std::vector<comb_t>& expected,
+                                const char* what) {
+  const auto to_strings = [](const std::vector<comb_t>& combs) {
+    std::vector<std::string> strs;
+    for (const auto& comb : combs) {
+      strs.emplace_back(comb->to_json_string());
+    }
+    return strs;
+  };
+  if (to_strings(actual) != to_strings(expected)) {
+    printf("Error: results of %s differ\n", what);
+    return false;
+  }
+  return true;
+}
+
+// 同じ値の一覧を共有する複数の探索器を並行して動かし、
+// 1 スレッドで探索した場合と同じ結果になることを確認
+bool test_concurrent_searchers(std::vector<value_t>& series, int max_elements,
+                               int num_threads) {
+  const std::vector<value_t> targets = {111, 316, 872, 2947, 31415};
+  ValueList value_list(series);
+
+  const auto search_all = [&](SearcherClass& searcher,
+                              std::vector<std::string>& out) {
+    for (const auto& target : targets) {
+      CombinationSearchArgs vsa(ComponentType::Resistor, value_list, 1,
+                                max_elements, target, target * 0.5,
+                                target * 1.5);
+      std::vector<Combination> combs;
+      if (searcher.search_combinations(vsa, combs) != result_t::SUCCESS) {
+        return false;
+      }
+      std::string json;
+      for (const auto& comb : combs) {
+        json += comb->to_json_string();
+      }
+      out.push_back(json);
+    }
+    return true;
+  };
+
+  SearcherClass expected_searcher;
+  std::vector<std::string> expected;
+  if (!search_all(expected_searcher, expected)) {
+    return false;
+  }
+
+  std::vector<std::vector<std::string>> actuals(num_threads);
+  std::vector<char> oks(num_threads, 0);
+  std::vector<SearchStatistics> stats(num_threads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([&, i] {
+      SearcherClass searcher;
+      oks[i] = search_all(searcher, actuals[i]);
+      stats[i] = searcher.statistics();
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    if (!oks[i] || actuals[i] != expected) {
+      printf("Error: results of thread %d differ\n", i);
+      return false;
+    }
+    if (stats[i].num_searches != targets.size() ||
+        stats[i].num_candidates !=
+            expected_searcher.statistics().num_candidates) {
+      printf("Error: statistics of thread %d differ\n", i);
+      return false;
+    }
+  }
+  return true;
+}
+
+// スレッドプールで分割して探索しても、分割しない場合と同じ結果・統計に
+// なることを確認
+bool test_parallel_search(std::vector<value_t>& series, int max_elements,
+                          int num_threads) {
+  const std::vector<value_t> targets = {111, 872, 2947, 31415, 123456};
+  const std::vector<value_t> ratios = {0.123, 0.5, 0.777};
+  ValueList value_list(series);
+
+  SearcherClass expected_searcher;
+  SearcherClass parallel_searcher(create_thread_pool(num_threads));
+  for (const auto& target : targets) {
+    CombinationSearchArgs vsa(ComponentType::Resistor, value_list, 1,
+                              max_elements, target, target * 0.5,
+                              target * 1.5);
+    std::vector<Combination> expected, actual;
+    if (expected_searcher.search_combinations(vsa, expected) !=
+            result_t::SUCCESS ||
+        parallel_searcher.search_combinations(vsa, actual) !=
+            result_t::SUCCESS ||
+        !expect_same_results(actual, expected, "parallel search")) {
+      return false;
+    }
+  }
+  for (const auto& ratio : ratios) {
+    DividerSearchArgs dsa(value_list, 2, max_elements, 10000, 100000, ratio,
+                          ratio * 0.9, ratio * 1.1);
+    std::vector<DoubleCombination> expected, actual;
+    if (expected_searcher.search_dividers(dsa, expected) !=
+            result_t::SUCCESS ||
+        parallel_searcher.search_dividers(dsa, actual) != result_t::SUCCESS ||
+        !expect_same_results(actual, expected, "parallel divider search")) {
+      return false;
+    }
+  }
+  const auto& expected_stats = expected_searcher.statistics();
+  const auto& actual_stats = parallel_searcher.statistics();
+  if (actual_stats.num_searches != expected_stats.num_searches ||
+      actual_stats.num_results != expected_stats.num_results) {
+    printf("Error: statistics of parallel search differ\n");
+    return false;
+  }
+  return true;
+}
+
+// 部分ごとに分けて探索した結果を統合すると、分割しない場合と同じ結果に
+// なることを確認
+bool test_shard_search(std::vector<value_t>& series, int max_elements,
+                       int num_shards) {
+  const std::vector<value_t> targets = {111, 872, 2947, 31415, 123456};
+  const std::vector<value_t> ratios = {0.123, 0.5, 0.777};
+  ValueList value_list(series);
+
+  for (const auto& target : targets) {
+    CombinationSearchArgs vsa(ComponentType::Resistor, value_list, 1,
+                              max_elements, target, target * 0.5,
+                              target * 1.5);
+    std::vector<Combination> expected;
+    if (search_combinations(vsa, expected) != result_t::SUCCESS) {
+      return false;
+    }
+
+    std::vector<std::vector<Combination>> shard_combs(num_shards);
+    for (int i = 0; i < num_shards; i++) {
+      vsa.shard.index = i;
+      vsa.shard.count = num_shards;
+      if (search_combinations(vsa, shard_combs[i]) != result_t::SUCCESS) {
+        return false;
+      }
+    }
+    std::vector<Combination> actual;
+    if (merge_combination_shards(vsa, shard_combs, actual) !=
+            result_t::SUCCESS ||
+        !expect_same_results(actual, expected, "shard search")) {
+      return false;
+    }
+  }
+
+  for (const auto& ratio : ratios) {
+    DividerSearchArgs dsa(value_list, 2, max_elements, 10000, 100000, ratio,
+                          ratio * 0.9, ratio * 1.1);
+    std::vector<DoubleCombination> expected;
+    if (search_dividers(dsa, expected) != result_t::SUCCESS) {
+      return false;
+    }
+
+    std::vector<std::vector<DoubleCombination>> shard_combs(num_shards);
+    for (int i = 0; i < num_shards; i++) {
+      dsa.shard.index = i;
+      dsa.shard.count = num_shards;
+      if (search_dividers(dsa, shard_combs[i]) != result_t::SUCCESS) {
+        return false;
+      }
+    }
+    std::vector<DoubleCombination> actual;
+    if (merge_divider_shards(dsa, shard_combs, actual) != result_t::SUCCESS ||
+        !expect_same_results(actual, expected, "shard divider search")) {
+      return false;
+    }
+  }
+
+  // 範囲外の部分は受け付けない
+  CombinationSearchArgs vsa(ComponentType::Resistor, value_list, 1,
+                            max_elements, 100, 50, 150);
+  vsa.shard.index = num_shards;
+  vsa.shard.count = num_shards;
+  std::vector<Combination> rejected;
+  if (search_combinations(vsa, rejected) != result_t::PARAMETER_OUT_OF_RANGE) {
+    printf("Error: invalid shard accepted\n");
+    return false;
+  }
+  return true;
+}
+
+// 進捗の通知と中止要求で探索が途中で止まり、次の探索には影響しないことを確認
+bool test_search_control(std::vector<value_t>& series, int max_elements,
+                         int num_threads) {
+  ValueList value_list(series);
+  CombinationSearchArgs vsa(ComponentType::Resistor, value_list, 1,
+                            max_elements, 31415, 31415 * 0.5, 31415 * 1.5);
+  DividerSearchArgs dsa(value_list, 2, max_elements - 1, 10000, 100000, 0.123,
+                        0.123 * 0.9, 0.123 * 1.1);
+
+  for (const auto& pool :
+       {ThreadPool(nullptr), create_thread_pool(num_threads)}) {
+    Searcher searcher = create_searcher(pool);
+    std::vector<Combination> expected;
+    if (searcher->search_combinations(vsa, expected) != result_t::SUCCESS) {
+      return false;
+    }
+    std::vector<DoubleCombination> expected_dividers;
+    if (searcher->search_dividers(dsa, expected_dividers) !=
+        result_t::SUCCESS) {
+      return false;
+    }
+    const SearchProgress total = searcher->progress();
+
+    // 進捗の通知で false を返すと中止する
+    int num_reports = 0;
+    SearchControl control;
+    control.progress_interval = 1024;
+    control.progress_callback = [&](const SearchProgress& progress) {
+      if (progress.num_nodes_visited == 0) return false;
+      return ++num_reports < 3;
+    };
+    searcher->set_control(control);
+    std::vector<Combination> partial;
+    if (searcher->search_combinations(vsa, partial) !=
+            result_t::SEARCH_CANCELLED ||
+        num_reports != 3 ||
+        searcher->progress().num_nodes_visited == 0) {
+      printf("Error: search not cancelled by progress callback\n");
+      return false;
+    }
+
+    // 中止フラグが立っていれば探索しない
+    std::atomic<int32_t> cancel_flag = 1;
+    control = SearchControl();
+    control.cancel_flag = &cancel_flag;
+    searcher->set_control(control);
+    std::vector<DoubleCombination> partial_dividers;
+    if (searcher->search_dividers(dsa, partial_dividers) !=
+        result_t::SEARCH_CANCELLED) {
+      printf("Error: search not cancelled by flag\n");
+      return false;
+    }
+
+    // フラグを戻すと中止前と同じ結果になる
+    cancel_flag = 0;
+    std::vector<Combination> actual;
+    if (searcher->search_combinations(vsa, actual) != result_t::SUCCESS ||
+        !expect_same_results(actual, expected, "search after cancellation")) {
+      return false;
+    }
+    std::vector<DoubleCombination> actual_dividers;
+    if (searcher->search_dividers(dsa, actual_dividers) != result_t::SUCCESS ||
+        !expect_same_results(actual_dividers, expected_dividers,
+                             "divider search after cancellation")) {
+      return false;
+    }
+    // 試すノードの数は並行に探索すると絞り込みの順で変わるので比べない
+    const SearchProgress progress = searcher->progress();
+    if (progress.num_topologies_done != total.num_topologies_done ||
+        total.num_topologies_done == 0 || progress.num_nodes_visited == 0) {
+      printf("Error: unexpected search progress\n");
+      return false;
+    }
+  }
+  return true;
+}
+
+// 少しずつ進めた探索が一度に探索した場合と同じ結果になることを確認
+bool test_search_task(std::vector<value_t>& series, int max_elements,
+                      int num_threads) {
+  const std::vector<value_t> targets = {111, 872, 2947, 31415, 123456};
+  ValueList value_list(series);
+
+  for (const auto& pool :
+       {ThreadPool(nullptr), create_thread_pool(num_threads)}) {
+    Searcher searcher = create_searcher(pool);
+    for (const auto& target : targets) {
+      CombinationSearchArgs vsa(ComponentType::Resistor, value_list, 1,
+                                max_elements, target, target * 0.5,
+                                target * 1.5);
+      std::vector<Combination> expected;
+      if (searcher->search_combinations(vsa, expected) != result_t::SUCCESS) {
+        return false;
+      }
+
+      // 時間を与えずに進めると根の子ノードごとに中断する
+      SearchTask task = create_search_task(searcher, vsa);
+      if (task->start() != result_t::SUCCESS) {
+        return false;
+      }
+      int num_steps = 1;
+      while (!task->step(0)) {
+        std::vector<Combination> partial;
+        if (task->results(partial) != result_t::SEARCH_IN_PROGRESS) {
+          printf("Error: unfinished search task reported finished\n");
+          return false;
+        }
+        num_steps++;
+      }
+      if (!pool && num_steps < 2) {
+        printf("Error: search task finished in a single step\n");
+        return false;
+      }
+      std::vector<Combination> actual;
+      if (task->results(actual) != result_t::SUCCESS ||
+          !expect_same_results(actual, expected, "search task")) {
+        return false;
+      }
+    }
+  }
+
+  // 分圧抵抗の探索も同じように少しずつ進められる
+  const std::vector<value_t> ratios = {0.1, 0.333, 0.5, 0.72};
+  Searcher searcher = create_searcher();
+  for (const auto& ratio : ratios) {
+    DividerSearchArgs dsa(value_list, 2, max_elements, 10000, 100000, ratio,
+                          ratio * 0.9, ratio * 1.1);
+    std::vector<DoubleCombination> expected;
+    if (searcher->search_dividers(dsa, expected) != result_t::SUCCESS) {
+      return false;
+    }
+
+    SearchTask task = create_search_task(searcher, dsa);
+    if (task->start() != result_t::SUCCESS || !task->is_divider()) {
+      return false;
+    }
+    int num_steps = 1;
+    while (!task->step(0)) {
+      std::vector<DoubleCombination> partial;
+      if (task->results(partial) != result_t::SEARCH_IN_PROGRESS) {
+        printf("Error: unfinished divider task reported finished\n");
+        return false;
+      }
+      num_steps++;
+    }
+    if (num_steps < 2) {
+      printf("Error: divider task finished in a single step\n");
+      return false;
+    }
+    std::vector<DoubleCombination> actual;
+    if (task->results(actual) != result_t::SUCCESS ||
+        !expect_same_results(actual, expected, "divider task")) {
+      return false;
+    }
+    std::vector<Combination> mismatched;
+    if (task->results(mismatched) == result_t::SUCCESS) {
+      printf("Error: divider task returned combinations\n");
+      return false;
+    }
+  }
+
+  // 不正な引数は始める時点で受け付けない
+  CombinationSearchArgs vsa(ComponentType::Resistor, value_list, 1,
+                            max_elements, 100, 150, 50);
+  SearchTask task = create_search_task(create_searcher(), vsa);
+  std::vector<Combination> rejected;
+  if (task->start() == result_t::SUCCESS || !task->step(1000) ||
+      task->results(rejected) == result_t::SUCCESS) {
+    printf("Error: invalid search task accepted\n");
+    return false;
+  }
+  return true;
+}
+
+// 候補のキャッシュから選び直した結果が通常の探索と同じになることを確認
+bool test_candidate_cache(std::vector<value_t>& series, int max_elements) {
+  // 探索後に候補を保持していない・列挙した・保持している候補から選んだ
+  enum class Cached { NONE, ENUMERATED, REUSED };
+  struct Query {
+    value_t target;
+    value_t tolerance;
+    Cached cached;
+  };
+  // 最初は列挙しない、狭める・ずらす・広げる・離れた値域に移る、
+  // 多すぎて列挙できない値域と、それより広い値域は列挙しない
+  const std::vector<Query> queries = {
+      {1000, 0.05, Cached::NONE},      {1000, 0.01, Cached::ENUMERATED},
+      {1002, 0.005, Cached::REUSED},   {1000, 0.02, Cached::ENUMERATED},
+      {1010, 0.02, Cached::ENUMERATED}, {47000, 0.01, Cached::ENUMERATED},
+      {47100, 0.005, Cached::REUSED},  {1000, 0.5, Cached::NONE},
+      {1000, 0.6, Cached::NONE},       {1000, 0.01, Cached::ENUMERATED},
+  };
+  ValueList value_list(series);
+  Searcher searcher = create_searcher();
+  CandidateCache cache = create_candidate_cache(searcher, 8000);
+  CandidateCache small_cache = create_candidate_cache(searcher, 10);
+
+  for (const auto& q : queries) {
+    CombinationSearchArgs vsa(ComponentType::Resistor, value_list, 1,
+                              max_elements, q.target,
+                              q.target * (1 - q.tolerance),
+                              q.target * (1 + q.tolerance));
+    std::vector<Combination> expected;
+    if (searcher->search_combinations(vsa, expected) != result_t::SUCCESS) {
+      return false;
+    }
+
+    const size_t num_cached = cache->size();
+    std::vector<Combination> actual;
+    if (cache->search_combinations(vsa, actual) != result_t::SUCCESS) {
+      return false;
+    }
+    Cached cached = Cached::NONE;
+    if (cache->size() > 0) {
+      cached = (cache->size() == num_cached) ? Cached::REUSED
+                                             : Cached::ENUMERATED;
+    }
+    if (cached != q.cached) {
+      printf("Error: unexpected candidate cache state\n");
+      return false;
+    }
+    if (!expect_same_results(actual, expected, "candidate cache")) {
+      return false;
+    }
+
+    // 候補が多すぎる場合は保持せずに通常の探索を行う
+    std::vector<Combination> fallback;
+    if (small_cache->search_combinations(vsa, fallback) !=
+            result_t::SUCCESS ||
+        small_cache->size() != 0) {
+      printf("Error: candidate cache fallback failed\n");
+      return false;
+    }
+    if (!expect_same_results(fallback, expected, "candidate cache fallback")) {
+      return false;
+    }
+  }
+
+  // 分圧抵抗も分圧比を狭める・ずらす・広げる・戻す
+  const std::vector<Query> divider_queries = {
+      {0.3, 0.05, Cached::NONE},       {0.3, 0.01, Cached::ENUMERATED},
+      {0.301, 0.005, Cached::REUSED},  {0.3, 0.02, Cached::ENUMERATED},
+      {0.32, 0.02, Cached::ENUMERATED}, {0.3, 0.01, Cached::REUSED},
+  };
+  cache->clear();
+  for (const auto& q : divider_queries) {
+    DividerSearchArgs dsa(value_list, 2, max_elements, 10000, 100000, q.target,
+                          q.target * (1 - q.tolerance),
+                          q.target * (1 + q.tolerance));
+    std::vector<DoubleCombination> expected;
+    if (searcher->search_dividers(dsa, expected) != result_t::SUCCESS) {
+      return false;
+    }
+
+    const size_t num_cached = cache->size();
+    std::vector<DoubleCombination> actual;
+    if (cache->search_dividers(dsa, actual) != result_t::SUCCESS) {
+      return false;
+    }
+    Cached cached = Cached::NONE;
+    if (cache->size() > 0) {
+      cached = (cache->size() == num_cached) ? Cached::REUSED
+                                             : Cached::ENUMERATED;
+    }
+    if (cached != q.cached) {
+      printf("Error: unexpected divider candidate cache state\n");
+      return false;
+    }
+    if (!expect_same_results(actual, expected, "divider candidate cache")) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// 結果のキャッシュから取り出した結果が探索の結果と同じになり、
+// ファイルに保存して読み込んでも同じになることを確認
+bool test_result_cache(std::vector<value_t>& series, int max_elements) {
+  const std::vector<value_t> targets = {1000, 3300, 47000};
+  ValueList value_list(series);
+  Searcher searcher = create_searcher();
+  ResultCache cache = create_result_cache(2);
+  Searcher cached = create_searcher();
+  cached->set_result_cache(cache);
+
+  const auto comb_args = [&](value_t target) {
+    return CombinationSearchArgs(ComponentType::Capacitor, value_list, 1,
+                                 max_elements, target, target * 0.95,
+                                 target * 1.05);
+  };
+  const auto div_args = [&](value_t target) {
+    return DividerSearchArgs(value_list, 2, max_elements, 10000, 100000,
+                             target, target * 0.99, target * 1.01);
+  };
+
+  std::vector<std::vector<Combination>> expected(targets.size());
+  std::vector<std::vector<DoubleCombination>> expected_dividers(
+      targets.size());
+  for (size_t i = 0; i < targets.size(); i++) {
+    auto vsa = comb_args(targets[i]);
+    if (searcher->search_combinations(vsa, expected[i]) != result_t::SUCCESS) {
+      return false;
+    }
+    auto dsa = div_args(targets[i] / 100000);
+    if (searcher->search_dividers(dsa, expected_dividers[i]) !=
+        result_t::SUCCESS) {
+      return false;
+    }
+  }
+
+  // 1 回目は探索、2 回目はキャッシュから取り出す
+  for (int pass = 0; pass < 2; pass++) {
+    const uint64_t num_hits = cache->hits();
+    auto vsa = comb_args(targets[0]);
+    std::vector<Combination> combs;
+    auto dsa = div_args(targets[0] / 100000);
+    std::vector<DoubleCombination> dividers;
+    if (cached->search_combinations(vsa, combs) != result_t::SUCCESS ||
+        cached->search_dividers(dsa, dividers) != result_t::SUCCESS ||
+        !expect_same_results(combs, expected[0], "result cache") ||
+        !expect_same_results(dividers, expected_dividers[0],
+                             "divider result cache")) {
+      return false;
+    }
+    if (cache->hits() != num_hits + (pass == 0 ? 0 : 2)) {
+      printf("Error: unexpected result cache hits\n");
+      return false;
+    }
+  }
+
+  // 最大エントリ数を超えると最も古いものから捨てる
+  for (size_t i = 1; i < targets.size(); i++) {
+    auto vsa = comb_args(targets[i]);
+    std::vector<Combination> combs;
+    if (cached->search_combinations(vsa, combs) != result_t::SUCCESS) {
+      return false;
+    }
+  }
+  if (cache->size() != 2 || cache->misses() != 4) {
+    printf("Error: unexpected result cache eviction\n");
+    return false;
+  }
+
+  // 保存して読み込んだキャッシュから同じ結果を取り出す
+  // 並行に実行したテストや前回の残りと衝突しないよう一意な名前にし、
+  // どこで戻っても削除する
+  char path_buf[] = "/tmp/rcmb_test_result_cache_XXXXXX";
+  const int fd = mkstemp(path_buf);
+  if (fd < 0) {
+    printf("Error: failed to create a temporary file\n");
+    return false;
+  }
+  close(fd);
+  struct TempFile {
+    const std::string path;
+    ~TempFile() { std::remove(path.c_str()); }
+  } temp_file{path_buf};
+  const std::string& path = temp_file.path;
+  ResultCache loaded = create_result_cache();
+  if (cache->save(path) != result_t::SUCCESS ||
+      loaded->load(path) != result_t::SUCCESS || loaded->size() != 2) {
+    printf("Error: failed to save/load result cache\n");
+    return false;
+  }
+  cached->set_result_cache(loaded);
+  for (size_t i = 1; i < targets.size(); i++) {
+    auto vsa = comb_args(targets[i]);
+    std::vector<Combination> combs;
+    if (cached->search_combinations(vsa, combs) != result_t::SUCCESS ||
+        !expect_same_results(combs, expected[i], "loaded result cache")) {
+      return false;
+    }
+    // 読み込んだ結果も探索と同じキャッシュのトポロジを使う
+    for (size_t j = 0; j < combs.size(); j++) {
+      if (combs[j]->topology != expected[i][j]->topology) {
+        printf("Error: loaded result cache has a foreign topology\n");
+        return false;
+      }
+    }
+  }
+  if (loaded->hits() != 2 || loaded->misses() != 0) {
+    printf("Error: unexpected loaded result cache hits\n");
+    return false;
+  }
+
+  // 壊れたファイルは読み込まない
+  // (先頭のエントリの大きさと、末尾のエントリの最後の値を壊す)
+  for (const long offset : {12L, -9L}) {
+    if (cache->save(path) != result_t::SUCCESS) {
+      return false;
+    }
+    FILE* fp = std::fopen(path.c_str(), "r+b");
+    if (!fp ||
+        std::fseek(fp, offset, offset < 0 ? SEEK_END : SEEK_SET) != 0 ||
+        std::fputc(0xff, fp) == EOF || std::fclose(fp) != 0) {
+      return false;
+    }
+    ResultCache broken = create_result_cache();
+    const result_t res = broken->load(path);
+    if (res != result_t::INVALID_CACHE_FILE || broken->size() != 0) {
+      printf("Error: broken result cache file accepted\n");
+      return false;
+    }
+  }
+  return true;
+}
+
+// serve の要求の形の JSON を読み取れ、壊れた JSON を読み取らないことを確認
+bool test_json_reader() {
+  JsonValue v;
+  const std::string text =
+      " {\"id\":-1.5e3, \"s\":\"a\\\"\\u00e9\\ud83d\\ude00\", "
+      "\"a\":[true,false,null,[]],\"o\":{}}\n";
+  if (parse_json(text, v) != result_t::SUCCESS || !v.is_object() ||
+      v.members.size() != 4) {
+    printf("Error: failed to parse JSON\n");
+    return false;
+  }
+  const JsonValue* id = v.find("id");
+  const JsonValue* s = v.find("s");
+  const JsonValue* a = v.find("a");
+  if (!id || !id->is_number() || id->number != -1500 || !s ||
+      s->str != "a\"\xc3\xa9\xf0\x9f\x98\x80" || !a || a->items.size() != 4 ||
+      !a->items[0].boolean || !a->items[2].is_null() ||
+      !a->items[3].is_array() || !v.find("o")->is_object() || v.find("x")) {
+    printf("Error: unexpected JSON value\n");
+    return false;
+  }
+  const std::vector<std::string> invalid = {
+      "", "{", "{\"a\":1,}", "[1 2]", "\"abc", "tru", "+1", "{} {}",
+      "{\"a\":\"\\x\"}", "{1:2}",
+  };
+  for (const auto& t : invalid) {
+    if (parse_json(t, v) != result_t::INVALID_JSON || !v.is_null()) {
+      printf("Error: invalid JSON accepted: %s\n", t.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+// メモリ予算を超える探索が途中までの結果を返し、トポロジを解放しても
+// 同じ結果が得られることを確認
+bool test_memory_budget(std::vector<value_t>& series, int max_elements,
+                        value_t target) {
+  ValueList value_list(series);
+  const auto search = [&](size_t budget, std::vector<Combination>& combs) {
+    CombinationSearchArgs vsa(ComponentType::Resistor, value_list, 1,
+                              max_elements, target, target * 0.5,
+                              target * 1.5);
+    vsa.memory_budget = budget;
+    combs.clear();
+    return search_combinations(vsa, combs);
+  };
+
+  std::vector<Combination> expected;
+  if (search(0, expected) != result_t::SUCCESS || expected.empty()) {
+    return false;
+  }
+
+  // 予算はこの探索が生成するものだけで数えるので、前の探索で生成済みの
+  // トポロジやトライ木が予算より大きくても探索できる
+  const size_t budget = 64 * 1024;
+  std::vector<Combination> reused;
+  if (get_memory_usage(value_list) <= budget) {
+    printf("Error: memory usage too small for the test\n");
+    return false;
+  }
+  if (search(budget, reused) != result_t::SUCCESS ||
+      !expect_same_results(reused, expected, "search with cached topologies")) {
+    return false;
+  }
+
+  // 大きなトポロジを解放し、それを再生成できない予算で探索
+  release_topologies(max_elements / 2);
+  std::vector<Combination> partial;
+  if (search(budget, partial) != result_t::SEARCH_SPACE_TOO_LARGE) {
+    printf("Error: memory budget not enforced\n");
+    return false;
+  }
+  for (const auto& comb : partial) {
+    if (comb->verify() != result_t::SUCCESS ||
+        comb->num_leafs() > max_elements) {
+      printf("Error: invalid partial result\n");
+      return false;
+    }
+  }
+
+  // 予算なしで再探索すると解放したトポロジを再生成して同じ結果になる
+  std::vector<Combination> actual;
+  if (search(0, actual) != result_t::SUCCESS ||
+      !expect_same_results(actual, expected,
+                           "search after releasing topologies")) {
+    return false;
+  }
+  return true;
+}
+
+bool test_adopted_value_list(std::vector<value_t>& series, int max_elements,
+                             value_t target) {
+  const auto search = [&](const ValueList& value_list,
+                          std::vector<Combination>& combs) {
+    CombinationSearchArgs vsa(ComponentType::Resistor, value_list, 1,
+                              max_elements, target, target * 0.9,
+                              target * 1.1);
+    return search_combinations(vsa, combs);
+  };
+
+  ValueList owned(series);
+  std::vector<Combination> expected;
+  if (search(owned, expected) != result_t::SUCCESS || expected.empty()) {
+    return false;
+  }
+
+  // 昇順に並べた領域をそのまま使っても同じ結果になる
+  std::vector<value_t> sorted = sort_values(series);
+  ValueList adopted(sorted.data(), sorted.size());
+  std::vector<Combination> actual;
+  if (search(adopted, actual) != result_t::SUCCESS ||
+      !expect_same_results(actual, expected, "adopted value list search")) {
+    return false;
+  }
+
+  // 昇順でない領域は受け付けない
+  std::reverse(sorted.begin(), sorted.end());
+  ValueList unsorted(sorted.data(), sorted.size());
+  std::vector<Combination> rejected;
+  if (search(unsorted, rejected) != result_t::INVALID_ELEMENT_VALUE_LIST) {
+    printf("Error: unsorted value list accepted\n");
+    return false;
+  }
+  return true;
+}
@@ -20,6 +20,7 @@ export class CombinationFinderUi extends UiPages.UiPage {
   unit: string = '';
 
   workerAgent = new WorkerAgent();
+  progressText: Text|null = null;
 
   lastResult: any = null;
 
@@ -77,6 +78,7 @@ export class CombinationFinderUi extends UiPages.UiPage {
     this.workerAgent.onLaunched = (p) => this.onLaunched(p);
     this.workerAgent.onFinished = (e) => this.onFinished(e);
     this.workerAgent.onAborted = (msg) => this.onAborted(msg);
+    this.workerAgent.onProgress = (p) => this.onProgress(p);
 
     this.conditionChanged();
   }
@@ -133,9 +135,17 @@ export class CombinationFinderUi extends UiPages.UiPage {
         RcmbUi.formatValue(args.targetValue, this.unit)}):`;
     this.statusBox.appendChild(RcmbUi.makeIcon('⌛', true));
     this.statusBox.appendChild(document.createTextNode(' ' + msg));
+    this.progressText = document.createTextNode('');
+    this.statusBox.appendChild(this.progressText);
     this.resultBox.style.opacity = '0.5';
   }
 
+  onProgress(progress: RcmbJS.SearchProgress): void {
+    if (!this.progressText) return;
+    this.progressText.data = ' ' +
+        getStr('<n> topologies searched', {n: progress.numTopologiesDone});
+  }
+
   onFinished(e: any): void {
     this.lastResult = e;
     this.showResult();
@@ -19,6 +19,7 @@ export class DividerFinderUi extends UiPages.UiPage {
   targetToleranceBox = new RcmbUi.RangeBox(false, true, -10, 10);
 
   workerAgent = new WorkerAgent();
+  progressText: Text|null = null;
 
   lastResult: any = null;
 
@@ -74,6 +75,7 @@ export class DividerFinderUi extends UiPages.UiPage {
     this.workerAgent.onLaunched = (p) => this.onLaunched(p);
     this.workerAgent.onFinished = (e) => this.onFinished(e);
     this.workerAgent.onAborted = (msg) => this.onAborted(msg);
+    this.workerAgent.onProgress = (p) => this.onProgress(p);
 
     this.conditionChanged();
   }
@@ -131,9 +133,17 @@ export class DividerFinderUi extends UiPages.UiPage {
         RcmbUi.formatValue(args.targetValue, '', false)}):`;
     this.statusBox.appendChild(RcmbUi.makeIcon('⌛', true));
     this.statusBox.appendChild(document.createTextNode(' ' + msg));
+    this.progressText = document.createTextNode('');
+    this.statusBox.appendChild(this.progressText);
     this.resultBox.style.opacity = '0.5';
   }
 
+  onProgress(progress: RcmbJS.SearchProgress): void {
+    if (!this.progressText) return;
+    this.progressText.data = ' ' +
+        getStr('<n> topologies searched', {n: progress.numTopologiesDone});
+  }
+
   onFinished(e: any): void {
     this.lastResult = e;
     this.showResult();
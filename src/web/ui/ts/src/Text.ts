@@ -18,6 +18,7 @@ const texts: {[key: string]: {[key: string]: string}} = {
     'Max Elements': '最大素子数',
     'Target Value': '目標値',
     'The search space is too large.': '探索空間が大きすぎます。',
+    'The search was cancelled.': '探索を中止しました。',
     'Upper Resistor': '上側の抵抗',
     'Lower Resistor': '下側の抵抗',
     'No combinations found': '組み合わせが見つかりませんでした',
@@ -35,6 +36,7 @@ const texts: {[key: string]: {[key: string]: string}} = {
     'Use WebAssembly': 'WebAssembly 使用',
     'Show Color Code': 'カラーコード表示',
     'Searching...': '探索しています...',
+    '<n> topologies searched': '<n> 個のトポロジーを探索済み',
     'Power Loss': '損失',
     'Current': '電流',
     'Resistor': '抵抗',
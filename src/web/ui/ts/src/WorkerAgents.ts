@@ -1,11 +1,42 @@
-import {WorkerCommand} from '../../../../lib/ts/src/RcmbJS';
+import {
+  Method,
+  SearchProgress,
+  WorkerCommand,
+} from '../../../../lib/ts/src/RcmbJS';
+import * as ResultDecoder from '../../../../lib/ts/src/ResultDecoder';
+import * as ShardMerger from '../../../../lib/ts/src/ShardMerger';
+
+// 1 つの探索を分担するワーカーの最大数
+// (ワーカーごとにトポロジのキャッシュを持つので、メモリ使用量も増える)
+const MAX_WORKERS = 4;
+
+// 探索を分担するワーカーの数
+// SharedArrayBuffer が使える場合はワーカー内のスレッドで並行に探索するので
+// ワーカーは 1 つにする
+function defaultNumWorkers(): number {
+  if ((self as any).crossOriginIsolated === true) return 1;
+  const n = navigator.hardwareConcurrency ?? 1;
+  return Math.max(1, Math.min(MAX_WORKERS, n));
+}
 
 export class WorkerAgent {
   urlPostfix = Math.floor(Date.now() / (60 * 1000)).toString();
 
-  worker: Worker|null = null;
+  numWorkers = defaultNumWorkers();
+  workers: Worker[] = [];
   workerRunning = false;
 
+  // 各ワーカーが分担した部分の結果 (全て揃ったら統合する)
+  shardResults: any[] = [];
+  shardProgress: (SearchProgress|null)[] = [];
+  numPendingShards = 0;
+
+  // 最後に送ったコマンドの id (これと異なる id の結果は中止した探索のもの)
+  commandId = 0;
+
+  // ワーカーの中止フラグ (SharedArrayBuffer が使える場合だけワーカーから届く)
+  cancelFlag: Int32Array|null = null;
+
   startRequestCommand: WorkerCommand|null = null;
   startRequestTimerId: number|null = null;
 
@@ -14,6 +45,7 @@ export class WorkerAgent {
   onLaunched: ((cmd: WorkerCommand) => void)|null = null;
   onFinished: ((e: any) => void)|null = null;
   onAborted: ((msg: string) => void)|null = null;
+  onProgress: ((progress: SearchProgress) => void)|null = null;
 
   requestStart(cmd: WorkerCommand): boolean {
     if (JSON.stringify(cmd) === JSON.stringify(this.startRequestCommand)) {
@@ -40,22 +72,39 @@ export class WorkerAgent {
   async startWorker(): Promise<void> {
     this.abortWorker();
 
-    if (this.worker === null) {
+    if (this.workers.length === 0) {
       const baseUrl =
           (window.location.hostname === 'localhost') ? '' : '/rc-combinator';
       const workerUrl = `${baseUrl}/worker/index.mjs?${this.urlPostfix}`;
-      console.log(`Launching worker: '${workerUrl}'`);
-      this.worker = new Worker(workerUrl, {type: 'module'});
+      for (let i = 0; i < this.numWorkers; i++) {
+        console.log(`Launching worker #${i}: '${workerUrl}'`);
+        const worker = new Worker(workerUrl, {type: 'module'});
+        worker.onmessage = (e) => this.onMessaged(i, e);
+        worker.onerror = (e) => this.onError(e.message);
+        worker.onmessageerror = (e) =>
+            this.onError('Message error in worker');
+        this.workers.push(worker);
+      }
+      this.cancelFlag = null;
       console.log('Worker started.');
-      this.worker.onmessage = (e) => this.onMessaged(e);
-      this.worker.onerror = (e) => this.onError(e.message);
-      this.worker.onmessageerror = (e) =>
-          this.onError('Message error in worker');
     }
 
     const cmd = this.startRequestCommand!;
     this.lastLaunchedCommand = JSON.parse(JSON.stringify(cmd));
-    this.worker.postMessage(cmd);
+    // 複数のワーカーがある場合は探索を分担させる
+    const count = this.workers.length;
+    const id = ++this.commandId;
+    this.shardResults = new Array(count).fill(null);
+    this.shardProgress = new Array(count).fill(null);
+    this.numPendingShards = count;
+    for (let i = 0; i < count; i++) {
+      if (count > 1) {
+        this.workers[i].postMessage(
+            {...cmd, id: id, shard: {index: i, count: count}});
+      } else {
+        this.workers[i].postMessage({...cmd, id: id});
+      }
+    }
     this.workerRunning = true;
 
     if (this.onLaunched) {
@@ -63,25 +112,111 @@ export class WorkerAgent {
     }
   }
 
-  abortWorker(): void {
+  // 実行中の探索を止める
+  // 中止フラグを共有できるワーカーは、終了させずに探索だけを中止して
+  // トポロジのキャッシュを残す (中止した探索の結果は id で見分けて捨てる)
+  // 組み合わせ・分圧抵抗の探索はワーカーが時分割で進めていて、次の
+  // メッセージを受け取ると探索を破棄するので、同様にワーカーを終了させない
+  // それ以外はワーカーを終了させる (次の探索で起動し直す)
+  abortWorker(terminate = false): void {
     if (!this.workerRunning) return;
-    console.log('Aborting worker...');
-    if (this.worker !== null) {
-      try {
-        this.worker!.terminate();
-      } catch (e) {
-        console.error('Failed to terminate worker:', e);
+    const method = this.lastLaunchedCommand?.method;
+    if (!terminate && this.cancelFlag && this.workers.length === 1) {
+      console.log('Cancelling search...');
+      Atomics.store(this.cancelFlag, 0, 1);
+    } else if (
+        !terminate &&
+        (method === Method.FindCombination || method === Method.FindDivider)) {
+      console.log('Cancelling search...');
+      for (const worker of this.workers) {
+        worker.postMessage({cancel: true});
+      }
+    } else {
+      console.log('Aborting worker...');
+      for (const worker of this.workers) {
+        try {
+          worker.terminate();
+        } catch (e) {
+          console.error('Failed to terminate worker:', e);
+        }
       }
-      this.worker = null;
+      this.workers = [];
+      this.cancelFlag = null;
     }
+    this.shardResults = [];
+    this.shardProgress = [];
+    this.numPendingShards = 0;
     this.workerRunning = false;
   }
 
-  onMessaged(e: MessageEvent<any>): void {
+  // バイナリ形式で転送された結果を展開する
+  decodeResult(ret: any): void {
+    if (!ret.binary) return;
+    try {
+      if (ret.command.method === Method.FindDivider) {
+        ret.result = ResultDecoder.decodeDoubleCombinations(ret.binary);
+      } else {
+        ret.result = ResultDecoder.decodeCombinations(ret.binary);
+      }
+    } catch (err: any) {
+      ret.error = (err && err.message) ? err.message : String(err);
+    }
+    delete ret.binary;
+  }
+
+  // 各ワーカーが分担した部分の結果を 1 つにまとめる
+  mergeShardResults(rets: any[]): any {
+    if (rets.length === 1) return rets[0];
+    const ret = rets[0];
+    const cmd = ret.command as WorkerCommand;
+    for (const r of rets) {
+      // メモリ予算超過などのエラーは途中までの結果と共に返す
+      if (!ret.error && r.error) ret.error = r.error;
+      ret.timeSpent = Math.max(ret.timeSpent, r.timeSpent);
+    }
+    const shards = rets.map((r) => r.result as any[]);
+    if (cmd.method === Method.FindDivider) {
+      ret.result = ShardMerger.mergeDividerShards(cmd.args as any, shards);
+    } else {
+      ret.result = ShardMerger.mergeCombinationShards(cmd.args as any, shards);
+    }
+    return ret;
+  }
+
+  // 各ワーカーの進捗を合計して通知する
+  notifyProgress(index: number, progress: SearchProgress): void {
+    this.shardProgress[index] = progress;
+    if (!this.onProgress) return;
+    const total: SearchProgress = {numTopologiesDone: 0, numNodesVisited: 0};
+    for (const p of this.shardProgress) {
+      if (!p) continue;
+      total.numTopologiesDone += p.numTopologiesDone;
+      total.numNodesVisited += p.numNodesVisited;
+    }
+    this.onProgress(total);
+  }
+
+  onMessaged(index: number, e: MessageEvent<any>): void {
+    const data = e.data;
+    if (data.cancelFlag) {
+      if (this.workers.length === 1) this.cancelFlag = data.cancelFlag;
+      return;
+    }
+    if (!this.workerRunning || data.id !== this.commandId) return;
+    if (data.progress) {
+      this.notifyProgress(index, data.progress);
+      return;
+    }
+    if (this.shardResults[index] !== null) return;
+    const shardRet = data;
+    shardRet.command = this.lastLaunchedCommand;
+    this.decodeResult(shardRet);
+    this.shardResults[index] = shardRet;
+    if (--this.numPendingShards > 0) return;
+
     this.workerRunning = false;
     if (this.onFinished) {
-      let ret = e.data;
-      ret.command = this.lastLaunchedCommand;
+      const ret = this.mergeShardResults(this.shardResults);
       if (ret.meta) {
         const meta = ret.meta;
         // if (meta.topologyCountList) {
@@ -118,7 +253,7 @@ export class WorkerAgent {
   }
 
   onError(msg: string): void {
-    this.abortWorker();
+    this.abortWorker(true);
     if (this.onAborted) {
       this.onAborted(msg);
     }
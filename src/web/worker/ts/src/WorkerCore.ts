@@ -1,62 +1,242 @@
 import createRcmbWasm from '../../wasm/build/rcmb_wasm';
 import * as RcmbJS from '../../../../lib/ts/src/RcmbJS';
 import * as RcmbWasm from '../../../../lib/ts/src/RcmbWasm';
+import * as ResultDecoder from '../../../../lib/ts/src/ResultDecoder';
 
 let wasmCore: RcmbWasm.RcmbWasm|null = null;
+let wasmCoreLoading: Promise<RcmbWasm.RcmbWasm>|null = null;
+
+// 実行中の探索のコマンドの id (進捗に付けて返す)
+let currentCommandId: number|undefined = undefined;
+
+// 受け取ったメッセージの数 (時分割の探索が新しい要求に気付くのに使う)
+let numMessages = 0;
+
+// 時分割で探索を進める 1 回あたりの時間 [ms]
+const SEARCH_STEP_MS = 20;
+
+// 進捗を UI スレッドに通知する最短の間隔 [ms]
+const PROGRESS_INTERVAL_MS = 100;
+let lastProgressTime = 0;
 
 declare interface DedicatedWorkerGlobalScope {
   onmessage: (e: MessageEvent<any>) => Promise<any>;
-  postMessage: (message: any) => void;
+  postMessage: (message: any, transfer?: Transferable[]) => void;
 }
 
 const thisWorker = self as DedicatedWorkerGlobalScope;
 
+// バイナリ形式の結果を UI スレッドに渡す形にする
+// WASM のヒープを指すビューは次の探索で無効になり、ヒープ全体は転送
+// できないので、結果の部分だけを転送用の領域にコピーする
+function fromBinaryResult(bin: RcmbWasm.RcmbWasmBinaryResult): any {
+  let binary: ResultDecoder.BinaryResult|null = null;
+  if (bin.numResults !== undefined) {
+    binary = {
+      numResults: bin.numResults,
+      tags: bin.tags!.slice(),
+      values: bin.values!.slice(),
+    };
+  }
+  return {
+    error: bin.error ?? '',
+    result: [],
+    binary: binary,
+    meta: bin.meta ? JSON.parse(bin.meta) : undefined,
+    timeSpent: 0,
+  };
+}
+
+// 素子の値を WASM のヒープに直接書き込んで昇順に並べる
+// (境界を越える呼び出しは値の個数によらず 1 回で済む)
+function writeElementValues(values: number[]): Float64Array {
+  const buffer = wasmCore!.getElementValueBuffer(values.length);
+  buffer.set(values);
+  buffer.sort();
+  return buffer;
+}
+
+// WebAssembly SIMD に対応しているか
+// (v128 の命令を含む最小のモジュールを検証できるかで判定)
+function wasmSimdSupported(): boolean {
+  try {
+    return WebAssembly.validate(new Uint8Array([
+      0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0, 10, 10,
+      1, 8, 0, 65, 0, 253, 15, 253, 98, 11,
+    ]));
+  } catch (_) {
+    return false;
+  }
+}
+
+// ワーカーと同じ場所に置いた WASM モジュールを読み込む
+// (バンドルしないので、パスはリテラルにせず実行時に解決する)
+async function importWasmCore(name: string): Promise<RcmbWasm.RcmbWasm> {
+  const url = new URL(`${name}.mjs`, import.meta.url).href;
+  const mod = await import(url);
+  return (await mod.default()) as RcmbWasm.RcmbWasm;
+}
+
+// WASM モジュールを読み込む
+// 環境に応じて pthread 版 (SharedArrayBuffer と SIMD が必要)、SIMD 版、
+// スカラー版の順に試し、読み込めたものを使う
+async function loadWasmCore(): Promise<RcmbWasm.RcmbWasm> {
+  const simd = wasmSimdSupported();
+  const isolated = (self as any).crossOriginIsolated === true &&
+      typeof SharedArrayBuffer !== 'undefined';
+  const candidates: string[] = [];
+  if (simd && isolated) candidates.push('rcmb_wasm_mt');
+  if (simd) candidates.push('rcmb_wasm_simd');
+  for (const name of candidates) {
+    try {
+      console.log(`Loading WASM module (${name})...`);
+      return await importWasmCore(name);
+    } catch (err) {
+      console.warn(`Failed to load WASM module (${name}):`, err);
+    }
+  }
+  console.log('Loading WASM module...');
+  return (await createRcmbWasm()) as RcmbWasm.RcmbWasm;
+}
+
+// 探索中の進捗を UI スレッドに通知する
+function onProgress(numTopologiesDone: number, numNodesVisited: number):
+    boolean {
+  const now = performance.now();
+  if (now - lastProgressTime >= PROGRESS_INTERVAL_MS) {
+    lastProgressTime = now;
+    const progress: RcmbJS.SearchProgress = {
+      numTopologiesDone: numTopologiesDone,
+      numNodesVisited: numNodesVisited,
+    };
+    thisWorker.postMessage({id: currentCommandId, progress: progress});
+  }
+  return true;
+}
+
+// WASM モジュールを一度だけ読み込み、進捗の通知先を設定する
+// 中止フラグが SharedArrayBuffer 上にあれば UI スレッドに渡し、
+// ワーカーを終了させずに探索を中止できるようにする
+// (読み込み中に次のコマンドが届いても読み込みは 1 回だけ行う)
+async function getWasmCore(): Promise<RcmbWasm.RcmbWasm> {
+  if (wasmCore) return wasmCore;
+  if (!wasmCoreLoading) {
+    wasmCoreLoading = loadWasmCore().then((core) => {
+      core.setProgressCallback(onProgress);
+      const cancelFlag = core.getCancelFlag();
+      if (typeof SharedArrayBuffer !== 'undefined' &&
+          cancelFlag.buffer instanceof SharedArrayBuffer) {
+        thisWorker.postMessage({cancelFlag: cancelFlag});
+      }
+      console.log('WASM module loaded.');
+      wasmCore = core;
+      return core;
+    }, (err) => {
+      // 次のコマンドで読み込みをやり直す
+      wasmCoreLoading = null;
+      throw err;
+    });
+  }
+  return await wasmCoreLoading;
+}
+
+// 他のメッセージを処理させるために一度イベントループに戻る
+// (setTimeout は入れ子になると最短の間隔が延びるので MessageChannel を使う)
+const yieldChannel = new MessageChannel();
+function yieldToEventLoop(): Promise<void> {
+  return new Promise((resolve) => {
+    yieldChannel.port1.onmessage = () => resolve();
+    yieldChannel.port2.postMessage(null);
+  });
+}
+
+// 組み合わせの探索を時分割で進める
+// seq はこの探索を要求したメッセージの番号
+// 探索の合間に次のメッセージが届いたら、その処理に任せて null を返す
+// (次の探索が始まっているかもしれないので WASM 側には触らない)
+async function findCombinationsSliced(
+    seq: number, args: RcmbJS.FindCombinationArgs, values: Float64Array,
+    shard: RcmbJS.SearchShard): Promise<RcmbWasm.RcmbWasmBinaryResult|null> {
+  const core = wasmCore!;
+  core.startCombinationSearch(
+      args.capacitor, values.byteOffset, values.length, args.numElemsMin,
+      args.numElemsMax, args.topologyConstraint, args.maxDepth,
+      args.targetValue, args.targetMin, args.targetMax, shard.index,
+      shard.count);
+  return await runSearchSliced(seq);
+}
+
+// 分圧抵抗の探索を時分割で進める (findCombinationsSliced と同じ)
+async function findDividersSliced(
+    seq: number, args: RcmbJS.FindDividerArgs, values: Float64Array,
+    shard: RcmbJS.SearchShard): Promise<RcmbWasm.RcmbWasmBinaryResult|null> {
+  const core = wasmCore!;
+  core.startDividerSearch(
+      values.byteOffset, values.length, args.numElemsMin, args.numElemsMax,
+      args.topologyConstraint, args.maxDepth, args.totalMin, args.totalMax,
+      args.targetValue, args.targetMin, args.targetMax, shard.index,
+      shard.count);
+  return await runSearchSliced(seq);
+}
+
+// 始めた探索を終わるまで進めて結果を返す
+// 合間に次のメッセージ (seq 番目より後) が届いたら null を返す
+async function runSearchSliced(seq: number):
+    Promise<RcmbWasm.RcmbWasmBinaryResult|null> {
+  const core = wasmCore!;
+  while (!core.stepSearch(SEARCH_STEP_MS)) {
+    await yieldToEventLoop();
+    if (seq !== numMessages) return null;
+  }
+  return core.takeSearchResultsBinary();
+}
+
 // onmessage
 thisWorker.onmessage = async (e: MessageEvent<any>) => {
-  let ret = {
+  let ret: any = {
     error: '',
     result: [],
     timeSpent: 0,
   };
 
+  const cmd = e.data;
+  // このメッセージの番号 (後から届いたメッセージに置き換えられたかの確認用)
+  const seq = ++numMessages;
+  // 時分割で進めていた前の探索は破棄する
+  if (wasmCore) wasmCore.abortSearch();
+  // 中止の要求には応答しない
+  if (cmd.cancel) return;
+
   try {
-    const cmd = e.data;
     const method = cmd.method as RcmbJS.Method;
+    const shard = (cmd.shard ?? {index: 0, count: 1}) as RcmbJS.SearchShard;
 
-    if (!wasmCore) {
-      console.log('Loading WASM module...');
-      wasmCore = (await createRcmbWasm()) as RcmbWasm.RcmbWasm;
-      console.log('WASM module loaded.');
-    }
+    await getWasmCore();
+    // 読み込みを待つ間に次の要求が届いていたら、そちらに任せる
+    // (読み込み中は前の探索を abortSearch() で破棄できていないため、
+    // ここで探索を始めると次の要求の探索と取り違える)
+    if (seq !== numMessages) return;
+    currentCommandId = cmd.id;
+    lastProgressTime = performance.now();
 
     const start = performance.now();
     switch (method) {
       case RcmbJS.Method.FindCombination: {
         const args = cmd.args as RcmbJS.FindCombinationArgs;
-        const elementValues = new wasmCore!.VectorDouble();
-        for (const v of args.elementValues) {
-          elementValues.push_back(v);
-        }
-        const retStr = wasmCore!.findCombinations(
-            args.capacitor, elementValues, args.numElemsMin, args.numElemsMax,
-            args.topologyConstraint, args.maxDepth, args.targetValue,
-            args.targetMin, args.targetMax);
-        elementValues.delete();
-        ret = JSON.parse(retStr);
+        const values = writeElementValues(args.elementValues);
+        const bin = await findCombinationsSliced(seq, args, values, shard);
+        // 次の要求に置き換えられた探索の結果は返さない
+        if (!bin) return;
+        ret = fromBinaryResult(bin);
       } break;
 
       case RcmbJS.Method.FindDivider: {
         const args = cmd.args as RcmbJS.FindDividerArgs;
-        const elementValues = new wasmCore!.VectorDouble();
-        for (const v of args.elementValues) {
-          elementValues.push_back(v);
-        }
-        const retStr = wasmCore!.findDividers(
-            elementValues, args.numElemsMin, args.numElemsMax,
-            args.topologyConstraint, args.maxDepth, args.totalMin,
-            args.totalMax, args.targetValue, args.targetMin, args.targetMax);
-        elementValues.delete();
-        ret = JSON.parse(retStr);
+        const values = writeElementValues(args.elementValues);
+        const bin = await findDividersSliced(seq, args, values, shard);
+        // 次の要求に置き換えられた探索の結果は返さない
+        if (!bin) return;
+        ret = fromBinaryResult(bin);
       } break;
 
       default:
@@ -69,6 +249,13 @@ thisWorker.onmessage = async (e: MessageEvent<any>) => {
   } catch (err: any) {
     ret.error = (err && err.message) ? err.message : String(err);
   }
+  ret.id = cmd.id;
 
-  thisWorker.postMessage(ret);
+  // 結果はコピーせずに UI スレッドに転送する
+  const binary = ret.binary as ResultDecoder.BinaryResult|null;
+  if (binary) {
+    thisWorker.postMessage(ret, [binary.tags.buffer, binary.values.buffer]);
+  } else {
+    thisWorker.postMessage(ret);
+  }
 };
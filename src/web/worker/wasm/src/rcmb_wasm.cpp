@@ -1,7 +1,13 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <emscripten/bind.h>
 #include <emscripten/heap.h>
+#include <emscripten/val.h>
 
 #include "rcmb/rcmb.hpp"
 
@@ -13,63 +19,262 @@
 
 using namespace rcmb;
 
-std::string get_meta_info_json() {
-  std::string json_str;
+// 同じ条件の探索に前の結果をそのまま返すキャッシュ
+static ResultCache result_cache = create_result_cache();
+
+static Searcher with_result_cache(Searcher searcher) {
+  searcher->set_result_cache(result_cache);
+  return searcher;
+}
+
+#ifdef RCMB_WASM_THREADS
+// スレッド数の上限 (Makefile の PTHREAD_POOL_SIZE と合わせる)
+static constexpr int MAX_THREADS = 8;
+
+// 大きな探索を分割して実行するスレッドプール
+// (スレッドは起動時に作られたものを使い、探索中は新たに作らない)
+static ThreadPool thread_pool =
+    create_thread_pool(std::min(default_num_threads(), MAX_THREADS));
+
+// このワーカーで行う探索の探索器
+static Searcher searcher =
+    with_result_cache(create_searcher(thread_pool));
+#else
+// このワーカーで行う探索の探索器
+static Searcher searcher = with_result_cache(create_searcher());
+#endif
+
+// 目標値や許容誤差だけを変えた探索に、前の探索の候補から答えるキャッシュ
+static CandidateCache candidate_cache = create_candidate_cache(searcher);
+
+// 探索 1 回あたりのメモリ使用量の上限 (キャッシュを含む)
+// wasm32 のヒープの上限 (既定で 2GB) に達してタブが落ちるのを避ける
+static constexpr size_t MEMORY_BUDGET = 1024 * 1024 * 1024;
+
+// キャッシュに残すトポロジの最大素子数 (これを超えるものは探索後に解放)
+static constexpr int MAX_CACHED_NUM_LEAFS = 12;
+
+// バイナリ形式の結果 (JS 側のビューが指すので次の探索まで保持する)
+static BinaryWriter binary_result;
+
+// JS 側が素子の値を直接書き込む領域
+static std::vector<value_t> element_value_buffer;
+
+// 0 以外にすると実行中の探索を中止する (探索を始めるときに 0 に戻す)
+// スレッド版ではヒープが SharedArrayBuffer なので、探索中のワーカーに
+// メインスレッドから Atomics.store で書き込める
+static std::atomic<int32_t> cancel_flag = 0;
+
+// 探索中に進捗を通知する JS の関数 (false を返すと探索を中止する)
+static emscripten::val progress_callback = emscripten::val::undefined();
+
+void write_meta_info_json(JsonWriter& json, const ValueList& value_list) {
   std::vector<int> topos_count = get_num_topologies();
-  json_str += "{";
-  json_str += "\"topologyCountList\":[";
+  json.put("{\"topologyCountList\":[");
   for (size_t i = 0; i < topos_count.size(); i++) {
     if (i > 0) {
-      json_str += ",";
+      json.put(',');
+    }
+    json.put(std::to_string(topos_count[i]));
+  }
+  json.put("],");
+  json.put("\"numTopologies\":" + std::to_string(num_topologies.load()) + ",");
+  json.put("\"numCombinations\":" + std::to_string(num_combinations.load()) +
+           ",");
+  json.put("\"numSearchStates\":" + std::to_string(num_search_states.load()) +
+           ",");
+  const auto& stats = searcher->statistics();
+  json.put("\"numSearches\":" + std::to_string(stats.num_searches) + ",");
+  json.put("\"numCandidates\":" + std::to_string(stats.num_candidates) + ",");
+  json.put("\"numCachedCandidates\":" +
+           std::to_string(candidate_cache->size()) + ",");
+  json.put("\"resultCacheHits\":" + std::to_string(result_cache->hits()) +
+           ",");
+  json.put("\"resultCacheMisses\":" +
+           std::to_string(result_cache->misses()) + ",");
+  json.put("\"resultCacheEntries\":" + std::to_string(result_cache->size()) +
+           ",");
+#ifdef RCMB_WASM_THREADS
+  json.put("\"numThreads\":" + std::to_string(thread_pool->size()) + ",");
+#endif
+  json.put("\"memoryUsage\":" + std::to_string(get_memory_usage(value_list)) +
+           ",");
+  json.put("\"heapSize\":" + std::to_string(emscripten_get_heap_size()));
+  json.put('}');
+}
+
+// 探索の結果をエラーとメタ情報付きの JSON にする
+// (結果ごとの文字列は作らずに 1 つのバッファに書き出す)
+template <class list_t>
+static std::string to_result_json(result_t ret, const list_t& combinations,
+                                  const ValueList& value_list) {
+  JsonWriter json;
+  json.put('{');
+  if (ret != result_t::SUCCESS) {
+    json.put("\"error\":\"");
+    json.put(result_to_string(ret));
+    json.put("\",");
+  }
+  json.put("\"result\":[");
+  for (size_t i = 0; i < combinations.size(); i++) {
+    if (i > 0) {
+      json.put(',');
     }
-    json_str += std::to_string(topos_count[i]);
+    combinations[i]->write_json(json);
   }
-  json_str += "],";
-  json_str += "\"numTopologies\":" + std::to_string(num_topologies) + ",";
-  json_str += "\"numCombinations\":" + std::to_string(num_combinations) + ",";
-  json_str += "\"numSearchStates\":" + std::to_string(num_search_states) + ",";
-  json_str += "\"heapSize\":" + std::to_string(emscripten_get_heap_size());
-  json_str += "}";
-  return json_str;
+  json.put("],\"meta\":");
+  write_meta_info_json(json, value_list);
+  json.put('}');
+  return json.take();
 }
 
-std::string findCombinations(bool capacitor,
-                             const std::vector<double>& element_values,
-                             int num_elems_min, int num_elems_max,
-                             int topology_constraint, int max_depth,
-                             double target_value, double target_min,
-                             double target_max) {
-  auto type = capacitor ? ComponentType::Capacitor : ComponentType::Resistor;
+// 探索を始める前に中止フラグを戻し、探索器に中止と進捗の通知を設定
+static void begin_search() {
+  cancel_flag = 0;
+  SearchControl control;
+  control.cancel_flag = &cancel_flag;
+  if (!progress_callback.isUndefined()) {
+    control.progress_callback = [](const SearchProgress& progress) {
+      const emscripten::val ret = progress_callback(
+          static_cast<double>(progress.num_topologies_done),
+          static_cast<double>(progress.num_nodes_visited));
+      return !ret.isFalse();
+    };
+  }
+  searcher->set_control(control);
+}
+
+// 途中までの結果をエラーと共に返すエラーか
+static bool is_partial_result(result_t ret) {
+  return ret == result_t::SEARCH_SPACE_TOO_LARGE ||
+         ret == result_t::SEARCH_CANCELLED;
+}
+
+static ValueList to_value_list(const std::vector<double>& element_values) {
   std::vector<value_t> val_vec;
   for (const auto& v : element_values) {
     val_vec.push_back(static_cast<value_t>(v));
   }
-  ValueList value_list(val_vec);
+  return ValueList(val_vec);
+}
+
+// 素子の値を書き込む領域を確保し、WASM のヒープを直接指すビューを返す
+// (JS 側で昇順に並べてから byteOffset と長さを探索関数に渡す)
+emscripten::val getElementValueBuffer(int size) {
+  element_value_buffer.resize(size);
+  return emscripten::val(emscripten::typed_memory_view(
+      element_value_buffer.size(), element_value_buffer.data()));
+}
+
+// 中止フラグを直接指す長さ 1 の Int32Array を返す
+emscripten::val getCancelFlag() {
+  return emscripten::val(emscripten::typed_memory_view(
+      1, reinterpret_cast<int32_t*>(&cancel_flag)));
+}
+
+// 進捗を通知する関数 (探索済みのトポロジ数, 試したノード数) を設定する
+// (undefined で通知しない)
+void setProgressCallback(emscripten::val callback) {
+  progress_callback = callback;
+}
+
+// JS 側が書き込んだ昇順の値の領域をコピーせずに使う
+static ValueList adopt_value_list(uintptr_t values_ptr, int num_values) {
+  return ValueList(reinterpret_cast<const value_t*>(values_ptr),
+                   static_cast<size_t>(num_values));
+}
 
+static result_t search_combinations(bool capacitor,
+                                    const ValueList& value_list,
+                                    int num_elems_min, int num_elems_max,
+                                    int topology_constraint, int max_depth,
+                                    double target_value, double target_min,
+                                    double target_max,
+                                    const SearchShard& shard,
+                                    std::vector<Combination>& combinations) {
+  auto type = capacitor ? ComponentType::Capacitor : ComponentType::Resistor;
   CombinationSearchArgs args(type, value_list, num_elems_min, num_elems_max,
-                       target_value, target_min, target_max);
+                             target_value, target_min, target_max);
   args.topology_constraint =
       static_cast<topology_constraint_t>(topology_constraint);
   args.max_depth = max_depth;
+  args.memory_budget = MEMORY_BUDGET;
+  args.shard = shard;
+  begin_search();
+  return candidate_cache->search_combinations(args, combinations);
+}
 
-  std::vector<Combination> combinations;
-  auto ret = rcmb::search_combinations(args, combinations);
+static result_t search_dividers(const ValueList& value_list, int num_elems_min,
+                                int num_elems_max, int topology_constraint,
+                                int max_depth, double total_min,
+                                double total_max, double target_value,
+                                double target_min, double target_max,
+                                const SearchShard& shard,
+                                std::vector<DoubleCombination>& combinations) {
+  DividerSearchArgs args(value_list, num_elems_min, num_elems_max, total_min,
+                         total_max, target_value, target_min, target_max);
+  args.topology_constraint =
+      static_cast<topology_constraint_t>(topology_constraint);
+  args.max_depth = max_depth;
+  args.memory_budget = MEMORY_BUDGET;
+  args.shard = shard;
+  begin_search();
+  return candidate_cache->search_dividers(args, combinations);
+}
+
+// 探索の結果をバイナリ形式で書き出し、WASM のヒープを直接指す
+// ビューとメタ情報を返す (ビューは次の探索まで有効)
+template <class list_t>
+static emscripten::val to_result_binary(result_t ret,
+                                        const list_t& combinations,
+                                        const ValueList& value_list) {
+  binary_result.clear();
+  for (const auto& comb : combinations) {
+    comb->write_binary(binary_result);
+  }
+
+  JsonWriter meta;
+  write_meta_info_json(meta, value_list);
+
+  emscripten::val obj = emscripten::val::object();
   if (ret != result_t::SUCCESS) {
-    return std::string("{\"error\":\"") + result_to_string(ret) + "\"}";
+    obj.set("error", std::string(result_to_string(ret)));
   }
+  obj.set("numResults", static_cast<double>(combinations.size()));
+  obj.set("tags", emscripten::val(emscripten::typed_memory_view(
+                      binary_result.tags.size(), binary_result.tags.data())));
+  obj.set("values",
+          emscripten::val(emscripten::typed_memory_view(
+              binary_result.values.size(), binary_result.values.data())));
+  obj.set("meta", meta.take());
+  return obj;
+}
 
-  std::string result = "{\"result\":[";
-  for (size_t i = 0; i < combinations.size(); i++) {
-    const auto& comb = combinations[i];
-    if (i > 0) {
-      result += ",";
-    }
-    result += comb->to_json_string();
+static emscripten::val to_error_binary(result_t ret) {
+  emscripten::val obj = emscripten::val::object();
+  obj.set("error", std::string(result_to_string(ret)));
+  return obj;
+}
+
+std::string findCombinations(bool capacitor,
+                             const std::vector<double>& element_values,
+                             int num_elems_min, int num_elems_max,
+                             int topology_constraint, int max_depth,
+                             double target_value, double target_min,
+                             double target_max) {
+  ValueList value_list = to_value_list(element_values);
+  std::vector<Combination> combinations;
+  auto ret = search_combinations(capacitor, value_list, num_elems_min,
+                                 num_elems_max, topology_constraint, max_depth,
+                                 target_value, target_min, target_max,
+                                 SearchShard(), combinations);
+  if (ret != result_t::SUCCESS && !is_partial_result(ret)) {
+    return std::string("{\"error\":\"") + result_to_string(ret) + "\"}";
   }
-  result += "],";
-  result += "\"meta\":" + get_meta_info_json();
-  result += "}";
 
+  // 予算を超えたか中止した場合は途中までの結果をエラーと共に返す
+  const std::string result = to_result_json(ret, combinations, value_list);
+  release_topologies(MAX_CACHED_NUM_LEAFS);
   return result;
 }
 
@@ -79,35 +284,218 @@ std::string findDividers(const std::vector<double>& element_values,
                          double total_min, double total_max,
                          double target_value, double target_min,
                          double target_max) {
-  std::vector<value_t> val_vec;
-  for (const auto& v : element_values) {
-    val_vec.push_back(static_cast<value_t>(v));
+  ValueList value_list = to_value_list(element_values);
+  std::vector<DoubleCombination> combinations;
+  auto ret = search_dividers(value_list, num_elems_min, num_elems_max,
+                             topology_constraint, max_depth, total_min,
+                             total_max, target_value, target_min, target_max,
+                             SearchShard(), combinations);
+  if (ret != result_t::SUCCESS && !is_partial_result(ret)) {
+    return std::string("{\"error\":\"") + result_to_string(ret) + "\"}";
   }
-  ValueList value_list(val_vec);
 
-  DividerSearchArgs args(value_list, num_elems_min, num_elems_max, total_min,
-                         total_max, target_value, target_min, target_max);
+  // 予算を超えたか中止した場合は途中までの結果をエラーと共に返す
+  const std::string result = to_result_json(ret, combinations, value_list);
+  release_topologies(MAX_CACHED_NUM_LEAFS);
+  return result;
+}
+
+// shard_index / num_shards で探索を分担する部分を指定する (全体なら 0 / 1)
+// 部分の結果は各部分の中で最良のもので、JS 側で統合する
+emscripten::val findCombinationsBinary(
+    bool capacitor, uintptr_t values_ptr, int num_values, int num_elems_min,
+    int num_elems_max, int topology_constraint, int max_depth,
+    double target_value, double target_min, double target_max,
+    int shard_index, int num_shards) {
+  ValueList value_list = adopt_value_list(values_ptr, num_values);
+  std::vector<Combination> combinations;
+  auto ret = search_combinations(capacitor, value_list, num_elems_min,
+                                 num_elems_max, topology_constraint, max_depth,
+                                 target_value, target_min, target_max,
+                                 SearchShard{shard_index, num_shards},
+                                 combinations);
+  if (ret != result_t::SUCCESS && !is_partial_result(ret)) {
+    return to_error_binary(ret);
+  }
+
+  emscripten::val result = to_result_binary(ret, combinations, value_list);
+  release_topologies(MAX_CACHED_NUM_LEAFS);
+  return result;
+}
+
+emscripten::val findDividersBinary(uintptr_t values_ptr, int num_values,
+                                   int num_elems_min, int num_elems_max,
+                                   int topology_constraint, int max_depth,
+                                   double total_min, double total_max,
+                                   double target_value, double target_min,
+                                   double target_max, int shard_index,
+                                   int num_shards) {
+  ValueList value_list = adopt_value_list(values_ptr, num_values);
+  std::vector<DoubleCombination> combinations;
+  auto ret = search_dividers(value_list, num_elems_min, num_elems_max,
+                             topology_constraint, max_depth, total_min,
+                             total_max, target_value, target_min, target_max,
+                             SearchShard{shard_index, num_shards},
+                             combinations);
+  if (ret != result_t::SUCCESS && !is_partial_result(ret)) {
+    return to_error_binary(ret);
+  }
+
+  emscripten::val result = to_result_binary(ret, combinations, value_list);
+  release_topologies(MAX_CACHED_NUM_LEAFS);
+  return result;
+}
+
+// 時分割で進める組み合わせ・分圧抵抗の探索
+// (ワーカーは stepSearch() の合間に新しい要求を受け取れる)
+static SearchTask search_task;
+
+// search_task が使う値の一覧
+// (探索中に JS 側が素子の値の領域を書き換えても影響しないようにコピーする)
+static std::unique_ptr<ValueList> search_task_values;
+
+// 分圧抵抗の探索か
+static bool search_is_divider = false;
+
+// 候補のキャッシュから答えた場合の結果 (search_task の代わりに返す)
+static bool search_from_cache = false;
+static result_t cached_search_status = result_t::SUCCESS;
+static std::vector<Combination> cached_search_results;
+static std::vector<DoubleCombination> cached_divider_results;
+
+// 探索を結果を取らずに破棄する
+void abortSearch() {
+  search_task.reset();
+  search_is_divider = false;
+  search_from_cache = false;
+  cached_search_results.clear();
+  cached_divider_results.clear();
+  release_topologies(MAX_CACHED_NUM_LEAFS);
+}
+
+// 探索を始める (前の探索が残っていれば破棄する)
+// 前回と同じ条件で目標値や許容誤差だけが変わった場合は、候補のキャッシュから
+// その場で答える
+// 引数は findCombinationsBinary と同じ
+void startCombinationSearch(bool capacitor, uintptr_t values_ptr,
+                            int num_values, int num_elems_min,
+                            int num_elems_max, int topology_constraint,
+                            int max_depth, double target_value,
+                            double target_min, double target_max,
+                            int shard_index, int num_shards) {
+  abortSearch();
+  const value_t* values = reinterpret_cast<const value_t*>(values_ptr);
+  search_task_values = std::make_unique<ValueList>(
+      std::vector<value_t>(values, values + num_values));
+
+  auto type = capacitor ? ComponentType::Capacitor : ComponentType::Resistor;
+  CombinationSearchArgs args(type, *search_task_values, num_elems_min,
+                             num_elems_max, target_value, target_min,
+                             target_max);
   args.topology_constraint =
       static_cast<topology_constraint_t>(topology_constraint);
   args.max_depth = max_depth;
+  args.memory_budget = MEMORY_BUDGET;
+  args.shard = SearchShard{shard_index, num_shards};
+  begin_search();
+  if (candidate_cache->prepare(args)) {
+    search_from_cache = true;
+    cached_search_status =
+        candidate_cache->search_combinations(args, cached_search_results);
+    return;
+  }
+  search_task = create_search_task(searcher, args);
+  search_task->start();
+}
 
+// 分圧抵抗の探索を始める (前の探索が残っていれば破棄する)
+// 候補のキャッシュから答えられる場合は startCombinationSearch と同じ
+// 引数は findDividersBinary と同じ
+void startDividerSearch(uintptr_t values_ptr, int num_values,
+                        int num_elems_min, int num_elems_max,
+                        int topology_constraint, int max_depth,
+                        double total_min, double total_max,
+                        double target_value, double target_min,
+                        double target_max, int shard_index, int num_shards) {
+  abortSearch();
+  const value_t* values = reinterpret_cast<const value_t*>(values_ptr);
+  search_task_values = std::make_unique<ValueList>(
+      std::vector<value_t>(values, values + num_values));
+
+  DividerSearchArgs args(*search_task_values, num_elems_min, num_elems_max,
+                         total_min, total_max, target_value, target_min,
+                         target_max);
+  args.topology_constraint =
+      static_cast<topology_constraint_t>(topology_constraint);
+  args.max_depth = max_depth;
+  args.memory_budget = MEMORY_BUDGET;
+  args.shard = SearchShard{shard_index, num_shards};
+  begin_search();
+  search_is_divider = true;
+  if (candidate_cache->prepare(args)) {
+    search_from_cache = true;
+    cached_search_status =
+        candidate_cache->search_dividers(args, cached_divider_results);
+    return;
+  }
+  search_task = create_search_task(searcher, args);
+  search_task->start();
+}
+
+// 探索を budget_ms [ms] 程度進め、終わったら true を返す
+bool stepSearch(double budget_ms) {
+  if (search_from_cache || !search_task) return true;
+  return search_task->step(budget_ms);
+}
+
+// 分圧抵抗の探索の結果を findDividersBinary と同じ形式で返す
+static emscripten::val take_divider_results_binary() {
   std::vector<DoubleCombination> combinations;
-  auto ret = rcmb::search_dividers(args, combinations);
-  if (ret != result_t::SUCCESS) {
-    return std::string("{\"error\":\"") + result_to_string(ret) + "\"}";
+  result_t ret;
+  if (search_from_cache) {
+    combinations.swap(cached_divider_results);
+    ret = cached_search_status;
+  } else if (search_task) {
+    ret = search_task->results(combinations);
+  } else {
+    return to_error_binary(result_t::SEARCH_CANCELLED);
+  }
+  if (ret != result_t::SUCCESS && ret != result_t::SEARCH_IN_PROGRESS &&
+      !is_partial_result(ret)) {
+    abortSearch();
+    return to_error_binary(ret);
   }
 
-  std::string result = "{\"result\":[";
-  for (size_t i = 0; i < combinations.size(); i++) {
-    const auto& comb = combinations[i];
-    if (i > 0) {
-      result += ",";
-    }
-    result += comb->to_json_string();
+  emscripten::val result =
+      to_result_binary(ret, combinations, *search_task_values);
+  abortSearch();
+  return result;
+}
+
+// 探索の結果を findCombinationsBinary (分圧抵抗なら findDividersBinary) と
+// 同じ形式で返し、探索を破棄する
+// (探索中なら、それまでの最良のものをエラーと共に返す)
+emscripten::val takeSearchResultsBinary() {
+  if (search_is_divider) return take_divider_results_binary();
+  std::vector<Combination> combinations;
+  result_t ret;
+  if (search_from_cache) {
+    combinations.swap(cached_search_results);
+    ret = cached_search_status;
+  } else if (search_task) {
+    ret = search_task->results(combinations);
+  } else {
+    return to_error_binary(result_t::SEARCH_CANCELLED);
+  }
+  if (ret != result_t::SUCCESS && ret != result_t::SEARCH_IN_PROGRESS &&
+      !is_partial_result(ret)) {
+    abortSearch();
+    return to_error_binary(ret);
   }
-  result += "],";
-  result += "\"meta\":" + get_meta_info_json();
-  result += "}";
+
+  emscripten::val result =
+      to_result_binary(ret, combinations, *search_task_values);
+  abortSearch();
   return result;
 }
 
@@ -115,4 +503,14 @@ EMSCRIPTEN_BINDINGS(RccombCore) {
   emscripten::register_vector<double>("VectorDouble");
   emscripten::function("findCombinations", &findCombinations);
   emscripten::function("findDividers", &findDividers);
+  emscripten::function("getElementValueBuffer", &getElementValueBuffer);
+  emscripten::function("findCombinationsBinary", &findCombinationsBinary);
+  emscripten::function("findDividersBinary", &findDividersBinary);
+  emscripten::function("getCancelFlag", &getCancelFlag);
+  emscripten::function("setProgressCallback", &setProgressCallback);
+  emscripten::function("startCombinationSearch", &startCombinationSearch);
+  emscripten::function("startDividerSearch", &startDividerSearch);
+  emscripten::function("stepSearch", &stepSearch);
+  emscripten::function("takeSearchResultsBinary", &takeSearchResultsBinary);
+  emscripten::function("abortSearch", &abortSearch);
 }